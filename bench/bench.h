@@ -0,0 +1,153 @@
+#ifndef _INCLUDE_BENCH_
+#define _INCLUDE_BENCH_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+#include "logging/logger.hpp"
+
+/*
+ * Minimal benchmark harness. Each bench_* executable runs a fixed set of
+ * scenarios and prints one JSON document on stdout:
+ *
+ *     {"benchmarks": [{"name": "...", "params": {...}, "metrics": {...}}, ...]}
+ *
+ * Metric names carry their direction for scripts/perfcheck.py: "*_ns" and
+ * "*_ratio" are lower-is-better, "*_per_sec" and "*_gbps" higher-is-better.
+ * `--scale F` multiplies the iteration counts.
+ */
+
+typedef std::vector<std::pair<std::string, double>> BenchValues;
+
+static inline uint64_t bench_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+class LatencySamples
+{
+public:
+    explicit LatencySamples(size_t reserve = 0) : sorted(true)
+    {
+        samples.reserve(reserve);
+    }
+
+    inline void add(uint64_t ns)
+    {
+        samples.push_back(ns);
+        sorted = false;
+    }
+
+    void merge(const LatencySamples& other)
+    {
+        samples.insert(samples.end(), other.samples.begin(), other.samples.end());
+        sorted = false;
+    }
+
+    size_t size() const
+    {
+        return samples.size();
+    }
+
+    double percentile(double q)
+    {
+        if (samples.empty())
+            return 0;
+        if (!sorted) {
+            std::sort(samples.begin(), samples.end());
+            sorted = true;
+        }
+        size_t rank = (size_t)(q * samples.size());
+        if (rank >= samples.size()) rank = samples.size() - 1;
+        return samples[rank];
+    }
+
+    double mean() const
+    {
+        if (samples.empty())
+            return 0;
+        double sum = 0;
+        for (auto v : samples) sum += v;
+        return sum / samples.size();
+    }
+
+private:
+    std::vector<uint64_t> samples;
+    bool sorted;
+};
+
+class BenchReport
+{
+public:
+    BenchReport(int argc, const char** argv) : scale(1)
+    {
+        for (int i = 1; i + 1 < argc; ++i) {
+            if (strcmp(argv[i], "--scale") == 0)
+                scale = atof(argv[i + 1]);
+        }
+        if (scale <= 0) scale = 1;
+        // keep stderr for the summary, a non-blocking tty logs every EAGAIN
+        logging::get_global_logger().set_level(logging::LogLevel::FATAL);
+    }
+
+    // iteration count scaled by --scale, at least 1
+    size_t count(size_t n) const
+    {
+        size_t scaled = (size_t)(n * scale);
+        return scaled ? scaled : 1;
+    }
+
+    void add(const std::string& name, const BenchValues& params, const BenchValues& metrics)
+    {
+        Entry entry = {name, params, metrics};
+        entries.push_back(entry);
+        fprintf(stderr, "%s:", name.c_str());
+        for (auto& metric : metrics)
+            fprintf(stderr, " %s=%.6g", metric.first.c_str(), metric.second);
+        fputc('\n', stderr);
+    }
+
+    void print() const
+    {
+        printf("{\"benchmarks\": [");
+        for (size_t i = 0; i < entries.size(); ++i) {
+            printf("%s\n  {\"name\": \"%s\", \"params\": ", i ? "," : "", entries[i].name.c_str());
+            print_values(entries[i].params);
+            printf(", \"metrics\": ");
+            print_values(entries[i].metrics);
+            printf("}");
+        }
+        printf("\n]}\n");
+        fflush(stdout);
+    }
+
+private:
+    struct Entry
+    {
+        std::string name;
+        BenchValues params;
+        BenchValues metrics;
+    };
+
+    static void print_values(const BenchValues& values)
+    {
+        printf("{");
+        for (size_t i = 0; i < values.size(); ++i) {
+            printf("%s\"%s\": %.6g", i ? ", " : "", values[i].first.c_str(), values[i].second);
+        }
+        printf("}");
+    }
+
+    double scale;
+    std::vector<Entry> entries;
+};
+
+#endif
@@ -0,0 +1,71 @@
+#include <stdint.h>
+#include <vector>
+#include "transport/base.hpp"
+#include "transport/protocol.hpp"
+#include "bench.h"
+
+using namespace transport;
+
+// hands every sent frame straight back to the receive queue
+class LoopbackTransport: public BaseTransport<Protocol> {
+protected:
+    void send_backend() override {
+        while (!is_closed) {
+            FrameEntry entry = send_que.Pop();
+            deliver(std::move(entry.first), std::move(entry.second));
+        }
+    }
+
+    void receive_backend() override {}
+};
+
+static void bench_round_trip(BenchReport& report, size_t size, size_t rounds)
+{
+    LoopbackTransport t;
+    t.open();
+    LatencySamples rtt(rounds);
+    std::vector<uint8_t> payload(size, 0x5a);
+    for (size_t i = 0; i < rounds; ++i) {
+        uint64_t start = bench_now();
+        t.send(payload);
+        t.receive(std::chrono::seconds(1));
+        rtt.add(bench_now() - start);
+    }
+    t.close();
+
+    report.add("base/rtt/" + std::to_string(size),
+        {{"payload", (double)size}, {"rounds", (double)rounds}},
+        {{"p50_ns", rtt.percentile(0.5)},
+         {"p99_ns", rtt.percentile(0.99)}});
+}
+
+static void bench_pipeline(BenchReport& report, size_t size, size_t frames)
+{
+    LoopbackTransport t;
+    t.open();
+    std::vector<uint8_t> payload(size, 0x5a);
+    uint64_t start = bench_now();
+    std::thread sender([&]() {
+        for (size_t i = 0; i < frames; ++i)
+            t.send(payload);
+    });
+    for (size_t i = 0; i < frames; ++i)
+        t.receive(std::chrono::seconds(1));
+    uint64_t elapsed = bench_now() - start;
+    sender.join();
+    t.close();
+
+    report.add("base/pipeline/" + std::to_string(size),
+        {{"payload", (double)size}, {"frames", (double)frames}},
+        {{"frames_per_sec", frames * 1e9 / elapsed}});
+}
+
+int main(int argc, const char** argv)
+{
+    BenchReport report(argc, argv);
+    bench_round_trip(report, 64, report.count(20000));
+    bench_round_trip(report, 4096, report.count(20000));
+    bench_pipeline(report, 64, report.count(200000));
+    report.print();
+    return 0;
+}
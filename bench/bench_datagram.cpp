@@ -0,0 +1,21 @@
+#include "transport/udp.hpp"
+#include "transport/protocol.hpp"
+#include "datagram.h"
+
+using namespace transport;
+
+int main(int argc, const char** argv)
+{
+    BenchReport report(argc, argv);
+    DatagramTransport<Protocol> server;
+    server.open();
+    server.bind("127.0.0.1", 22345);
+
+    DatagramTransport<Protocol> client;
+    client.open();
+    client.connect("127.0.0.1", 22345);
+
+    bench_datagram(report, "udp", server, client);
+    report.print();
+    return 0;
+}
@@ -0,0 +1,90 @@
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include "dataqueue.hpp"
+#include "bench.h"
+
+#define BENCH_QUEUE_STOP UINT64_MAX
+
+// saturated queue, p50/p99 are the cost of a Push under contention
+static void bench_threads(BenchReport& report, int producers, int consumers, size_t total)
+{
+    DataQueue<uint64_t> que;
+    size_t per_producer = total / producers;
+    std::vector<LatencySamples> push_time(producers);
+    std::vector<std::thread> threads;
+
+    for (int i = 0; i < consumers; ++i) {
+        threads.emplace_back([&que]() {
+            while (que.Pop() != BENCH_QUEUE_STOP) {}
+        });
+    }
+
+    uint64_t start = bench_now();
+    std::vector<std::thread> senders;
+    for (int i = 0; i < producers; ++i) {
+        push_time[i] = LatencySamples(per_producer);
+        senders.emplace_back([&que, &push_time, i, per_producer]() {
+            for (size_t n = 0; n < per_producer; ++n) {
+                uint64_t begin = bench_now();
+                que.Push(n);
+                push_time[i].add(bench_now() - begin);
+            }
+        });
+    }
+    for (auto& t : senders) t.join();
+    for (int i = 0; i < consumers; ++i) que.Push(BENCH_QUEUE_STOP);
+    for (auto& t : threads) t.join();
+    uint64_t elapsed = bench_now() - start;
+
+    LatencySamples merged;
+    for (auto& samples : push_time) merged.merge(samples);
+
+    size_t items = per_producer * producers;
+    report.add("dataqueue/p" + std::to_string(producers) + "c" + std::to_string(consumers),
+        {{"producers", (double)producers}, {"consumers", (double)consumers}, {"items", (double)items}},
+        {{"ops_per_sec", items * 1e9 / elapsed},
+         {"push_p50_ns", merged.percentile(0.5)},
+         {"push_p99_ns", merged.percentile(0.99)}});
+}
+
+// Push to Pop wake-up latency, bounced between two queues
+static void bench_handoff(BenchReport& report, size_t rounds)
+{
+    DataQueue<uint64_t> ping, pong;
+    std::thread echo([&]() {
+        uint64_t value;
+        while ((value = ping.Pop()) != BENCH_QUEUE_STOP)
+            pong.Push(value);
+    });
+
+    LatencySamples rtt(rounds);
+    for (size_t i = 0; i < rounds; ++i) {
+        uint64_t start = bench_now();
+        ping.Push(i);
+        pong.Pop();
+        rtt.add(bench_now() - start);
+    }
+    ping.Push(BENCH_QUEUE_STOP);
+    echo.join();
+
+    report.add("dataqueue/handoff", {{"rounds", (double)rounds}},
+        {{"p50_ns", rtt.percentile(0.5) / 2},
+         {"p99_ns", rtt.percentile(0.99) / 2}});
+}
+
+int main(int argc, const char** argv)
+{
+    BenchReport report(argc, argv);
+    size_t total = report.count(200000);
+    const int threads[] = {1, 2, 4, 8, 16};
+    for (int n : threads) {
+        bench_threads(report, n, n, total);
+    }
+    bench_threads(report, 4, 1, total);
+    bench_threads(report, 1, 4, total);
+    bench_handoff(report, report.count(20000));
+    report.print();
+    return 0;
+}
@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <streambuf>
+#include <thread>
+#include <vector>
+#include "logging/logger.hpp"
+#include "logging/binary.hpp"
+#include "logging/file_sink.hpp"
+#include "logging/ratelimit.hpp"
+#include "bench.h"
+
+// formats everything and throws it away
+class NullBuf : public std::streambuf
+{
+protected:
+    int overflow(int c) override { return c; }
+    std::streamsize xsputn(const char*, std::streamsize n) override { return n; }
+};
+
+template <typename F>
+static void bench_logger(BenchReport& report, const std::string& name, int threads, size_t count, F log_one)
+{
+    std::vector<LatencySamples> samples(threads);
+    std::vector<std::thread> workers;
+    uint64_t start = bench_now();
+    for (int t = 0; t < threads; ++t) {
+        samples[t] = LatencySamples(count);
+        workers.emplace_back([&samples, &log_one, t, count]() {
+            for (size_t i = 0; i < count; ++i) {
+                uint64_t begin = bench_now();
+                log_one(i);
+                samples[t].add(bench_now() - begin);
+            }
+        });
+    }
+    for (auto& w : workers) w.join();
+    uint64_t elapsed = bench_now() - start;
+
+    LatencySamples merged;
+    for (auto& s : samples) merged.merge(s);
+    report.add("logging/" + name + "/t" + std::to_string(threads),
+        {{"threads", (double)threads}, {"messages", (double)count * threads}},
+        {{"msgs_per_sec", count * threads * 1e9 / elapsed},
+         {"p50_ns", merged.percentile(0.5)},
+         {"p99_ns", merged.percentile(0.99)}});
+}
+
+int main(int argc, const char** argv)
+{
+    BenchReport report(argc, argv);
+    size_t count = report.count(100000);
+    const int threads[] = {1, 4};
+
+    NullBuf null_buf;
+    std::ostream null_stream(&null_buf);
+    logging::Logger text(logging::LogLevel::INFO);
+    text.add_stream(null_stream);
+
+    const char* log_path = "/tmp/transport_bench.log";
+    logging::Logger file(logging::LogLevel::INFO);
+    file.add_stream(logging::MappedFileStream(log_path, 256 << 20, 1));
+
+    const char* bin_path = "/tmp/transport_bench.bin";
+    logging::BinaryLogger binary(logging::LogLevel::INFO);
+    binary.open(bin_path);
+
+    logging::RateLimiter limiter(1, 1);
+
+    for (int n : threads) {
+        bench_logger(report, "filtered", n, count, [&](size_t i) {
+            text.debug("frame %zu sent (%d bytes)", i, 64);
+        });
+        bench_logger(report, "text", n, count, [&](size_t i) {
+            text.info("frame %zu sent (%d bytes)", i, 64);
+        });
+        bench_logger(report, "file", n, count, [&](size_t i) {
+            file.info("frame %zu sent (%d bytes)", i, 64);
+        });
+        bench_logger(report, "binary", n, count, [&](size_t i) {
+            log_binary(binary, logging::LogLevel::INFO, "frame %zu sent (%d bytes)", i, 64);
+        });
+        bench_logger(report, "ratelimited", n, count, [&](size_t i) {
+            limiter.log(text, logging::LogLevel::INFO, "frame %zu sent (%d bytes)", i, 64);
+        });
+    }
+    report.print();
+
+    binary.close();
+    for (int i = 0; i < 8; ++i)
+        unlink((std::string(bin_path) + "." + std::to_string(i)).c_str());
+    unlink(log_path);
+    return 0;
+}
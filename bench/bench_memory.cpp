@@ -0,0 +1,18 @@
+#include "transport/memory.hpp"
+#include "transport/protocol.hpp"
+#include "datagram.h"
+
+using namespace transport;
+
+int main(int argc, const char** argv)
+{
+    BenchReport report(argc, argv);
+    auto pair = MemoryTransport<Protocol>::make_pair();
+    pair.first->open();
+    pair.second->open();
+
+    // the datagram scenarios without the kernel in the way
+    bench_datagram(report, "memory", *pair.second, *pair.first);
+    report.print();
+    return 0;
+}
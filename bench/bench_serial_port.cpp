@@ -0,0 +1,129 @@
+#include <pty.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <atomic>
+#include <thread>
+#include "transport/serial_port.hpp"
+#include "bench.h"
+
+using namespace transport;
+
+// 2-byte little endian length prefix, so frames survive the byte stream
+class LengthProtocol {
+public:
+    typedef std::vector<uint8_t> FrameType;
+
+    static ssize_t pred_size(void* buf, size_t size) {
+        if (buf == nullptr) return 2;
+        if (size < 2) return 0;
+        const uint8_t* p = static_cast<const uint8_t*>(buf);
+        return 2 + (p[0] | (p[1] << 8));
+    }
+
+    static FrameType make_frame(void* buf, size_t size) {
+        if (buf == nullptr) return FrameType();
+        return FrameType((uint8_t*)buf, (uint8_t*)buf + size);
+    }
+
+    static size_t frame_size(const FrameType& frame) {
+        return frame.size();
+    }
+
+    static void* frame_data(const FrameType& frame) {
+        return (void*)frame.data();
+    }
+
+    static FrameType build(size_t payload) {
+        FrameType frame(payload + 2, 0x5a);
+        frame[0] = payload & 0xff;
+        frame[1] = payload >> 8;
+        return frame;
+    }
+};
+
+typedef SerialPortTransport<LengthProtocol> SerialTransport;
+
+struct PtyPair {
+    int master;
+    int slave;
+
+    PtyPair() {
+        struct termios raw;
+        memset(&raw, 0, sizeof(raw));
+        cfmakeraw(&raw);
+        if (openpty(&master, &slave, nullptr, &raw, nullptr) < 0) {
+            perror("openpty");
+            exit(1);
+        }
+        fcntl(master, F_SETFL, fcntl(master, F_GETFL) | O_NONBLOCK);
+        fcntl(slave, F_SETFL, fcntl(slave, F_GETFL) | O_NONBLOCK);
+    }
+};
+
+// both ends have to be open before the first frame, open() flushes the tty
+static void bench_ping_pong(BenchReport& report, size_t size, size_t rounds)
+{
+    PtyPair pty;
+    SerialTransport a(pty.master, 115200, 64 * 1024), b(pty.slave, 115200, 64 * 1024);
+    a.open();
+    b.open();
+    std::atomic<bool> done(false);
+    std::thread echo([&]() {
+        while (!done) {
+            try {
+                auto frame_pair = b.receive(std::chrono::milliseconds(100));
+                b.send(std::move(frame_pair.first));
+            } catch (const QueueTimeout&) {}
+        }
+    });
+
+    LatencySamples rtt(rounds);
+    auto frame = LengthProtocol::build(size);
+    for (size_t i = 0; i < rounds; ++i) {
+        uint64_t start = bench_now();
+        a.send(frame);
+        a.receive(std::chrono::seconds(1));
+        rtt.add(bench_now() - start);
+    }
+    done = true;
+    echo.join();
+
+    report.add("serial/rtt/" + std::to_string(size),
+        {{"payload", (double)size}, {"rounds", (double)rounds}},
+        {{"p50_ns", rtt.percentile(0.5)},
+         {"p99_ns", rtt.percentile(0.99)}});
+}
+
+static void bench_throughput(BenchReport& report, size_t size, size_t frames)
+{
+    PtyPair pty;
+    SerialTransport a(pty.master, 115200, 64 * 1024), b(pty.slave, 115200, 64 * 1024);
+    a.open();
+    b.open();
+
+    auto frame = LengthProtocol::build(size);
+    uint64_t start = bench_now();
+    std::thread sender([&]() {
+        for (size_t i = 0; i < frames; ++i)
+            a.send(frame);
+    });
+    size_t bytes = 0;
+    for (size_t i = 0; i < frames; ++i)
+        bytes += b.receive(std::chrono::seconds(1)).first.size();
+    uint64_t elapsed = bench_now() - start;
+    sender.join();
+
+    report.add("serial/throughput/" + std::to_string(size),
+        {{"payload", (double)size}, {"frames", (double)frames}},
+        {{"frames_per_sec", frames * 1e9 / elapsed},
+         {"gbps", bytes * 8.0 / elapsed}});
+}
+
+int main(int argc, const char** argv)
+{
+    BenchReport report(argc, argv);
+    bench_ping_pong(report, 64, report.count(2000));
+    bench_throughput(report, 256, report.count(20000));
+    report.print();
+    return 0;
+}
@@ -0,0 +1,19 @@
+#include "transport/unix_udp.hpp"
+#include "transport/protocol.hpp"
+#include "datagram.h"
+
+using namespace transport;
+
+int main(int argc, const char** argv)
+{
+    BenchReport report(argc, argv);
+    // the unix transport defaults to 1KB receive buffers
+    UnixDatagramTransport<Protocol> server("/tmp/transport_bench.sock", "", 64 * 1024);
+    UnixDatagramTransport<Protocol> client("/tmp/transport_bench1.sock", "/tmp/transport_bench.sock", 64 * 1024);
+    server.open();
+    client.open();
+
+    bench_datagram(report, "unix", server, client);
+    report.print();
+    return 0;
+}
@@ -0,0 +1,141 @@
+#ifndef _INCLUDE_BENCH_DATAGRAM_
+#define _INCLUDE_BENCH_DATAGRAM_
+
+#include <stdint.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include "dataqueue.hpp"
+#include "bench.h"
+
+/*
+ * Scenarios shared by the datagram and memory benchmarks. The transports are created
+ * once by the caller and reused, frames left over from a previous scenario
+ * are drained first.
+ */
+
+#define BENCH_DATAGRAM_WINDOW 256
+
+template <typename T>
+static void bench_drain(T& transport)
+{
+    try {
+        while (true)
+            transport.receive(std::chrono::milliseconds(20));
+    } catch (const QueueTimeout&) {}
+}
+
+// client -> server -> client, one frame in flight
+template <typename T>
+static void bench_ping_pong(BenchReport& report, const std::string& prefix, T& server, T& client,
+                            size_t size, size_t rounds)
+{
+    bench_drain(server);
+    bench_drain(client);
+    std::atomic<bool> done(false);
+    std::thread echo([&]() {
+        while (!done) {
+            try {
+                auto frame_pair = server.receive(std::chrono::milliseconds(100));
+                server.send(std::move(frame_pair.first), frame_pair.second);
+            } catch (const QueueTimeout&) {}
+        }
+    });
+
+    LatencySamples rtt(rounds);
+    std::vector<uint8_t> payload(size, 0x5a);
+    size_t lost = 0;
+    for (size_t i = 0; i < rounds; ++i) {
+        uint64_t start = bench_now();
+        client.send(payload);
+        try {
+            client.receive(std::chrono::milliseconds(100));
+            rtt.add(bench_now() - start);
+        } catch (const QueueTimeout&) {
+            ++lost;
+        }
+    }
+    done = true;
+    echo.join();
+
+    report.add(prefix + "/rtt/" + std::to_string(size),
+        {{"payload", (double)size}, {"rounds", (double)rounds}},
+        {{"p50_ns", rtt.percentile(0.5)},
+         {"p99_ns", rtt.percentile(0.99)},
+         {"loss_ratio", (double)lost / rounds}});
+}
+
+/*
+ * One-way throughput. The sender keeps at most BENCH_DATAGRAM_WINDOW frames
+ * ahead of the receiver so the send queue does not simply buffer the whole
+ * run; if the receiver makes no progress for a while the frames are assumed
+ * lost and the sender moves on.
+ */
+template <typename T>
+static void bench_throughput(BenchReport& report, const std::string& prefix, T& server, T& client,
+                             size_t size, size_t frames)
+{
+    bench_drain(server);
+    std::atomic<size_t> received(0);
+    std::atomic<bool> sent_all(false);
+    uint64_t last_receive = 0;
+    size_t bytes = 0;
+    std::thread receiver([&]() {
+        while (received < frames) {
+            try {
+                auto frame_pair = server.receive(std::chrono::milliseconds(100));
+                last_receive = bench_now();
+                bytes += frame_pair.first.size();
+                received.fetch_add(1, std::memory_order_release);
+            } catch (const QueueTimeout&) {
+                if (sent_all) break;
+            }
+        }
+    });
+
+    std::vector<uint8_t> payload(size, 0x5a);
+    uint64_t start = bench_now();
+    size_t assumed_lost = 0;
+    for (size_t i = 0; i < frames; ++i) {
+        uint64_t stall = bench_now();
+        size_t seen = received.load(std::memory_order_acquire);
+        while (i >= assumed_lost + seen + BENCH_DATAGRAM_WINDOW) {
+            std::this_thread::yield();
+            size_t curr = received.load(std::memory_order_acquire);
+            if (curr != seen) {
+                seen = curr;
+                stall = bench_now();
+            } else if (bench_now() - stall > 20000000) {
+                assumed_lost = i - seen;
+                break;
+            }
+        }
+        client.send(payload);
+    }
+    sent_all = true;
+    receiver.join();
+
+    size_t count = received.load();
+    double elapsed = last_receive > start ? last_receive - start : 1;
+    report.add(prefix + "/throughput/" + std::to_string(size),
+        {{"payload", (double)size}, {"frames", (double)frames}},
+        {{"frames_per_sec", count * 1e9 / elapsed},
+         {"gbps", bytes * 8 / elapsed},
+         {"loss_ratio", 1 - (double)count / frames}});
+}
+
+template <typename T>
+static void bench_datagram(BenchReport& report, const std::string& prefix, T& server, T& client)
+{
+    bench_ping_pong(report, prefix, server, client, 64, report.count(10000));
+    const size_t sizes[] = {64, 512, 1400, 8192, 32768};
+    for (size_t size : sizes) {
+        // keep each run around 64MB of payload
+        size_t frames = report.count((64 << 20) / size);
+        if (frames > report.count(200000)) frames = report.count(200000);
+        bench_throughput(report, prefix, server, client, size, frames);
+    }
+}
+
+#endif
@@ -1,8 +1,12 @@
 #ifndef _INCLUDED_QUEUE_
 #define _INCLUDED_QUEUE_
 
+#include <stdint.h>
+#include <algorithm>
 #include <deque>
+#include <memory>
 #include <mutex>
+#include <vector>
 #include <chrono>
 #include <condition_variable>
 #include <stdexcept>
@@ -49,10 +53,55 @@ public:
 
 typedef uint8_t queue_epoch_t;
 
+/*
+ * A wakeup shared by several queues, so one thread can wait for any of them.
+ * The sequence number changes on every push; a waiter reads it, scans the
+ * queues with TryPop, then waits for it to move on, so a push between the
+ * scan and the wait is never missed.
+ */
+class QueueNotifier
+{
+public:
+    QueueNotifier() : m_Sequence(0) {}
+    QueueNotifier(const QueueNotifier&) = delete;
+
+    void Notify() noexcept
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Sequence++;
+        m_Cond.notify_all();
+    }
+
+    uint64_t Sequence() noexcept
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        return m_Sequence;
+    }
+
+    // false if the sequence is still `seen` after `timeout`
+    template <typename Rep = uint64_t, typename Period = std::milli>
+    bool Wait(uint64_t seen, const std::chrono::duration<Rep, Period> timeout)
+    {
+        std::unique_lock<std::mutex> lock(m_Mutex);
+        return m_Cond.wait_for(lock, timeout, [this, seen] { return m_Sequence != seen; });
+    }
+
+    void Wait(uint64_t seen)
+    {
+        std::unique_lock<std::mutex> lock(m_Mutex);
+        m_Cond.wait(lock, [this, seen] { return m_Sequence != seen; });
+    }
+
+private:
+    std::mutex m_Mutex;
+    std::condition_variable m_Cond;
+    uint64_t m_Sequence;
+};
+
 template <typename T>
 class DataQueue {
 public:
-    DataQueue() : m_CurrEpoch(0) {}
+    DataQueue() : m_HighWater(0), m_CurrEpoch(0) {}
     DataQueue(const DataQueue&) = delete;
 
     ~DataQueue() { Clear(); }
@@ -61,7 +110,11 @@ public:
     {
         std::lock_guard<std::mutex> lock(m_Mutex);
         m_Queue.push_back(std::move(data));
+        if (m_Queue.size() > m_HighWater)
+            m_HighWater = m_Queue.size();
         m_Cond.notify_one();
+        for (auto& notifier : m_Notifiers)
+            notifier->Notify();
     }
 
     T Pop()
@@ -99,6 +152,30 @@ public:
         return data;
     }
 
+    // pops without waiting, false if the queue is empty
+    bool TryPop(T& data)
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        if (m_Queue.empty())
+            return false;
+        data = std::move(m_Queue.front());
+        m_Queue.pop_front();
+        return true;
+    }
+
+    // also wakes `notifier` on every Push and Clear
+    void AddNotifier(std::shared_ptr<QueueNotifier> notifier)
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Notifiers.push_back(std::move(notifier));
+    }
+
+    void RemoveNotifier(const std::shared_ptr<QueueNotifier>& notifier)
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Notifiers.erase(std::remove(m_Notifiers.begin(), m_Notifiers.end(), notifier), m_Notifiers.end());
+    }
+
     bool Empty() noexcept
     {
         std::lock_guard<std::mutex> lock(m_Mutex);
@@ -111,6 +188,19 @@ public:
         return m_Queue.size();
     }
 
+    // largest size seen since construction or the last ResetHighWater
+    size_t HighWater() noexcept
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        return m_HighWater;
+    }
+
+    void ResetHighWater() noexcept
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_HighWater = m_Queue.size();
+    }
+
     queue_epoch_t GetEpoch() noexcept
     {
         std::lock_guard<std::mutex> lock(m_Mutex);
@@ -129,15 +219,19 @@ public:
         m_Queue.clear();
         m_CurrEpoch++;
         m_Cond.notify_all();
+        for (auto& notifier : m_Notifiers)
+            notifier->Notify();
     }
 
 protected:
     std::deque<T> m_Queue;
     std::mutex m_Mutex;
     std::condition_variable m_Cond;
+    size_t m_HighWater;
 
 private:
     queue_epoch_t m_CurrEpoch;
+    std::vector<std::shared_ptr<QueueNotifier>> m_Notifiers;
 };
 
 #endif
\ No newline at end of file
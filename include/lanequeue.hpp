@@ -0,0 +1,233 @@
+#ifndef _INCLUDED_LANE_QUEUE_
+#define _INCLUDED_LANE_QUEUE_
+
+#include <array>
+#include <deque>
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+#include "dataqueue.hpp"
+
+/*
+ * Lane choice of MultiLaneQueue, for schedulers keeping their own lanes:
+ * the highest ready lane, or with weights, up to `weight` picks per lane and
+ * cycle, higher lanes first. A lane with weight 0 stays strict, it goes
+ * ahead of the weighted lanes whenever it has items. Not thread safe.
+ */
+template <size_t N>
+class LaneSelector {
+public:
+    typedef std::array<unsigned, N> Weights;
+
+    LaneSelector() : m_Weighted(false)
+    {
+        m_Weights.fill(0);
+        m_Credits.fill(0);
+    }
+
+    // all zero for strict priority, the default
+    void SetWeights(const Weights& weights) noexcept
+    {
+        m_Weights = weights;
+        m_Credits = weights;
+        m_Weighted = false;
+        for (unsigned weight : weights)
+            m_Weighted = m_Weighted || weight;
+    }
+
+    // start a new cycle
+    void Reset() noexcept
+    {
+        m_Credits = m_Weights;
+    }
+
+    // `ready(lane)` tells whether a lane has items, at least one must
+    template <typename Ready>
+    size_t Select(Ready ready)
+    {
+        if (m_Weighted)
+        {
+            for (size_t i = N; i-- > 0;)
+            {
+                if (!m_Weights[i] && ready(i))
+                    return i;
+            }
+            for (int pass = 0; pass < 2; ++pass)
+            {
+                for (size_t i = N; i-- > 0;)
+                {
+                    if (ready(i) && m_Credits[i])
+                    {
+                        m_Credits[i]--;
+                        return i;
+                    }
+                }
+                // every waiting lane used its share, start the next cycle
+                m_Credits = m_Weights;
+            }
+        }
+        size_t i = N - 1;
+        while (!ready(i))
+            i--;
+        return i;
+    }
+
+private:
+    Weights m_Weights;
+    Weights m_Credits;
+    bool m_Weighted;
+};
+
+/*
+ * DataQueue with N lanes, lane N - 1 being the most urgent. Pop() takes from
+ * the highest non-empty lane (strict priority) unless weights are set, then
+ * each lane gets up to `weight` pops per cycle, higher lanes first, so bulk
+ * lanes still progress under a steady stream of urgent items. A lane with
+ * weight 0 keeps strict priority over the weighted lanes. Size and high
+ * water count all lanes together.
+ */
+template <typename T, size_t N>
+class MultiLaneQueue {
+public:
+    typedef typename LaneSelector<N>::Weights Weights;
+
+    MultiLaneQueue() : m_Size(0), m_HighWater(0), m_CurrEpoch(0) {}
+    MultiLaneQueue(const MultiLaneQueue&) = delete;
+
+    ~MultiLaneQueue() { Clear(); }
+
+    // out-of-range lanes go to the most urgent one
+    void Push(T data, size_t lane = 0)
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Lanes[lane < N ? lane : N - 1].push_back(std::move(data));
+        if (++m_Size > m_HighWater)
+            m_HighWater = m_Size;
+        m_Cond.notify_one();
+    }
+
+    T Pop()
+    {
+        std::unique_lock<std::mutex> lock(m_Mutex);
+        auto epoch = m_CurrEpoch;
+        while (!m_Size)
+        {
+            m_Cond.wait(lock);
+            if (epoch != m_CurrEpoch) {
+                throw QueueCleared(this);
+            }
+        }
+        return Take();
+    }
+
+    template <typename Rep = uint64_t, typename Period = std::milli>
+    T Pop(const std::chrono::duration<Rep, Period> timeout)
+    {
+        std::unique_lock<std::mutex> lock(m_Mutex);
+        auto epoch = m_CurrEpoch;
+        while (!m_Size)
+        {
+            if (m_Cond.wait_for(lock, timeout) == std::cv_status::timeout) {
+                throw QueueTimeout(this);
+            }
+            if (epoch != m_CurrEpoch) {
+                throw QueueCleared(this);
+            }
+        }
+        return Take();
+    }
+
+    // pops without waiting, false if the queue is empty
+    bool TryPop(T& data)
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        if (!m_Size)
+            return false;
+        data = Take();
+        return true;
+    }
+
+    // all zero for strict priority, the default
+    void SetWeights(const Weights& weights) noexcept
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Selector.SetWeights(weights);
+    }
+
+    bool Empty() noexcept
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        return !m_Size;
+    }
+
+    size_t Size() noexcept
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        return m_Size;
+    }
+
+    size_t Size(size_t lane) noexcept
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        return lane < N ? m_Lanes[lane].size() : 0;
+    }
+
+    // largest size seen since construction or the last ResetHighWater
+    size_t HighWater() noexcept
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        return m_HighWater;
+    }
+
+    void ResetHighWater() noexcept
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_HighWater = m_Size;
+    }
+
+    queue_epoch_t GetEpoch() noexcept
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        return m_CurrEpoch;
+    }
+
+    bool CheckEpoch(queue_epoch_t epoch) noexcept
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        return m_CurrEpoch == epoch;
+    }
+
+    void Clear() noexcept
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        for (auto& lane : m_Lanes)
+            lane.clear();
+        m_Size = 0;
+        m_Selector.Reset();
+        m_CurrEpoch++;
+        m_Cond.notify_all();
+    }
+
+protected:
+    std::array<std::deque<T>, N> m_Lanes;
+    std::mutex m_Mutex;
+    std::condition_variable m_Cond;
+    size_t m_Size;
+    size_t m_HighWater;
+
+private:
+    // called with the lock held and at least one item queued
+    T Take()
+    {
+        size_t lane = m_Selector.Select([this](size_t i) { return !m_Lanes[i].empty(); });
+        T data = std::move(m_Lanes[lane].front());
+        m_Lanes[lane].pop_front();
+        m_Size--;
+        return data;
+    }
+
+    LaneSelector<N> m_Selector;
+    queue_epoch_t m_CurrEpoch;
+};
+
+#endif
@@ -0,0 +1,331 @@
+#ifndef _INCLUDE_LOGGING_BINARY_
+#define _INCLUDE_LOGGING_BINARY_
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+#include "logger.hpp"
+
+/*
+ * Binary logging keeps printf-style formatting off the hot path. A call site
+ * registers its format string once and every event only records the format
+ * id, a timestamp and the raw arguments into a per-thread mmap'd file:
+ *
+ *     auto* trace = static_cast<logging::BinaryLogger*>(logging::get_logger<logging::BinaryLogger>("trace"));
+ *     trace->open("/tmp/trace.bin");
+ *     log_binary(*trace, logging::LogLevel::INFO, "frame %u sent (%zu bytes)", seq, size);
+ *
+ * Each writing thread gets its own file ("/tmp/trace.bin.0", ".1", ...),
+ * which `logdecode` merges back into the text format of write_record.
+ * A BinaryLogger that is not open formats events immediately and logs them
+ * as text, like any other Logger.
+ */
+#define log_binary(logger, level, fmt, ...) do {                                        \
+    static const uint32_t _log_binary_fmt_id = ::logging::register_format(level, fmt); \
+    (logger).trace(level, _log_binary_fmt_id, ##__VA_ARGS__);                           \
+} while (0)
+
+namespace logging {
+
+uint32_t register_format(Logger::Level level, const char* fmt);
+
+namespace binary {
+
+#define LOGGING_BINARY_MAGIC "TRLOGBIN"
+#define LOGGING_BINARY_VERSION 1
+#define LOGGING_BINARY_FORMAT_RECORD UINT32_MAX
+#define LOGGING_BINARY_THREAD_CACHE 4      // loggers a thread alternates between without a lookup
+
+// file header, followed by a sequence of EventHeader + payload
+struct FileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t clock;         // Logger::Clock of the timestamps
+    uint64_t committed;     // bytes of complete records after the header
+};
+
+struct EventHeader
+{
+    uint32_t fmt_id;
+    uint32_t size;          // payload size
+    uint64_t time;          // nanoseconds since the clock epoch
+};
+
+// argument type tags, one byte before each encoded argument
+enum ArgType: uint8_t
+{
+    ARG_INT = 'i',
+    ARG_UINT = 'u',
+    ARG_DOUBLE = 'f',
+    ARG_STRING = 's',
+    ARG_POINTER = 'p'
+};
+
+template <typename T, typename Enable = void>
+struct ArgCodec;
+
+template <typename T>
+struct ArgCodec<T, typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type>
+{
+    typedef typename std::conditional<std::is_enum<T>::value,
+        std::underlying_type<T>, std::common_type<T>>::type::type int_type;
+
+    static size_t size(T) { return 1 + sizeof(uint64_t); }
+
+    static uint8_t* write(uint8_t* p, T value)
+    {
+        *p++ = std::is_signed<int_type>::value ? ARG_INT : ARG_UINT;
+        uint64_t v = std::is_signed<int_type>::value ? (uint64_t)(int64_t)(int_type)value : (uint64_t)(int_type)value;
+        memcpy(p, &v, sizeof(v));
+        return p + sizeof(v);
+    }
+};
+
+template <typename T>
+struct ArgCodec<T, typename std::enable_if<std::is_floating_point<T>::value>::type>
+{
+    static size_t size(T) { return 1 + sizeof(double); }
+
+    static uint8_t* write(uint8_t* p, T value)
+    {
+        *p++ = ARG_DOUBLE;
+        double v = value;
+        memcpy(p, &v, sizeof(v));
+        return p + sizeof(v);
+    }
+};
+
+template <typename T>
+struct ArgCodec<T*, typename std::enable_if<!std::is_same<typename std::remove_cv<T>::type, char>::value>::type>
+{
+    static size_t size(T*) { return 1 + sizeof(uint64_t); }
+
+    static uint8_t* write(uint8_t* p, T* value)
+    {
+        *p++ = ARG_POINTER;
+        uint64_t v = (uint64_t)(uintptr_t)value;
+        memcpy(p, &v, sizeof(v));
+        return p + sizeof(v);
+    }
+};
+
+struct StringCodec
+{
+    static size_t size(const char* s, size_t len) { return 1 + sizeof(uint32_t) + len; }
+
+    static uint8_t* write(uint8_t* p, const char* s, size_t len)
+    {
+        *p++ = ARG_STRING;
+        uint32_t n = len;
+        memcpy(p, &n, sizeof(n));
+        memcpy(p + sizeof(n), s, len);
+        return p + sizeof(n) + len;
+    }
+};
+
+template <>
+struct ArgCodec<const char*>
+{
+    static size_t size(const char* s) { return StringCodec::size(s, s ? strlen(s) : 0); }
+    static uint8_t* write(uint8_t* p, const char* s) { return StringCodec::write(p, s, s ? strlen(s) : 0); }
+};
+
+template <>
+struct ArgCodec<char*> : ArgCodec<const char*> {};
+
+template <>
+struct ArgCodec<std::string>
+{
+    static size_t size(const std::string& s) { return StringCodec::size(s.data(), s.size()); }
+    static uint8_t* write(uint8_t* p, const std::string& s) { return StringCodec::write(p, s.data(), s.size()); }
+};
+
+inline size_t args_size() { return 0; }
+
+template <typename T, typename... Args>
+inline size_t args_size(const T& value, const Args&... args)
+{
+    return ArgCodec<typename std::decay<T>::type>::size(value) + args_size(args...);
+}
+
+inline uint8_t* write_args(uint8_t* p) { return p; }
+
+template <typename T, typename... Args>
+inline uint8_t* write_args(uint8_t* p, const T& value, const Args&... args)
+{
+    p = ArgCodec<typename std::decay<T>::type>::write(p, value);
+    return write_args(p, args...);
+}
+
+// expand a format string against encoded arguments, printf style
+std::string format(const char* fmt, size_t fmt_len, const uint8_t* args, size_t size);
+
+// per-thread output file, appended through a shared mapping
+class ThreadBuffer
+{
+public:
+    ThreadBuffer(const std::string& path, Logger::Clock clock, size_t chunk_size);
+    ThreadBuffer(const ThreadBuffer&) = delete;
+    ~ThreadBuffer();
+
+    inline uint8_t* reserve(size_t size)
+    {
+        if (_offset + size > _capacity) {
+            grow(size);
+        }
+        return _base + _offset;
+    }
+
+    inline void commit(size_t size)
+    {
+        _offset += size;
+        __atomic_store_n(&reinterpret_cast<FileHeader*>(_base)->committed,
+                         _offset - sizeof(FileHeader), __ATOMIC_RELEASE);
+    }
+
+    inline bool seen(uint32_t fmt_id)
+    {
+        if (fmt_id >= _seen.size()) {
+            _seen.resize(fmt_id + 1, false);
+        }
+        if (_seen[fmt_id]) return true;
+        _seen[fmt_id] = true;
+        return false;
+    }
+
+    void close();
+
+private:
+    void grow(size_t size);
+
+    int _fd;
+    uint8_t* _base;
+    size_t _capacity;
+    size_t _offset;
+    size_t _chunk_size;
+    std::vector<bool> _seen;
+};
+
+// sequential reader of one per-thread file
+class Reader
+{
+public:
+    explicit Reader(const std::string& path);
+    Reader(const Reader&) = delete;
+    ~Reader();
+
+    // decode the next event, false at the end of the committed data
+    bool next(Record& record);
+
+private:
+    struct Format
+    {
+        Logger::Level level;
+        std::string name;
+        std::string fmt;
+    };
+
+    uint8_t* _base;
+    size_t _size;
+    size_t _offset;
+    Logger::Clock _clock;
+    std::unordered_map<uint32_t, Format> _formats;
+};
+
+}
+
+class BinaryLogger : public Logger
+{
+public:
+    explicit BinaryLogger(Level level = Level::INFO);
+    BinaryLogger(const std::string& name, Level level = Level::INFO, Logger* parent = nullptr);
+    ~BinaryLogger() override;
+
+    // start writing events to "<path>.<n>", one file per thread
+    void open(const std::string& path, size_t chunk_size = 4 << 20);
+    // truncate and close all thread files; no thread may be logging
+    void close();
+
+    inline bool is_open() const
+    {
+        return _open.load(std::memory_order_acquire);
+    }
+
+    template <typename... Args>
+    inline void trace(Level level, uint32_t fmt_id, const Args&... args)
+    {
+        if (level < this->level())
+            return;
+        size_t size = binary::args_size(args...);
+        if (!is_open()) {
+            std::vector<uint8_t> buf(size);
+            binary::write_args(buf.data(), args...);
+            log_encoded(level, fmt_id, buf.data(), size);
+            return;
+        }
+        binary::ThreadBuffer* buffer = thread_buffer();
+        if (!buffer->seen(fmt_id)) {
+            write_format(*buffer, fmt_id);
+        }
+        uint8_t* p = buffer->reserve(sizeof(binary::EventHeader) + size);
+        binary::EventHeader header = {fmt_id, (uint32_t)size, now()};
+        memcpy(p, &header, sizeof(header));
+        binary::write_args(p + sizeof(header), args...);
+        buffer->commit(sizeof(header) + size);
+    }
+
+private:
+    // generations are unique across loggers and opens, so they key the
+    // buffers of all loggers a thread writes to, and stale entries never match
+    struct ThreadCache
+    {
+        uint64_t generation[LOGGING_BINARY_THREAD_CACHE];
+        binary::ThreadBuffer* buffer[LOGGING_BINARY_THREAD_CACHE];
+        unsigned next;
+    };
+
+    inline binary::ThreadBuffer* thread_buffer()
+    {
+        static thread_local ThreadCache cache = {{0}, {nullptr}, 0};
+        uint64_t generation = _generation.load(std::memory_order_relaxed);
+        for (unsigned i = 0; i < LOGGING_BINARY_THREAD_CACHE; ++i) {
+            if (cache.generation[i] == generation)
+                return cache.buffer[i];
+        }
+        unsigned slot = cache.next++ % LOGGING_BINARY_THREAD_CACHE;
+        cache.buffer[slot] = open_thread_buffer();
+        cache.generation[slot] = generation;
+        return cache.buffer[slot];
+    }
+
+    inline uint64_t now() const
+    {
+        struct timespec ts;
+        clock_gettime(_file_clock == Clock::MONOTONIC ? CLOCK_MONOTONIC : CLOCK_REALTIME, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    }
+
+    binary::ThreadBuffer* open_thread_buffer();
+    void write_format(binary::ThreadBuffer& buffer, uint32_t fmt_id);
+    void log_encoded(Level level, uint32_t fmt_id, const uint8_t* args, size_t size);
+
+    std::atomic<bool> _open;
+    std::atomic<uint64_t> _generation;
+    Clock _file_clock;
+    std::string _path;
+    size_t _chunk_size;
+    std::mutex _mutex;
+    std::unordered_map<std::thread::id, std::unique_ptr<binary::ThreadBuffer>> _buffers;
+};
+
+}
+
+#endif
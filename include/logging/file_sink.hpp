@@ -0,0 +1,95 @@
+#ifndef _INCLUDE_LOGGING_FILE_SINK_
+#define _INCLUDE_LOGGING_FILE_SINK_
+
+#include <stdint.h>
+#include <mutex>
+#include <string>
+#include <ostream>
+#include <streambuf>
+
+#define LOGGING_FILE_MAX_SIZE (64 << 20)
+#define LOGGING_FILE_MAX_FILES 5
+#define LOGGING_FILE_CHUNK_SIZE (1 << 20)
+
+namespace logging {
+
+/*
+ * Log file appended through a shared mapping, so writing a record costs a
+ * memcpy instead of a write syscall.
+ *
+ * The file is grown in chunks and the unused tail of the last chunk stays
+ * zero-filled until close() truncates it. A record arrives in several
+ * writes and is complete once its newline is written, so after a crash the
+ * file holds complete lines, possibly followed by one torn line and the
+ * zero-filled tail; reopening the file trims both back to the last newline
+ * and continues appending. When a record would push the file past
+ * `max_size`, it is rotated by renaming: path -> path.1 -> ... -> path.N;
+ * rotation waits for a record boundary, so records are not split unless a
+ * line runs a whole chunk past `max_size`.
+ */
+class MappedFileBuf : public std::streambuf
+{
+public:
+    explicit MappedFileBuf(const std::string& path, size_t max_size = LOGGING_FILE_MAX_SIZE,
+                           unsigned max_files = LOGGING_FILE_MAX_FILES,
+                           size_t chunk_size = LOGGING_FILE_CHUNK_SIZE);
+    MappedFileBuf(const MappedFileBuf&) = delete;
+    MappedFileBuf(MappedFileBuf&& other);
+    ~MappedFileBuf() override;
+
+    inline const std::string& path() const
+    {
+        return _path;
+    }
+
+    inline size_t size() const
+    {
+        return _size;
+    }
+
+    void rotate();
+    void close();
+
+protected:
+    int overflow(int c) override;
+    std::streamsize xsputn(const char* s, std::streamsize n) override;
+
+private:
+    void open_file();
+    int close_file();
+    void rotate_file();
+    void grow(size_t size);
+
+    std::string _path;
+    size_t _max_size;
+    unsigned _max_files;
+    size_t _chunk_size;
+
+    std::mutex _mutex;
+    int _fd;
+    char* _base;
+    size_t _capacity;
+    size_t _size;
+};
+
+class MappedFileStream : public std::ostream
+{
+public:
+    explicit MappedFileStream(const std::string& path, size_t max_size = LOGGING_FILE_MAX_SIZE,
+                              unsigned max_files = LOGGING_FILE_MAX_FILES,
+                              size_t chunk_size = LOGGING_FILE_CHUNK_SIZE);
+    MappedFileStream(const MappedFileStream&) = delete;
+    MappedFileStream(MappedFileStream&& other);
+
+    inline MappedFileBuf* rdbuf()
+    {
+        return &_buf;
+    }
+
+private:
+    MappedFileBuf _buf;
+};
+
+}
+
+#endif
@@ -31,9 +31,17 @@ public:
         FATAL = LOG_LEVEL_FATAL
     };
 
+    // Clock used to stamp records. MONOTONIC skips the wall-clock
+    // conversion and prints seconds since boot, like dmesg.
+    enum class Clock: uint8_t
+    {
+        REALTIME = 0,
+        MONOTONIC
+    };
+
     constexpr static const char* namesep = "::";
 
-    explicit Logger(Level level = Level::INFO) : _parent(nullptr), _level(level) {}
+    explicit Logger(Level level = Level::INFO) : _parent(nullptr), _level(level), _clock(Clock::REALTIME) {}
     Logger(const Logger&) = delete;
     virtual ~Logger() = default;
     
@@ -67,6 +75,16 @@ public:
     {
         _level = level;
     }
+
+    inline Clock clock() const
+    {
+        return _clock;
+    }
+
+    inline void set_clock(Clock clock)
+    {
+        _clock = clock;
+    }
     
     template<Level level>
     inline void log(const char* fmt, ...) {
@@ -163,7 +181,7 @@ public:
         auto seqlen = strlen(namesep);
         if (sep_pos == std::string::npos || sep_pos + seqlen >= name.size())
             return logger;
-        return logger->get_child(name.substr(sep_pos + seqlen), level);
+        return logger->get_child<T_Logger>(name.substr(sep_pos + seqlen), level);
     }
 
     inline void add_stream(std::ostream& stream)
@@ -200,6 +218,7 @@ private:
     std::unordered_map<std::string, std::unique_ptr<Logger>> logger_cache;
     std::string _name;
     Level _level;
+    Clock _clock;
 };
 
 class LoggerStreamBuf : public std::streambuf {
@@ -234,16 +253,22 @@ private:
 struct Record
 {
     std::string name;
+    // for MONOTONIC records this holds the time since boot rather than
+    // the time since the unix epoch
     std::chrono::system_clock::time_point time;
     Logger::Level level;
+    Logger::Clock clock;
     std::string msg;
 
-    Record(const std::string& name, Logger::Level level, const std::string& msg);
+    Record(const std::string& name, Logger::Level level, const std::string& msg,
+           Logger::Clock clock = Logger::Clock::REALTIME);
 };
 
 using LogLevel = Logger::Level;
 
 std::ostream& operator<<(std::ostream& os, const Logger::Level level);
+const char* level2str(Logger::Level level);
+void format_record(std::string& line, const Record& record);
 Logger::Level str2level(const char* level);
 std::unique_ptr<Logger>& _get_global_logger();
 Logger& get_global_logger();
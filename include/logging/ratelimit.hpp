@@ -0,0 +1,84 @@
+#ifndef _INCLUDE_LOGGING_RATELIMIT_
+#define _INCLUDE_LOGGING_RATELIMIT_
+
+#include <stdint.h>
+#include <stdarg.h>
+#include <time.h>
+#include <atomic>
+#include "logger.hpp"
+
+// rate limit one call site, sharing a single limiter across all callers;
+// the logger comes first so it outlives the limiter's final summary
+#define log_ratelimited(logger, level, ...) do {           \
+    ::logging::Logger& _log_rate_logger = (logger);        \
+    static ::logging::RateLimiter _log_rate_limiter;       \
+    _log_rate_limiter.log(_log_rate_logger, level, __VA_ARGS__);   \
+} while (0)
+
+namespace logging {
+
+/*
+ * Token bucket for noisy log sites, implemented as a generic cell rate
+ * algorithm so that acquire() is a single CAS. Messages over the limit are
+ * dropped and counted; the count is reported as "(suppressed N messages)"
+ * on the next message that gets through, or by the destructor if the storm
+ * just stops, through the logger of the last message, which must outlive
+ * the limiter.
+ *
+ * Keep one limiter per call site (log_ratelimited) or one per key, e.g. per
+ * transport or per peer, to limit each storm separately.
+ */
+class RateLimiter
+{
+public:
+    // `rate` messages per second on average, bursts of up to `burst`;
+    // with a rate of 0 only the first `burst` messages pass
+    explicit RateLimiter(double rate = 10, uint32_t burst = 10);
+    RateLimiter(const RateLimiter&) = delete;
+    ~RateLimiter();
+
+    // true if a message may pass; `suppressed` receives the number of
+    // messages dropped since the last one that passed
+    inline bool acquire(uint64_t& suppressed)
+    {
+        int64_t now = now_ns();
+        int64_t tat = _tat.load(std::memory_order_relaxed);
+        int64_t new_tat;
+        do {
+            new_tat = (tat > now ? tat : now) + _interval;
+            if (new_tat - now > _limit) {
+                _suppressed.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+        } while (!_tat.compare_exchange_weak(tat, new_tat, std::memory_order_relaxed));
+        suppressed = _suppressed.exchange(0, std::memory_order_relaxed);
+        return true;
+    }
+
+    inline uint64_t suppressed() const
+    {
+        return _suppressed.load(std::memory_order_relaxed);
+    }
+
+    void log(Logger& logger, Logger::Level level, const char* fmt, ...);
+    void vlog(Logger& logger, Logger::Level level, const char* fmt, va_list args);
+
+private:
+    static inline int64_t now_ns()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+        return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    }
+
+    int64_t _interval;              // nanoseconds per message
+    int64_t _limit;                 // interval * burst
+    std::atomic<int64_t> _tat;      // theoretical arrival time
+    std::atomic<uint64_t> _suppressed;
+    std::atomic<Logger*> _logger;   // of the last message, for the final summary
+    std::atomic<int> _level;
+};
+
+}
+
+#endif
@@ -2,13 +2,29 @@
 #define _INCLUDE_TRANSPORT_BASE_
 
 #include <stdint.h>
+#include <sys/types.h>
+#include <atomic>
 #include <chrono>
 #include <memory>
 #include <thread>
+#include <typeinfo>
+#include <algorithm>
+#include <array>
 #include <functional>
+#include <mutex>
+#include <unordered_map>
 #include "dataqueue.hpp"
+#include "lanequeue.hpp"
+#include "capture.hpp"
+#include "completion.hpp"
+#include "dispatch.hpp"
+#include "fair.hpp"
 #include "logging/logger.hpp"
+#include "logging/ratelimit.hpp"
+#include "pacing.hpp"
+#include "peer.hpp"
 #include "protocol.hpp"
+#include "trace.hpp"
 
 #define TRANSPORT_MAX_RETRY 5
 #define TRANSPORT_TIMEOUT 1000
@@ -19,6 +35,106 @@ namespace transport
 template <typename P>
 class BaseTransport;
 
+struct TransportStats
+{
+    uint64_t frames_sent;
+    uint64_t bytes_sent;
+    uint64_t send_errors;           // failed send syscalls
+    uint64_t partial_writes;        // frames the kernel accepted only in part
+    uint64_t frames_dropped;        // over a peer's limit under fair queuing
+    uint64_t send_expired;          // past their deadline before the send syscall
+    uint64_t frames_coalesced;      // replaced by a newer frame for the same key
+    uint64_t frames_paced;          // held back by the transport or peer pacing
+    uint64_t frames_received;
+    uint64_t bytes_received;
+    uint64_t receive_errors;        // failed receive syscalls
+    uint64_t truncated;             // datagrams larger than the receive buffer
+    uint64_t invalid_frames;        // data rejected by P::pred_size
+    uint64_t receive_expired;       // older than the receive TTL at receive()
+    size_t send_queue_depth;
+    size_t recv_queue_depth;
+    size_t send_queue_high_water;
+    size_t recv_queue_high_water;
+};
+
+// send lanes, the send backend always takes from the most urgent ready one
+enum class Priority : uint8_t
+{
+    BULK,
+    NORMAL,
+    CONTROL,        // heartbeats, acks; also skips fair queuing
+};
+
+#define TRANSPORT_PRIORITY_COUNT 3
+
+// bookkeeping carried through send_que and recv_que next to each frame
+struct FrameMeta
+{
+    uint64_t timestamp;     // trace_now() when the frame was queued, 0 if untraced
+    uint64_t kernel_time;   // kernel receive time (CLOCK_REALTIME ns unless `kernel_raw`), 0 if unknown
+    uint64_t deadline;      // steady clock ns after which the frame is dropped, 0 if none
+    uint64_t key;           // coalescing key, if `coalesced`
+    Priority priority;
+    bool coalesced;         // placeholder for the latest frame queued under `key`
+    bool kernel_raw;        // kernel_time is the NIC clock, see TimestampMode::HARDWARE
+    CompletionRef completion;   // send_async() result, resolved by the send backend
+
+    FrameMeta() : timestamp(0), kernel_time(0), deadline(0), key(0),
+                  priority(Priority::NORMAL), coalesced(false), kernel_raw(false) {}
+};
+
+// Each side is only written by its own backend thread, so the counters are
+// uncontended; the padding keeps them on separate cache lines. Padding
+// rather than alignas, so transports can be heap allocated in C++11.
+struct TransportCounters
+{
+    struct SendSide
+    {
+        std::atomic<uint64_t> frames;
+        std::atomic<uint64_t> bytes;
+        std::atomic<uint64_t> errors;
+        std::atomic<uint64_t> partial;
+        std::atomic<uint64_t> dropped;
+        std::atomic<uint64_t> expired;
+        std::atomic<uint64_t> coalesced;
+        std::atomic<uint64_t> paced;
+
+        SendSide() : frames(0), bytes(0), errors(0), partial(0), dropped(0), expired(0), coalesced(0), paced(0) {}
+    } send;
+
+    char padding[64];
+
+    struct ReceiveSide
+    {
+        std::atomic<uint64_t> frames;
+        std::atomic<uint64_t> bytes;
+        std::atomic<uint64_t> errors;
+        std::atomic<uint64_t> truncated;
+        std::atomic<uint64_t> invalid;
+        std::atomic<uint64_t> expired;      // counted by receive(), not the backend
+
+        ReceiveSide() : frames(0), bytes(0), errors(0), truncated(0), invalid(0), expired(0) {}
+    } recv;
+
+    void reset()
+    {
+        send.frames = 0;
+        send.bytes = 0;
+        send.errors = 0;
+        send.partial = 0;
+        send.dropped = 0;
+        send.expired = 0;
+        send.coalesced = 0;
+        send.paced = 0;
+        recv.frames = 0;
+        recv.bytes = 0;
+        recv.errors = 0;
+        recv.truncated = 0;
+        recv.invalid = 0;
+        recv.expired = 0;
+    }
+};
+
 class _transport_base {
 public:
     _transport_base() : is_open(false), is_closed(false) {}
@@ -83,6 +199,19 @@ public:
     virtual bool operator==(const TransportToken &other) const {
         return transport_ == other.transport_;
     }
+    // equal for tokens that compare equal, transports may create a new token per frame
+    virtual size_t peer_hash() const {
+        return std::hash<uintptr_t>()(reinterpret_cast<uintptr_t>(transport_));
+    }
+    // peer address of the token, nullptr if the transport has none
+    virtual const struct sockaddr* peer_address(socklen_t* addr_len) const {
+        *addr_len = 0;
+        return nullptr;
+    }
+    // per-peer stats and user data, nullptr if the transport keeps no peer table
+    virtual PeerState* peer_state() const {
+        return nullptr;
+    }
 
 protected:
     _transport_base *transport_;
@@ -90,12 +219,59 @@ protected:
     friend std::hash<TransportToken>;
 };
 
+/*
+ * `token` as a T, or nullptr. Transports create their tokens as exactly T,
+ * so the typeid check usually spares the dynamic_cast; subclasses of T
+ * still convert.
+ */
+template <typename T>
+inline const T* token_cast(const TransportToken* token)
+{
+    if (!token)
+        return nullptr;
+    if (typeid(*token) == typeid(T))
+        return static_cast<const T*>(token);
+    return dynamic_cast<const T*>(token);
+}
+
+template <typename T>
+inline T* token_cast(TransportToken* token)
+{
+    return const_cast<T*>(token_cast<T>(static_cast<const TransportToken*>(token)));
+}
+
 template <typename P>
 class BaseTransport : public _transport_base
 {
 public:
     typedef P Protocol;
     typedef typename P::FrameType FrameType;
+    typedef std::pair<typename P::FrameType, std::shared_ptr<TransportToken>> DataPair;
+    typedef std::chrono::steady_clock::time_point Deadline;
+
+    // queue element: the frame pair plus its FrameMeta
+    struct FrameEntry : DataPair
+    {
+        FrameMeta meta;
+
+        FrameEntry() {}
+        FrameEntry(DataPair pair) : DataPair(std::move(pair)) {}
+        FrameEntry(FrameType frame, std::shared_ptr<TransportToken> token)
+            : DataPair(std::move(frame), std::move(token)) {}
+    };
+
+    typedef std::function<void(FrameEntry&)> ReceiveHandler;
+
+    struct ReceiveDispatch
+    {
+        std::shared_ptr<ReceiveHandler> handler;
+        std::shared_ptr<WorkerPool> pool;
+        Dispatch mode;
+    };
+
+    BaseTransport()
+        : tracing_enabled(false), capture_enabled(false), handler_error_limit(std::make_shared<logging::RateLimiter>()),
+          fair_peer_limit(0), receive_ttl(0) {}
 
     ~BaseTransport() override
     {
@@ -103,21 +279,128 @@ public:
     }
 
     template <typename Rep = uint64_t, typename Period = std::milli>
-    inline void send(typename P::FrameType frame, std::shared_ptr<TransportToken> token = nullptr)
+    inline void send(typename P::FrameType frame, std::shared_ptr<TransportToken> token = nullptr,
+                     Priority priority = Priority::NORMAL, Deadline deadline = Deadline())
     {
         ensure_open();
-        send_que.Push(std::make_pair(frame, token));
+        queue_send(FrameEntry(std::move(frame), std::move(token)), priority, deadline);
+    }
+    /*
+     * Like send(), but the returned future resolves once the send backend is
+     * done with the frame: with the bytes written, or -errno if the syscall
+     * failed. Frames that never reach the syscall resolve with -ETIMEDOUT
+     * past their deadline, -ENOBUFS over a fair queuing limit and
+     * -ECANCELED when dropped otherwise, e.g. by close(). Completions come
+     * from a pool, so this allocates nothing per frame.
+     */
+    inline SendFuture send_async(typename P::FrameType frame, std::shared_ptr<TransportToken> token = nullptr,
+                                 Priority priority = Priority::NORMAL, Deadline deadline = Deadline())
+    {
+        ensure_open();
+        CompletionSlot* slot = CompletionPool::instance().acquire(nullptr);
+        SendFuture future(slot);
+        FrameEntry entry(std::move(frame), std::move(token));
+        entry.meta.completion = CompletionRef(slot);
+        queue_send(std::move(entry), priority, deadline);
+        return future;
+    }
+    // `callback` runs on the send backend with the result, keep it short
+    inline void send_async(typename P::FrameType frame, SendCallback callback, std::shared_ptr<TransportToken> token = nullptr,
+                           Priority priority = Priority::NORMAL, Deadline deadline = Deadline())
+    {
+        ensure_open();
+        FrameEntry entry(std::move(frame), std::move(token));
+        entry.meta.completion = CompletionRef(CompletionPool::instance().acquire(std::move(callback)));
+        queue_send(std::move(entry), priority, deadline);
+    }
+    /*
+     * Latest value only: while a frame queued under `key` has not been sent,
+     * a new one replaces it in place, so a slow link always carries the
+     * newest state and never a backlog of old ones. The replaced frames are
+     * counted in frames_coalesced.
+     */
+    inline void send_latest(uint64_t key, typename P::FrameType frame, std::shared_ptr<TransportToken> token = nullptr,
+                            Priority priority = Priority::NORMAL, Deadline deadline = Deadline())
+    {
+        ensure_open();
+        FrameEntry entry(std::move(frame), token);
+        entry.meta.timestamp = trace_clock();
+        entry.meta.priority = priority;
+        entry.meta.deadline = deadline_ns(deadline);
+        {
+            std::lock_guard<std::mutex> lock(latest_mutex);
+            auto it = latest_frames.find(key);
+            if (it != latest_frames.end())
+            {
+                // keep the queue position of the frame it replaces
+                entry.meta.timestamp = it->second.meta.timestamp;
+                it->second = std::move(entry);
+                counters.send.coalesced.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            latest_frames.emplace(key, std::move(entry));
+        }
+        // carries the token, so fair queuing charges the right peer
+        FrameEntry placeholder;
+        placeholder.second = std::move(token);
+        placeholder.meta.key = key;
+        placeholder.meta.priority = priority;
+        placeholder.meta.coalesced = true;
+        send_que.Push(std::move(placeholder), static_cast<size_t>(priority));
     }
     template <typename Rep = uint64_t, typename Period = std::milli>
     inline std::pair<typename P::FrameType, std::shared_ptr<TransportToken>> receive(std::chrono::duration<Rep, Period> dur = std::chrono::milliseconds(0))
+    {
+        return DataPair(receive_entry(dur));
+    }
+    // like receive(), but keeps the FrameMeta, e.g. the kernel timestamp
+    template <typename Rep = uint64_t, typename Period = std::milli>
+    inline FrameEntry receive_entry(std::chrono::duration<Rep, Period> dur = std::chrono::milliseconds(0))
     {
         ensure_open();
-        DataPair frame_pair;
-        if (!dur.count())
-            frame_pair = recv_que.Pop();
-        else
-            frame_pair = recv_que.Pop(dur);
-        return frame_pair;
+        auto until = std::chrono::steady_clock::now() + dur;
+        FrameEntry entry;
+        while (true)
+        {
+            if (!dur.count())
+                entry = recv_que.Pop();
+            else
+            {
+                auto remaining = until - std::chrono::steady_clock::now();
+                if (remaining.count() <= 0)
+                    throw QueueTimeout(&recv_que);
+                entry = recv_que.Pop(remaining);
+            }
+            if (!expired(entry.meta))
+                break;
+            counters.recv.expired.fetch_add(1, std::memory_order_relaxed);
+        }
+        trace_received(entry.meta);
+        return entry;
+    }
+    // like receive_entry(), but returns false instead of waiting
+    bool try_receive_entry(FrameEntry& entry)
+    {
+        ensure_open();
+        while (recv_que.TryPop(entry))
+        {
+            if (!expired(entry.meta))
+            {
+                trace_received(entry.meta);
+                return true;
+            }
+            counters.recv.expired.fetch_add(1, std::memory_order_relaxed);
+        }
+        return false;
+    }
+    // `notifier` is woken whenever a frame is queued for receive(), see TransportSet
+    void watch_receive(std::shared_ptr<QueueNotifier> notifier)
+    {
+        recv_que.AddNotifier(std::move(notifier));
+    }
+    void unwatch_receive(const std::shared_ptr<QueueNotifier>& notifier)
+    {
+        recv_que.RemoveNotifier(notifier);
     }
     template <typename Rep = uint64_t, typename Period = std::milli>
     inline typename P::FrameType request(typename P::FrameType frame, int max_retry = TRANSPORT_MAX_RETRY, std::chrono::duration<Rep, Period> dur = std::chrono::milliseconds(TRANSPORT_TIMEOUT))
@@ -125,8 +408,8 @@ public:
         ensure_open();
         while (max_retry--)
         {
-            send_que.Push(std::make_pair(frame, nullptr));
-            DataPair frame_pair = recv_que.Pop(dur);
+            send(frame);
+            DataPair frame_pair = receive(dur);
             if (frame_pair.first) {
                 return frame_pair.first;
             }
@@ -136,17 +419,551 @@ public:
         return nullptr;
     }
 
+    /*
+     * Per-frame latency tracing. Frames are stamped at send(), around the
+     * send syscall, when the receive syscall returns and at receive(), and
+     * the stage latencies go into lock-free histograms. When disabled the
+     * backends skip the clock reads entirely; building with
+     * TRANSPORT_DISABLE_TRACING compiles the checks out.
+     */
+    void enable_tracing(bool enable = true)
+    {
+        if (enable && !latency_hist) {
+            latency_hist.reset(new LatencyHistogram[static_cast<size_t>(TraceStage::COUNT)]);
+        }
+        tracing_enabled.store(enable, std::memory_order_release);
+    }
+
+    bool tracing() const
+    {
+        return tracing_enabled.load(std::memory_order_relaxed);
+    }
+
+    LatencySummary latency(TraceStage stage) const
+    {
+        if (!latency_hist) {
+            LatencySummary empty = {0, 0, 0, 0, 0, 0};
+            return empty;
+        }
+        return latency_hist[static_cast<size_t>(stage)].summary();
+    }
+
+    void reset_latency()
+    {
+        if (!latency_hist)
+            return;
+        for (size_t i = 0; i < static_cast<size_t>(TraceStage::COUNT); ++i)
+            latency_hist[i].reset();
+    }
+
+    /*
+     * Hand received frames to `handler` instead of recv_que. Without a pool
+     * the handler runs on the receive backend, which suits cheap handlers
+     * and saves the queue hop and the wakeup of a receiving thread; with one
+     * it runs on the pool's workers, Dispatch::BY_TOKEN keeping the frames of
+     * each peer in order. A null handler goes back to receive(). The receive
+     * TTL only applies to frames waiting in recv_que.
+     */
+    void on_receive(ReceiveHandler handler, std::shared_ptr<WorkerPool> pool = nullptr,
+                    Dispatch mode = Dispatch::BY_TOKEN)
+    {
+        std::shared_ptr<ReceiveDispatch> dispatch;
+        if (handler)
+        {
+            dispatch = std::make_shared<ReceiveDispatch>();
+            dispatch->handler = std::make_shared<ReceiveHandler>(std::move(handler));
+            dispatch->pool = std::move(pool);
+            dispatch->mode = mode;
+        }
+        std::atomic_store(&receive_dispatch, dispatch);
+    }
+
+    /*
+     * Write every frame sent or received from now on to a pcap file, see
+     * capture.hpp for the format. Frames are recorded by the backends right
+     * after the syscall, received frames with the kernel timestamp if known.
+     */
+    void enable_capture(const std::string& path, uint32_t snaplen = TRANSPORT_CAPTURE_SNAPLEN)
+    {
+        std::atomic_store(&capture_writer, std::make_shared<CaptureWriter>(path, snaplen));
+        capture_enabled.store(true, std::memory_order_release);
+    }
+
+    // a backend still writing keeps the file open, so flush what is there now
+    void disable_capture()
+    {
+        capture_enabled.store(false, std::memory_order_release);
+        std::shared_ptr<CaptureWriter> writer = std::atomic_exchange(&capture_writer, std::shared_ptr<CaptureWriter>());
+        if (writer)
+            writer->flush();
+    }
+
+    bool capturing() const
+    {
+        return capture_enabled.load(std::memory_order_relaxed);
+    }
+
+    /*
+     * Serve queued frames per destination with deficit round-robin instead
+     * of in send() order, so one peer with a deep backlog cannot hold up the
+     * others. Frames are grouped by token; a peer's PeerState sets its
+     * weight and byte limit, `peer_limit` is the limit for peers without
+     * one. Frames over the limit are dropped and counted in frames_dropped.
+     * Each priority lane has its own round-robin, so lanes keep their order
+     * or weights; CONTROL frames skip it. Must be called before open().
+     */
+    void enable_fair_queuing(size_t quantum = TRANSPORT_FAIR_QUANTUM, size_t peer_limit = 0)
+    {
+        if (this->is_open && !this->is_closed)
+        {
+            auto &logger = *logging::get_logger("transport");
+            logger.error("fair queuing must be enabled before open");
+            throw std::runtime_error("fair queuing must be enabled before open");
+        }
+        for (size_t lane = 0; lane < static_cast<size_t>(Priority::CONTROL); ++lane)
+            fair_lanes[lane].reset(new FairQueue<FrameEntry>(quantum));
+        fair_peer_limit = peer_limit;
+    }
+
+    bool fair_queuing() const
+    {
+        return static_cast<bool>(fair_lanes[0]);
+    }
+
+    /*
+     * Token bucket pacing of the send backend, in bytes and frames per
+     * second, so bursts do not overrun the receiver's socket buffer or a
+     * device FIFO. The backend sleeps until the frame is due; pacing set on
+     * a token's PeerState applies as well, and holds up the frames behind
+     * it. A default PacingConfig turns pacing off.
+     */
+    void set_pacing(const PacingConfig& config)
+    {
+        pacer.configure(config);
+    }
+
+    // frames waiting in recv_que longer than `ttl` are dropped by receive(), 0 to keep all
+    void set_receive_ttl(std::chrono::milliseconds ttl)
+    {
+        receive_ttl.store(std::chrono::duration_cast<std::chrono::nanoseconds>(ttl).count(),
+                          std::memory_order_relaxed);
+    }
+
+    /*
+     * Share of the send backend for BULK and NORMAL frames, in frames per
+     * cycle, so bulk traffic is not starved by a steady normal stream. Both
+     * zero, the default, serves the lanes in strict priority order. CONTROL
+     * frames always go first, with or without fair queuing.
+     */
+    void set_priority_weights(unsigned bulk, unsigned normal)
+    {
+        if (!bulk != !normal)
+        {
+            auto &logger = *logging::get_logger("transport");
+            logger.error("priority weights must be both zero or both positive");
+            throw std::runtime_error("priority weights must be both zero or both positive");
+        }
+        typename SendQueue::Weights weights = {{bulk, normal, 0}};
+        send_que.SetWeights(weights);
+        std::lock_guard<std::mutex> lock(fair_mutex);
+        fair_selector.SetWeights(weights);
+    }
+
     void close() override {
         is_closed = true;
         recv_que.Clear();
         send_que.Clear();
+        std::lock_guard<std::mutex> lock(latest_mutex);
+        latest_frames.clear();
     }
 
-    typedef std::pair<typename P::FrameType, std::shared_ptr<TransportToken>> DataPair;
+    TransportStats stats()
+    {
+        TransportStats stats;
+        stats.frames_sent = counters.send.frames.load(std::memory_order_relaxed);
+        stats.bytes_sent = counters.send.bytes.load(std::memory_order_relaxed);
+        stats.send_errors = counters.send.errors.load(std::memory_order_relaxed);
+        stats.partial_writes = counters.send.partial.load(std::memory_order_relaxed);
+        stats.frames_dropped = counters.send.dropped.load(std::memory_order_relaxed);
+        stats.send_expired = counters.send.expired.load(std::memory_order_relaxed);
+        stats.frames_coalesced = counters.send.coalesced.load(std::memory_order_relaxed);
+        stats.frames_paced = counters.send.paced.load(std::memory_order_relaxed);
+        stats.frames_received = counters.recv.frames.load(std::memory_order_relaxed);
+        stats.bytes_received = counters.recv.bytes.load(std::memory_order_relaxed);
+        stats.receive_errors = counters.recv.errors.load(std::memory_order_relaxed);
+        stats.truncated = counters.recv.truncated.load(std::memory_order_relaxed);
+        stats.invalid_frames = counters.recv.invalid.load(std::memory_order_relaxed);
+        stats.receive_expired = counters.recv.expired.load(std::memory_order_relaxed);
+        stats.send_queue_depth = send_que.Size();
+        for (auto& lane : fair_lanes)
+            stats.send_queue_depth += lane ? lane->size() : 0;
+        stats.recv_queue_depth = recv_que.Size();
+        stats.send_queue_high_water = send_que.HighWater();
+        stats.recv_queue_high_water = recv_que.HighWater();
+        return stats;
+    }
+
+    void reset_stats()
+    {
+        counters.reset();
+        send_que.ResetHighWater();
+        recv_que.ResetHighWater();
+    }
 
 protected:
-    DataQueue<DataPair> send_que;
-    DataQueue<DataPair> recv_que;
+    // timestamp for a frame or a syscall, 0 while tracing is off
+    inline uint64_t trace_clock() const
+    {
+#ifdef TRANSPORT_DISABLE_TRACING
+        return 0;
+#else
+        return tracing_enabled.load(std::memory_order_acquire) ? trace_now() : 0;
+#endif
+    }
+
+    // called by the send backend after the syscall that started at `start`
+    inline void trace_send(const FrameMeta& meta, uint64_t start)
+    {
+        if (!start)
+            return;
+        uint64_t now = trace_now();
+        if (meta.timestamp && start >= meta.timestamp)
+            latency_hist[static_cast<size_t>(TraceStage::SEND_QUEUE)].record(start - meta.timestamp);
+        latency_hist[static_cast<size_t>(TraceStage::SEND_SYSCALL)].record(now - start);
+    }
+
+    inline void trace_received(const FrameMeta& meta)
+    {
+        if (!meta.timestamp)
+            return;
+        uint64_t now = trace_clock();
+        if (now >= meta.timestamp)
+            latency_hist[static_cast<size_t>(TraceStage::RECV_QUEUE)].record(now - meta.timestamp);
+    }
+
+    // record a frame if capture is enabled, `time` 0 for now
+    inline void capture(CaptureDirection direction, const FrameType& frame,
+                        const struct sockaddr* addr, socklen_t addr_len, uint64_t time = 0)
+    {
+        if (!capture_enabled.load(std::memory_order_relaxed))
+            return;
+        std::shared_ptr<CaptureWriter> writer = std::atomic_load(&capture_writer);
+        if (writer)
+            writer->write(direction, time ? time : capture_now(), addr, addr_len,
+                          P::frame_data(frame), P::frame_size(frame));
+    }
+
+    // hand a frame from the receive backend to the application
+    inline void deliver(FrameType frame, std::shared_ptr<TransportToken> token, const FrameMeta& meta = FrameMeta())
+    {
+        if (capture_enabled.load(std::memory_order_relaxed))
+        {
+            socklen_t addr_len = 0;
+            const struct sockaddr* addr = token ? token->peer_address(&addr_len) : nullptr;
+            // a NIC clock stamp would put the record in another time base
+            capture(CaptureDirection::RECEIVED, frame, addr, addr_len, meta.kernel_raw ? 0 : meta.kernel_time);
+        }
+        FrameEntry entry(std::move(frame), std::move(token));
+        entry.meta = meta;
+        entry.meta.timestamp = trace_clock();
+        uint64_t ttl = receive_ttl.load(std::memory_order_relaxed);
+        if (ttl)
+            entry.meta.deadline = deadline_ns(std::chrono::steady_clock::now()) + ttl;
+        std::shared_ptr<ReceiveDispatch> dispatch = std::atomic_load(&receive_dispatch);
+        if (dispatch)
+        {
+            dispatch_entry(std::move(dispatch), std::move(entry));
+            return;
+        }
+        recv_que.Push(std::move(entry));
+    }
+
+    // next frame for the send backend, in priority and fair order, skipping
+    // expired frames; throws QueueTimeout if `timeout` is positive and
+    // nothing arrives in time
+    FrameEntry pop_send(std::chrono::milliseconds timeout = std::chrono::milliseconds(0))
+    {
+        while (true)
+        {
+            FrameEntry entry = next_send(timeout);
+            if (entry.meta.coalesced && !take_latest(entry))
+                continue;
+            if (drop_expired(entry))
+                continue;
+            pace(entry);
+            // the deadline may have passed while pacing held the frame
+            if (drop_expired(entry))
+                continue;
+            return entry;
+        }
+    }
+
+    static inline uint64_t deadline_ns(Deadline deadline)
+    {
+        if (deadline == Deadline())
+            return 0;
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(deadline.time_since_epoch()).count();
+    }
+
+    static inline bool expired(const FrameMeta& meta)
+    {
+        return meta.deadline && deadline_ns(std::chrono::steady_clock::now()) > meta.deadline;
+    }
+
+    // resolve send_async() for the frame, `result` is the bytes written or -errno
+    static inline void complete_send(FrameEntry& entry, ssize_t result)
+    {
+        entry.meta.completion.complete(result);
+    }
+
+    // called by the send backend once per send syscall
+    inline void count_send(size_t size, ssize_t sent)
+    {
+        if (sent < 0) {
+            counters.send.errors.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        counters.send.frames.fetch_add(1, std::memory_order_relaxed);
+        counters.send.bytes.fetch_add(sent, std::memory_order_relaxed);
+        if ((size_t)sent < size)
+            counters.send.partial.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    inline void count_send_error()
+    {
+        counters.send.errors.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    inline void count_drop()
+    {
+        counters.send.dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    inline void count_receive(size_t size)
+    {
+        counters.recv.frames.fetch_add(1, std::memory_order_relaxed);
+        counters.recv.bytes.fetch_add(size, std::memory_order_relaxed);
+    }
+
+    inline void count_receive_error()
+    {
+        counters.recv.errors.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    inline void count_truncated()
+    {
+        counters.recv.truncated.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    inline void count_invalid_frame()
+    {
+        counters.recv.invalid.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    TransportCounters counters;
+    std::atomic<bool> tracing_enabled;
+    std::unique_ptr<LatencyHistogram[]> latency_hist;
+    std::atomic<bool> capture_enabled;
+    std::shared_ptr<CaptureWriter> capture_writer;
+    std::shared_ptr<ReceiveDispatch> receive_dispatch;
+    std::shared_ptr<logging::RateLimiter> handler_error_limit;  // shared with queued DispatchTasks
+    typedef MultiLaneQueue<FrameEntry, TRANSPORT_PRIORITY_COUNT> SendQueue;
+
+    SendQueue send_que;
+    DataQueue<FrameEntry> recv_que;
+    std::array<std::unique_ptr<FairQueue<FrameEntry>>, TRANSPORT_PRIORITY_COUNT> fair_lanes;   // none for CONTROL
+    LaneSelector<TRANSPORT_PRIORITY_COUNT> fair_selector;
+    std::mutex fair_mutex;      // fair_selector, set_priority_weights() may run at any time
+    size_t fair_peer_limit;
+    std::atomic<uint64_t> receive_ttl;
+    Pacer pacer;
+    std::unordered_map<uint64_t, FrameEntry> latest_frames;
+    std::mutex latest_mutex;
+
+private:
+    void queue_send(FrameEntry entry, Priority priority, Deadline deadline)
+    {
+        entry.meta.timestamp = trace_clock();
+        entry.meta.priority = priority;
+        entry.meta.deadline = deadline_ns(deadline);
+        send_que.Push(std::move(entry), static_cast<size_t>(priority));
+    }
+
+    static void run_handler(ReceiveHandler& handler, FrameEntry& entry, logging::RateLimiter& error_limit)
+    {
+        try
+        {
+            handler(entry);
+        }
+        catch (const std::exception& e)
+        {
+            auto &logger = *logging::get_logger("transport");
+            error_limit.log(logger, logging::LogLevel::ERROR, "receive handler failed: %s", e.what());
+        }
+    }
+
+    // a frame on its way to a handler on the pool; holds neither the
+    // transport nor the pool, so either may go away while it is queued
+    struct DispatchTask
+    {
+        std::shared_ptr<ReceiveHandler> handler;
+        std::shared_ptr<logging::RateLimiter> error_limit;
+        FrameEntry entry;
+
+        void operator()()
+        {
+            run_handler(*handler, entry, *error_limit);
+        }
+    };
+
+    void dispatch_entry(std::shared_ptr<ReceiveDispatch> dispatch, FrameEntry entry)
+    {
+        trace_received(entry.meta);
+        if (!dispatch->pool)
+        {
+            run_handler(*dispatch->handler, entry, *handler_error_limit);
+            return;
+        }
+        size_t key = entry.second ? entry.second->peer_hash() : 0;
+        DispatchTask task = {dispatch->handler, handler_error_limit, std::move(entry)};
+        if (dispatch->mode == Dispatch::BY_TOKEN)
+            dispatch->pool->submit(key, std::move(task));
+        else
+            dispatch->pool->submit(std::move(task));
+    }
+
+    // the next frame from send_que, through the fair queues if enabled
+    FrameEntry next_send(std::chrono::milliseconds timeout)
+    {
+        if (!fair_queuing())
+        {
+            return timeout.count() > 0 ? send_que.Pop(timeout) : send_que.Pop();
+        }
+        FrameEntry entry;
+        while (true)
+        {
+            if (is_closed)
+            {
+                for (auto& lane : fair_lanes)
+                {
+                    if (lane)
+                        lane->clear();
+                }
+                throw QueueCleared(&send_que);
+            }
+            while (send_que.TryPop(entry))
+            {
+                if (entry.meta.priority == Priority::CONTROL)
+                    return entry;
+                queue_fair(std::move(entry));
+            }
+            if (pop_fair(entry))
+                return entry;
+            entry = timeout.count() > 0 ? send_que.Pop(timeout) : send_que.Pop();
+            if (entry.meta.priority == Priority::CONTROL)
+                return entry;
+            queue_fair(std::move(entry));
+        }
+    }
+
+    // sleep until both the transport and the peer bucket allow the frame
+    void pace(const FrameEntry& entry)
+    {
+        PeerState* peer = entry.second ? entry.second->peer_state() : nullptr;
+        bool peer_paced = peer && peer->pacer().enabled();
+        if (!pacer.enabled() && !peer_paced)
+            return;
+        size_t size = P::frame_size(entry.first);
+        Pacer::Clock::time_point now = Pacer::Clock::now();
+        Pacer::Clock::time_point due = pacer.take(size, now);
+        if (peer_paced)
+            due = std::max(due, peer->pacer().take(size, now));
+        if (due <= now)
+            return;
+        counters.send.paced.fetch_add(1, std::memory_order_relaxed);
+        // in slices, so close() does not wait for a slow rate
+        while (now < due)
+        {
+            if (is_closed)
+                throw QueueCleared(&send_que);
+            std::this_thread::sleep_until(std::min(due, now + std::chrono::milliseconds(50)));
+            now = Pacer::Clock::now();
+        }
+    }
+
+    // true if the frame is past its deadline, completing it with -ETIMEDOUT
+    bool drop_expired(FrameEntry& entry)
+    {
+        if (!expired(entry.meta))
+            return false;
+        counters.send.expired.fetch_add(1, std::memory_order_relaxed);
+        entry.meta.completion.complete(-ETIMEDOUT);
+        return true;
+    }
+
+    // size of the frame a send_latest() placeholder stands for
+    size_t latest_size(uint64_t key)
+    {
+        std::lock_guard<std::mutex> lock(latest_mutex);
+        auto it = latest_frames.find(key);
+        return it == latest_frames.end() ? 0 : P::frame_size(it->second.first);
+    }
+
+    // swap a coalescing placeholder for the latest frame of its key, false
+    // if that frame was already sent or dropped
+    bool take_latest(FrameEntry& entry)
+    {
+        std::lock_guard<std::mutex> lock(latest_mutex);
+        auto it = latest_frames.find(entry.meta.key);
+        if (it == latest_frames.end())
+            return false;
+        entry = std::move(it->second);
+        latest_frames.erase(it);
+        return true;
+    }
+
+    // from the fair lanes in lane order, or by the priority weights
+    bool pop_fair(FrameEntry& entry)
+    {
+        auto ready = [this](size_t lane) { return fair_lanes[lane] && !fair_lanes[lane]->empty(); };
+        size_t lane;
+        {
+            std::lock_guard<std::mutex> lock(fair_mutex);
+            bool any = false;
+            for (size_t i = 0; i < fair_lanes.size(); ++i)
+                any = any || ready(i);
+            if (!any)
+                return false;
+            lane = fair_selector.Select(ready);
+        }
+        return fair_lanes[lane]->pop(entry);
+    }
+
+    void queue_fair(FrameEntry entry)
+    {
+        FairQueue<FrameEntry>& lane = *fair_lanes[static_cast<size_t>(entry.meta.priority)];
+        // keeps the peer alive if the frame is dropped
+        std::shared_ptr<TransportToken> token = entry.second;
+        PeerState* peer = token ? token->peer_state() : nullptr;
+        uint32_t weight = peer ? peer->send_weight() : 1;
+        size_t limit = peer && peer->send_limit() ? peer->send_limit() : fair_peer_limit;
+        bool coalesced = entry.meta.coalesced;
+        uint64_t key = entry.meta.key;
+        size_t size = coalesced ? latest_size(key) : P::frame_size(entry.first);
+        CompletionRef completion = entry.meta.completion;
+        if (!lane.push(std::move(entry), token.get(), size, weight, limit))
+        {
+            FrameEntry latest;
+            latest.meta.key = key;
+            // a dropped placeholder takes its frame along, or the key would stay stuck
+            if (coalesced && take_latest(latest))
+                latest.meta.completion.complete(-ENOBUFS);
+            completion.complete(-ENOBUFS);
+            count_drop();
+            if (peer)
+                peer->count_drop();
+        }
+    }
 };
 
 }
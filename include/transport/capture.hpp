@@ -0,0 +1,255 @@
+#ifndef _INCLUDE_TRANSPORT_CAPTURE_
+#define _INCLUDE_TRANSPORT_CAPTURE_
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+
+/*
+ * Traffic capture in the classic pcap format with nanosecond timestamps.
+ * Frames are stored with LINKTYPE_USER0: every packet starts with a
+ * CaptureFrameHeader and the raw peer sockaddr, followed by the frame bytes
+ * as they were passed to or returned by the kernel. In Wireshark, map
+ * DLT_USER0 to a dissector with a header size of 4 + addr_len.
+ */
+
+#define TRANSPORT_CAPTURE_MAGIC 0xa1b23c4d      // pcap, nanosecond resolution
+#define TRANSPORT_CAPTURE_MAGIC_USEC 0xa1b2c3d4
+#define TRANSPORT_CAPTURE_LINKTYPE 147          // LINKTYPE_USER0
+#define TRANSPORT_CAPTURE_SNAPLEN 262144        // bytes kept per frame, pseudo header included
+#define TRANSPORT_CAPTURE_BUFFER_SIZE 1024 * 1024
+#define TRANSPORT_CAPTURE_FLUSH_INTERVAL 1000   // ms between flushes of the buffer
+
+namespace transport
+{
+
+enum class CaptureDirection: uint8_t
+{
+    RECEIVED = 0,
+    SENT = 1
+};
+
+struct CaptureFileHeader
+{
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t network;
+};
+
+struct CaptureRecordHeader
+{
+    uint32_t ts_sec;
+    uint32_t ts_frac;       // nanoseconds, microseconds for TRANSPORT_CAPTURE_MAGIC_USEC
+    uint32_t incl_len;
+    uint32_t orig_len;
+};
+
+// LINKTYPE_USER0 pseudo header in front of every frame
+struct CaptureFrameHeader
+{
+    uint8_t direction;      // CaptureDirection
+    uint8_t reserved;
+    uint16_t addr_len;      // length of the sockaddr that follows, 0 if unknown
+};
+
+// wall clock nanoseconds, the time base of capture files
+static inline uint64_t capture_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline uint64_t capture_monotonic_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ * Appends frames to a capture file, safe to share between backend threads.
+ * The buffer is flushed by the first write after `flush_interval` ms, so a
+ * crash loses at most that much of the capture tail; 0 flushes every write.
+ */
+class CaptureWriter
+{
+public:
+    // the pseudo header and address are never cut, snaplen only limits the frame bytes
+    explicit CaptureWriter(const std::string& path, uint32_t snaplen = TRANSPORT_CAPTURE_SNAPLEN,
+                           uint32_t flush_interval = TRANSPORT_CAPTURE_FLUSH_INTERVAL)
+        : snaplen(std::max<uint32_t>(snaplen, sizeof(CaptureFrameHeader) + sizeof(struct sockaddr_storage))),
+          flush_interval(flush_interval), last_flush(capture_monotonic_ms())
+    {
+        file = fopen(path.c_str(), "wb");
+        if (!file)
+        {
+            throw std::runtime_error("failed to open capture file " + path + ": " + strerror(errno));
+        }
+        setvbuf(file, nullptr, _IOFBF, TRANSPORT_CAPTURE_BUFFER_SIZE);
+        CaptureFileHeader header = {TRANSPORT_CAPTURE_MAGIC, 2, 4, 0, 0, this->snaplen, TRANSPORT_CAPTURE_LINKTYPE};
+        fwrite(&header, sizeof(header), 1, file);
+    }
+    CaptureWriter(const CaptureWriter&) = delete;
+
+    ~CaptureWriter()
+    {
+        fclose(file);
+    }
+
+    void write(CaptureDirection direction, uint64_t time, const struct sockaddr* addr, socklen_t addr_len,
+               const void* data, size_t size)
+    {
+        if (!addr || addr_len > sizeof(struct sockaddr_storage)) addr_len = 0;
+        CaptureFrameHeader frame_header = {static_cast<uint8_t>(direction), 0, static_cast<uint16_t>(addr_len)};
+        size_t total = sizeof(frame_header) + addr_len + size;
+        size_t incl = total < snaplen ? total : snaplen;
+        CaptureRecordHeader header = {
+            static_cast<uint32_t>(time / 1000000000), static_cast<uint32_t>(time % 1000000000),
+            static_cast<uint32_t>(incl), static_cast<uint32_t>(total)
+        };
+        std::lock_guard<std::mutex> lock(mutex);
+        fwrite(&header, sizeof(header), 1, file);
+        fwrite(&frame_header, sizeof(frame_header), 1, file);
+        if (addr_len)
+            fwrite(addr, addr_len, 1, file);
+        if (incl > sizeof(frame_header) + addr_len)
+            fwrite(data, incl - sizeof(frame_header) - addr_len, 1, file);
+        uint64_t now = capture_monotonic_ms();
+        if (now - last_flush >= flush_interval)
+        {
+            fflush(file);
+            last_flush = now;
+        }
+    }
+
+    void flush()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        fflush(file);
+    }
+
+private:
+    FILE* file;
+    uint32_t snaplen;
+    uint32_t flush_interval;
+    uint64_t last_flush;
+    std::mutex mutex;
+};
+
+struct CaptureRecord
+{
+    uint64_t time;          // nanoseconds since the epoch
+    CaptureDirection direction;
+    const struct sockaddr* addr;
+    socklen_t addr_len;
+    const uint8_t* data;
+    size_t size;            // captured bytes, may be less than orig_size
+    size_t orig_size;
+};
+
+// sequential reader over a mapped capture file written by CaptureWriter
+class CaptureReader
+{
+public:
+    explicit CaptureReader(const std::string& path) : base(nullptr), size(0), offset(0), nsec(true)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            throw std::runtime_error("failed to open capture file " + path + ": " + strerror(errno));
+        }
+        struct stat st;
+        if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(CaptureFileHeader))
+        {
+            ::close(fd);
+            throw std::runtime_error("invalid capture file " + path);
+        }
+        size = st.st_size;
+        void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (mapped == MAP_FAILED)
+        {
+            throw std::runtime_error("failed to map capture file " + path + ": " + strerror(errno));
+        }
+        base = static_cast<const uint8_t*>(mapped);
+        madvise(mapped, size, MADV_SEQUENTIAL);
+
+        const CaptureFileHeader* header = reinterpret_cast<const CaptureFileHeader*>(base);
+        if ((header->magic != TRANSPORT_CAPTURE_MAGIC && header->magic != TRANSPORT_CAPTURE_MAGIC_USEC) ||
+            header->network != TRANSPORT_CAPTURE_LINKTYPE)
+        {
+            munmap(mapped, size);
+            throw std::runtime_error("not a transport capture file " + path);
+        }
+        nsec = header->magic == TRANSPORT_CAPTURE_MAGIC;
+        offset = sizeof(CaptureFileHeader);
+    }
+    CaptureReader(const CaptureReader&) = delete;
+
+    ~CaptureReader()
+    {
+        munmap(const_cast<uint8_t*>(base), size);
+    }
+
+    // false at the end of the file or at a truncated record
+    bool next(CaptureRecord& record)
+    {
+        while (offset + sizeof(CaptureRecordHeader) <= size)
+        {
+            CaptureRecordHeader header;
+            memcpy(&header, base + offset, sizeof(header));
+            const uint8_t* packet = base + offset + sizeof(header);
+            if (offset + sizeof(header) + header.incl_len > size)
+                return false;
+            offset += sizeof(header) + header.incl_len;
+
+            CaptureFrameHeader frame_header;
+            if (header.incl_len < sizeof(frame_header))
+                continue;
+            memcpy(&frame_header, packet, sizeof(frame_header));
+            size_t prefix = sizeof(frame_header) + frame_header.addr_len;
+            if (header.incl_len < prefix || header.orig_len < header.incl_len)
+                continue;
+            record.time = (uint64_t)header.ts_sec * 1000000000 + header.ts_frac * (nsec ? 1 : 1000);
+            record.direction = static_cast<CaptureDirection>(frame_header.direction);
+            record.addr = frame_header.addr_len ? reinterpret_cast<const struct sockaddr*>(packet + sizeof(frame_header)) : nullptr;
+            record.addr_len = frame_header.addr_len;
+            record.data = packet + prefix;
+            record.size = header.incl_len - prefix;
+            record.orig_size = header.orig_len - prefix;
+            return true;
+        }
+        return false;
+    }
+
+    void rewind()
+    {
+        offset = sizeof(CaptureFileHeader);
+    }
+
+private:
+    const uint8_t* base;
+    size_t size;
+    size_t offset;
+    bool nsec;
+};
+
+}
+
+#endif
@@ -0,0 +1,259 @@
+#ifndef _INCLUDE_TRANSPORT_COMPLETION_
+#define _INCLUDE_TRANSPORT_COMPLETION_
+
+#include <errno.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#define TRANSPORT_COMPLETION_CHUNK 256     // slots allocated at once when the pool runs dry
+
+namespace transport
+{
+
+// bytes written, or -errno
+typedef std::function<void(ssize_t)> SendCallback;
+
+class CompletionPool;
+
+// result of one send_async(), recycled through the CompletionPool
+class CompletionSlot
+{
+public:
+    CompletionSlot() : refs(0), senders(0), done(false), result(0), next(nullptr) {}
+    CompletionSlot(const CompletionSlot&) = delete;
+
+    // the first result wins, later ones are ignored
+    void complete(ssize_t value)
+    {
+        SendCallback handler;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (done)
+                return;
+            result = value;
+            done = true;
+            handler = std::move(callback);
+            callback = nullptr;
+            cond.notify_all();
+        }
+        if (handler)
+            handler(value);
+    }
+
+private:
+    friend class CompletionPool;
+    friend class CompletionRef;
+    friend class SendFuture;
+
+    std::atomic<uint32_t> refs;         // futures and frame side references
+    std::atomic<uint32_t> senders;      // frame side references only
+    bool done;
+    ssize_t result;
+    SendCallback callback;
+    std::mutex mutex;
+    std::condition_variable cond;
+    CompletionSlot* next;               // free list
+};
+
+/*
+ * Process-wide free list of completion slots. Slots are allocated in chunks
+ * and never freed, so a steady stream of send_async() allocates nothing,
+ * and futures may outlive the transport that created them.
+ */
+class CompletionPool
+{
+public:
+    static CompletionPool& instance()
+    {
+        // never destroyed, detached backends may still release slots at exit
+        static CompletionPool* pool = new CompletionPool;
+        return *pool;
+    }
+
+    CompletionSlot* acquire(SendCallback callback)
+    {
+        CompletionSlot* slot;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!free_list)
+                grow();
+            slot = free_list;
+            free_list = slot->next;
+        }
+        slot->done = false;
+        slot->result = 0;
+        slot->callback = std::move(callback);
+        slot->refs.store(0, std::memory_order_relaxed);
+        slot->senders.store(0, std::memory_order_relaxed);
+        return slot;
+    }
+
+    void release(CompletionSlot* slot)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        slot->next = free_list;
+        free_list = slot;
+    }
+
+private:
+    CompletionPool() : free_list(nullptr) {}
+
+    void grow()
+    {
+        chunks.emplace_back(new CompletionSlot[TRANSPORT_COMPLETION_CHUNK]);
+        CompletionSlot* chunk = chunks.back().get();
+        for (size_t i = 0; i < TRANSPORT_COMPLETION_CHUNK; ++i)
+        {
+            chunk[i].next = free_list;
+            free_list = &chunk[i];
+        }
+    }
+
+    std::mutex mutex;
+    CompletionSlot* free_list;
+    std::vector<std::unique_ptr<CompletionSlot[]>> chunks;
+};
+
+static inline void release_slot(CompletionSlot* slot, std::atomic<uint32_t>& refs)
+{
+    if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        CompletionPool::instance().release(slot);
+}
+
+/*
+ * The frame side of a completion, carried in FrameMeta. Copies share the
+ * slot; once the last copy goes away without complete(), e.g. because the
+ * frame was dropped or the queue cleared, the send resolves with -ECANCELED.
+ */
+class CompletionRef
+{
+public:
+    CompletionRef() : slot(nullptr) {}
+    explicit CompletionRef(CompletionSlot* slot) : slot(slot)
+    {
+        retain();
+    }
+    CompletionRef(const CompletionRef& other) : slot(other.slot)
+    {
+        retain();
+    }
+    CompletionRef(CompletionRef&& other) noexcept : slot(other.slot)
+    {
+        other.slot = nullptr;
+    }
+    CompletionRef& operator=(CompletionRef other) noexcept
+    {
+        std::swap(slot, other.slot);
+        return *this;
+    }
+    ~CompletionRef()
+    {
+        reset();
+    }
+
+    explicit operator bool() const
+    {
+        return slot != nullptr;
+    }
+
+    void complete(ssize_t result)
+    {
+        if (slot)
+            slot->complete(result);
+    }
+
+    void reset()
+    {
+        if (!slot)
+            return;
+        if (slot->senders.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            slot->complete(-ECANCELED);
+        release_slot(slot, slot->refs);
+        slot = nullptr;
+    }
+
+private:
+    void retain()
+    {
+        if (!slot)
+            return;
+        slot->refs.fetch_add(1, std::memory_order_relaxed);
+        slot->senders.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    CompletionSlot* slot;
+};
+
+// the application side of send_async(), move only
+class SendFuture
+{
+public:
+    SendFuture() : slot(nullptr) {}
+    explicit SendFuture(CompletionSlot* slot) : slot(slot)
+    {
+        if (slot)
+            slot->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+    SendFuture(const SendFuture&) = delete;
+    SendFuture(SendFuture&& other) noexcept : slot(other.slot)
+    {
+        other.slot = nullptr;
+    }
+    SendFuture& operator=(SendFuture&& other) noexcept
+    {
+        std::swap(slot, other.slot);
+        return *this;
+    }
+    ~SendFuture()
+    {
+        if (slot)
+            release_slot(slot, slot->refs);
+    }
+
+    bool valid() const
+    {
+        return slot != nullptr;
+    }
+
+    bool ready() const
+    {
+        std::lock_guard<std::mutex> lock(slot->mutex);
+        return slot->done;
+    }
+
+    void wait() const
+    {
+        std::unique_lock<std::mutex> lock(slot->mutex);
+        slot->cond.wait(lock, [this] { return slot->done; });
+    }
+
+    // false on timeout
+    template <typename Rep, typename Period>
+    bool wait_for(const std::chrono::duration<Rep, Period>& timeout) const
+    {
+        std::unique_lock<std::mutex> lock(slot->mutex);
+        return slot->cond.wait_for(lock, timeout, [this] { return slot->done; });
+    }
+
+    // bytes written or -errno, waits for the send
+    ssize_t get() const
+    {
+        wait();
+        std::lock_guard<std::mutex> lock(slot->mutex);
+        return slot->result;
+    }
+
+private:
+    CompletionSlot* slot;
+};
+
+}
+
+#endif
@@ -0,0 +1,662 @@
+#ifndef _INCLUDE_TRANSPORT_COROUTINE_
+#define _INCLUDE_TRANSPORT_COROUTINE_
+
+/*
+ * C++20 coroutine front end, empty unless the compiler implements
+ * coroutines. Conversations are written as Task<> coroutines and run on a
+ * Reactor, a few threads resuming whichever coroutine has something to do,
+ * instead of one blocked thread per receive(timeout):
+ *
+ *     Reactor reactor(2);
+ *     AsyncTransport<DatagramTransport<Protocol>> link(transport, reactor);
+ *     reactor.spawn([&]() -> Task<> {
+ *         auto [frame, token] = co_await link.async_receive(std::chrono::seconds(1));
+ *         co_await link.async_send(std::move(frame), token);
+ *     });
+ *
+ * AsyncTransport takes over the transport's on_receive() while it lives,
+ * and frames go to the waiting coroutines in the order they asked. A
+ * coroutine may wait for the frames of one peer only, which is how
+ * async_request() to a token matches its reply; requests to the same peer
+ * cannot be told apart by the transport, so run one at a time per peer or
+ * match replies by an id of the protocol. Frames nobody waits for are kept
+ * for later receives up to the mailbox limit, then the oldest are dropped.
+ */
+#if defined(__cpp_impl_coroutine)
+
+#include <sys/types.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <queue>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "base.hpp"
+
+#define TRANSPORT_ASYNC_MAILBOX_LIMIT 1024      // frames kept for coroutines yet to ask
+
+namespace transport
+{
+
+template <typename T = void>
+class Task;
+
+namespace detail
+{
+
+// resume whoever awaits the task, symmetric transfer keeps the stack flat
+struct FinalAwaiter
+{
+    bool await_ready() noexcept
+    {
+        return false;
+    }
+    template <typename Promise>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept
+    {
+        std::coroutine_handle<> next = handle.promise().continuation;
+        return next ? next : std::noop_coroutine();
+    }
+    void await_resume() noexcept {}
+};
+
+struct TaskPromiseBase
+{
+    std::coroutine_handle<> continuation;
+    std::exception_ptr error;
+
+    std::suspend_always initial_suspend() noexcept
+    {
+        return {};
+    }
+
+    FinalAwaiter final_suspend() noexcept
+    {
+        return {};
+    }
+
+    void unhandled_exception()
+    {
+        error = std::current_exception();
+    }
+};
+
+template <typename T>
+struct TaskPromise : TaskPromiseBase
+{
+    std::optional<T> value;
+
+    Task<T> get_return_object();
+
+    void return_value(T result)
+    {
+        value.emplace(std::move(result));
+    }
+
+    T result()
+    {
+        if (error)
+            std::rethrow_exception(error);
+        return std::move(*value);
+    }
+};
+
+template <>
+struct TaskPromise<void> : TaskPromiseBase
+{
+    Task<void> get_return_object();
+
+    void return_void() {}
+
+    void result()
+    {
+        if (error)
+            std::rethrow_exception(error);
+    }
+};
+
+}
+
+// lazy coroutine, starts when awaited
+template <typename T>
+class Task
+{
+public:
+    typedef detail::TaskPromise<T> promise_type;
+    typedef std::coroutine_handle<promise_type> Handle;
+
+    Task() = default;
+    explicit Task(Handle handle) : handle(handle) {}
+    Task(const Task&) = delete;
+    Task(Task&& other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+    Task& operator=(Task&& other) noexcept
+    {
+        std::swap(handle, other.handle);
+        return *this;
+    }
+    ~Task()
+    {
+        if (handle)
+            handle.destroy();
+    }
+
+    bool await_ready() const noexcept
+    {
+        return !handle || handle.done();
+    }
+
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+    {
+        handle.promise().continuation = awaiting;
+        return handle;
+    }
+
+    T await_resume()
+    {
+        return handle.promise().result();
+    }
+
+private:
+    Handle handle;
+};
+
+namespace detail
+{
+
+template <typename T>
+inline Task<T> TaskPromise<T>::get_return_object()
+{
+    return Task<T>(std::coroutine_handle<TaskPromise<T>>::from_promise(*this));
+}
+
+inline Task<void> TaskPromise<void>::get_return_object()
+{
+    return Task<void>(std::coroutine_handle<TaskPromise<void>>::from_promise(*this));
+}
+
+// runs a task to completion and frees itself
+struct Detached
+{
+    struct promise_type
+    {
+        Detached get_return_object() noexcept
+        {
+            return {};
+        }
+        std::suspend_never initial_suspend() noexcept
+        {
+            return {};
+        }
+        std::suspend_never final_suspend() noexcept
+        {
+            return {};
+        }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept {}
+    };
+};
+
+}
+
+/*
+ * Worker threads resuming coroutines, plus one thread for timers. Timer
+ * callbacks should only post work. The destructor drops pending timers and
+ * joins the threads; coroutines still suspended at that point are leaked.
+ */
+class Reactor
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    explicit Reactor(size_t threads = 1) : stopping(false), timer_seq(0)
+    {
+        if (!threads)
+            threads = 1;
+        for (size_t i = 0; i < threads; ++i)
+            workers.emplace_back([this] { run(); });
+        timer_thread = std::thread([this] { run_timers(); });
+    }
+    Reactor(const Reactor&) = delete;
+
+    ~Reactor()
+    {
+        {
+            std::lock_guard<std::mutex> lock(timer_mutex);
+            stopping = true;
+            timer_cond.notify_all();
+        }
+        timer_thread.join();
+        // a null handle stops one worker
+        for (size_t i = 0; i < workers.size(); ++i)
+            ready.Push(std::coroutine_handle<>());
+        for (auto& worker : workers)
+            worker.join();
+    }
+
+    void post(std::coroutine_handle<> handle)
+    {
+        ready.Push(handle);
+    }
+
+    void call_at(Clock::time_point when, std::function<void()> callback)
+    {
+        std::lock_guard<std::mutex> lock(timer_mutex);
+        timers.push(Timer{when, timer_seq++, std::move(callback)});
+        timer_cond.notify_all();
+    }
+
+    // co_await reactor.schedule() continues on a reactor thread
+    auto schedule()
+    {
+        struct Awaiter
+        {
+            Reactor& reactor;
+            bool await_ready() noexcept
+            {
+                return false;
+            }
+            void await_suspend(std::coroutine_handle<> handle)
+            {
+                reactor.post(handle);
+            }
+            void await_resume() noexcept {}
+        };
+        return Awaiter{*this};
+    }
+
+    template <typename Rep, typename Period>
+    auto sleep_for(std::chrono::duration<Rep, Period> duration)
+    {
+        struct Awaiter
+        {
+            Reactor& reactor;
+            Clock::time_point when;
+            bool await_ready() noexcept
+            {
+                return when <= Clock::now();
+            }
+            void await_suspend(std::coroutine_handle<> handle)
+            {
+                Reactor* target = &reactor;
+                reactor.call_at(when, [target, handle] { target->post(handle); });
+            }
+            void await_resume() noexcept {}
+        };
+        return Awaiter{*this, Clock::now() + std::chrono::duration_cast<Clock::duration>(duration)};
+    }
+
+    // start a conversation on the reactor, exceptions are logged and dropped
+    void spawn(Task<> task)
+    {
+        run_detached(*this, std::move(task));
+    }
+
+    template <typename F>
+    void spawn(F factory)
+    {
+        run_factory(*this, std::move(factory));
+    }
+
+private:
+    struct Timer
+    {
+        Clock::time_point when;
+        uint64_t seq;
+        std::function<void()> callback;
+
+        bool operator>(const Timer& other) const
+        {
+            return when != other.when ? when > other.when : seq > other.seq;
+        }
+    };
+
+    static detail::Detached run_detached(Reactor& reactor, Task<> task)
+    {
+        co_await reactor.schedule();
+        try
+        {
+            co_await task;
+        }
+        catch (const std::exception& e)
+        {
+            auto &logger = *logging::get_logger("transport");
+            logger.error("coroutine failed: %s", e.what());
+        }
+    }
+
+    // keeps the lambda, and with it the captures of the coroutine, alive
+    template <typename F>
+    static detail::Detached run_factory(Reactor& reactor, F factory)
+    {
+        co_await reactor.schedule();
+        try
+        {
+            co_await factory();
+        }
+        catch (const std::exception& e)
+        {
+            auto &logger = *logging::get_logger("transport");
+            logger.error("coroutine failed: %s", e.what());
+        }
+    }
+
+    void run()
+    {
+        while (true)
+        {
+            std::coroutine_handle<> handle = ready.Pop();
+            if (!handle)
+                return;
+            handle.resume();
+        }
+    }
+
+    void run_timers()
+    {
+        std::unique_lock<std::mutex> lock(timer_mutex);
+        while (!stopping)
+        {
+            if (timers.empty())
+            {
+                timer_cond.wait(lock);
+                continue;
+            }
+            if (timers.top().when > Clock::now())
+            {
+                timer_cond.wait_until(lock, timers.top().when);
+                continue;
+            }
+            std::function<void()> callback = std::move(const_cast<Timer&>(timers.top()).callback);
+            timers.pop();
+            lock.unlock();
+            callback();
+            lock.lock();
+        }
+    }
+
+    DataQueue<std::coroutine_handle<>> ready;
+    std::vector<std::thread> workers;
+    std::thread timer_thread;
+    std::mutex timer_mutex;
+    std::condition_variable timer_cond;
+    std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> timers;
+    bool stopping;
+    uint64_t timer_seq;
+};
+
+// awaitable send, receive and request on top of a transport
+template <typename T>
+class AsyncTransport
+{
+public:
+    typedef typename T::Protocol::FrameType FrameType;
+    typedef typename T::FrameEntry FrameEntry;
+    typedef typename T::DataPair DataPair;
+
+    AsyncTransport(T& transport, Reactor& reactor)
+        : transport(transport), reactor(reactor), mailbox(std::make_shared<Mailbox>(reactor))
+    {
+        std::shared_ptr<Mailbox> box = mailbox;
+        transport.on_receive([box](FrameEntry& entry) { box->deliver(std::move(entry)); });
+    }
+    AsyncTransport(const AsyncTransport&) = delete;
+
+    ~AsyncTransport()
+    {
+        transport.on_receive(nullptr);
+    }
+
+    // frames kept while no coroutine waits for them, 0 drops them at once
+    void set_mailbox_limit(size_t limit)
+    {
+        std::lock_guard<std::mutex> lock(mailbox->mutex);
+        mailbox->limit = limit;
+        while (mailbox->frames.size() > limit)
+        {
+            mailbox->frames.pop_front();
+            mailbox->dropped++;
+        }
+    }
+
+    // frames dropped over the mailbox limit, late replies and other peers' traffic
+    uint64_t mailbox_dropped()
+    {
+        std::lock_guard<std::mutex> lock(mailbox->mutex);
+        return mailbox->dropped;
+    }
+
+    // resumes with the next frame; throws QueueTimeout if `timeout` is
+    // positive and nothing arrives in time
+    template <typename Rep = int64_t, typename Period = std::milli>
+    auto async_receive(std::chrono::duration<Rep, Period> timeout = std::chrono::milliseconds(0))
+    {
+        return async_receive(nullptr, timeout);
+    }
+
+    // like async_receive(), but only frames whose token equals `from`
+    template <typename Rep = int64_t, typename Period = std::milli>
+    auto async_receive(std::shared_ptr<TransportToken> from,
+                       std::chrono::duration<Rep, Period> timeout = std::chrono::milliseconds(0))
+    {
+        return ReceiveAwaiter{mailbox, std::move(from), std::chrono::duration_cast<Reactor::Clock::duration>(timeout),
+                              nullptr, {}};
+    }
+
+    // resumes once the send backend is done, with the bytes written or -errno
+    auto async_send(FrameType frame, std::shared_ptr<TransportToken> token = nullptr,
+                    Priority priority = Priority::NORMAL)
+    {
+        return SendAwaiter{this, std::move(frame), std::move(token), priority, 0};
+    }
+
+    // like BaseTransport::request(), an empty frame if every retry timed out
+    template <typename Rep = int64_t, typename Period = std::milli>
+    Task<FrameType> async_request(FrameType frame, int max_retry = TRANSPORT_MAX_RETRY,
+                                  std::chrono::duration<Rep, Period> timeout = std::chrono::milliseconds(TRANSPORT_TIMEOUT))
+    {
+        return async_request(std::move(frame), nullptr, max_retry, timeout);
+    }
+
+    // sends to `token` and takes the reply from the same peer only
+    template <typename Rep = int64_t, typename Period = std::milli>
+    Task<FrameType> async_request(FrameType frame, std::shared_ptr<TransportToken> token,
+                                  int max_retry = TRANSPORT_MAX_RETRY,
+                                  std::chrono::duration<Rep, Period> timeout = std::chrono::milliseconds(TRANSPORT_TIMEOUT))
+    {
+        while (max_retry--)
+        {
+            co_await async_send(frame, token);
+            try
+            {
+                DataPair reply = co_await async_receive(token, timeout);
+                co_return std::move(reply.first);
+            }
+            catch (const QueueTimeout&)
+            {
+                auto& logger = *logging::get_logger("transport");
+                logger.warn("request timeout, retrying...");
+            }
+        }
+        co_return FrameType();
+    }
+
+private:
+    struct Waiter
+    {
+        std::coroutine_handle<> handle;
+        std::shared_ptr<TransportToken> from;   // null for any peer
+        std::atomic<bool> done{false};      // claimed by a frame or the timer
+        bool timed_out = false;
+        FrameEntry entry;
+    };
+
+    // frames nobody waits for yet and coroutines waiting for frames
+    struct Mailbox
+    {
+        explicit Mailbox(Reactor& reactor) : reactor(reactor), limit(TRANSPORT_ASYNC_MAILBOX_LIMIT), dropped(0) {}
+
+        void deliver(FrameEntry entry)
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            for (auto it = waiters.begin(); it != waiters.end(); ++it)
+            {
+                if (!matches((*it)->from, entry))
+                    continue;
+                // timed out waiters are removed by their timer, under the lock
+                std::shared_ptr<Waiter> waiter = std::move(*it);
+                waiters.erase(it);
+                waiter->done.store(true);
+                lock.unlock();
+                waiter->entry = std::move(entry);
+                reactor.post(waiter->handle);
+                return;
+            }
+            // the oldest frame is the likeliest to be a late reply
+            if (frames.size() >= limit)
+            {
+                dropped++;
+                if (frames.empty())
+                    return;
+                frames.pop_front();
+            }
+            frames.push_back(std::move(entry));
+        }
+
+        // runs on the timer thread
+        void expire(const std::shared_ptr<Waiter>& waiter)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (waiter->done.exchange(true))
+                    return;
+                waiters.erase(std::find(waiters.begin(), waiters.end(), waiter));
+            }
+            waiter->timed_out = true;
+            reactor.post(waiter->handle);
+        }
+
+        static bool matches(const std::shared_ptr<TransportToken>& from, const FrameEntry& entry)
+        {
+            return !from || (entry.second && *from == *entry.second);
+        }
+
+        Reactor& reactor;
+        std::mutex mutex;
+        std::deque<FrameEntry> frames;
+        std::deque<std::shared_ptr<Waiter>> waiters;
+        size_t limit;
+        uint64_t dropped;
+    };
+
+    struct ReceiveAwaiter
+    {
+        std::shared_ptr<Mailbox> mailbox;
+        std::shared_ptr<TransportToken> from;
+        Reactor::Clock::duration timeout;
+        std::shared_ptr<Waiter> waiter;
+        std::optional<FrameEntry> entry;
+
+        bool await_ready()
+        {
+            std::lock_guard<std::mutex> lock(mailbox->mutex);
+            return take();
+        }
+
+        bool await_suspend(std::coroutine_handle<> handle)
+        {
+            // once the waiter is queued this awaiter may be resumed and gone
+            // before the lock is released, so hold the mailbox locally
+            std::shared_ptr<Mailbox> box = mailbox;
+            std::lock_guard<std::mutex> lock(box->mutex);
+            if (take())
+                return false;
+            waiter = std::make_shared<Waiter>();
+            waiter->handle = handle;
+            waiter->from = from;
+            box->waiters.push_back(waiter);
+            if (timeout.count() > 0)
+            {
+                std::shared_ptr<Waiter> pending = waiter;
+                box->reactor.call_at(Reactor::Clock::now() + timeout, [box, pending] {
+                    box->expire(pending);
+                });
+            }
+            return true;
+        }
+
+        DataPair await_resume()
+        {
+            if (entry)
+                return DataPair(std::move(*entry));
+            if (waiter->timed_out)
+                throw QueueTimeout(nullptr);
+            return DataPair(std::move(waiter->entry));
+        }
+
+        // with the mailbox locked
+        bool take()
+        {
+            auto& frames = mailbox->frames;
+            for (auto it = frames.begin(); it != frames.end(); ++it)
+            {
+                if (Mailbox::matches(from, *it))
+                {
+                    entry.emplace(std::move(*it));
+                    frames.erase(it);
+                    return true;
+                }
+            }
+            return false;
+        }
+    };
+
+    struct SendAwaiter
+    {
+        AsyncTransport* owner;
+        FrameType frame;
+        std::shared_ptr<TransportToken> token;
+        Priority priority;
+        ssize_t result;
+
+        bool await_ready() noexcept
+        {
+            return false;
+        }
+
+        void await_suspend(std::coroutine_handle<> handle)
+        {
+            Reactor* reactor = &owner->reactor;
+            ssize_t* out = &result;
+            // the callback may resume the coroutine before this returns,
+            // nothing may touch the awaiter after send_async
+            owner->transport.send_async(std::move(frame), [reactor, out, handle](ssize_t sent) {
+                *out = sent;
+                reactor->post(handle);
+            }, std::move(token), priority);
+        }
+
+        ssize_t await_resume() noexcept
+        {
+            return result;
+        }
+    };
+
+    T& transport;
+    Reactor& reactor;
+    std::shared_ptr<Mailbox> mailbox;
+};
+
+}
+
+#endif
+
+#endif
@@ -0,0 +1,117 @@
+#ifndef _INCLUDE_TRANSPORT_DISPATCH_
+#define _INCLUDE_TRANSPORT_DISPATCH_
+
+#include <stdint.h>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "dataqueue.hpp"
+#include "logging/logger.hpp"
+
+namespace transport
+{
+
+// how a transport spreads received frames over a WorkerPool
+enum class Dispatch
+{
+    ANY,            // next worker in turn, frames of a peer may overlap
+    BY_TOKEN,       // one worker per token, each peer's frames stay in order
+};
+
+/*
+ * Threads running receive handlers, shareable between transports. Each
+ * worker has its own queue, so tasks submitted with the same key run in
+ * submission order. The destructor runs the tasks already submitted, then
+ * joins the workers.
+ */
+class WorkerPool
+{
+public:
+    typedef std::function<void()> Task;
+
+    explicit WorkerPool(size_t threads = std::thread::hardware_concurrency()) : next(0)
+    {
+        if (!threads)
+            threads = 1;
+        for (size_t i = 0; i < threads; ++i)
+        {
+            workers.emplace_back(new Worker);
+            Worker* worker = workers.back().get();
+            worker->thread = std::thread([worker]() { run(worker->queue); });
+        }
+    }
+    WorkerPool(const WorkerPool&) = delete;
+
+    ~WorkerPool()
+    {
+        // an empty task stops the worker once it reaches it
+        for (auto& worker : workers)
+            worker->queue.Push(Task());
+        for (auto& worker : workers)
+            worker->thread.join();
+    }
+
+    void submit(Task task)
+    {
+        size_t index = next.fetch_add(1, std::memory_order_relaxed) % workers.size();
+        workers[index]->queue.Push(std::move(task));
+    }
+
+    // always the same worker for the same key
+    void submit(size_t key, Task task)
+    {
+        workers[mix(key) % workers.size()]->queue.Push(std::move(task));
+    }
+
+    size_t size() const
+    {
+        return workers.size();
+    }
+
+private:
+    // splitmix64 finalizer; keys are often aligned pointers or small
+    // counters, whose low bits alone would pick the same few workers
+    static uint64_t mix(uint64_t key)
+    {
+        key ^= key >> 30;
+        key *= 0xbf58476d1ce4e5b9ull;
+        key ^= key >> 27;
+        key *= 0x94d049bb133111ebull;
+        return key ^ (key >> 31);
+    }
+
+    struct Worker
+    {
+        DataQueue<Task> queue;
+        std::thread thread;
+    };
+
+    static void run(DataQueue<Task>& queue)
+    {
+        auto &logger = *logging::get_logger("transport");
+        while (true)
+        {
+            Task task = queue.Pop();
+            if (!task)
+                return;
+            try
+            {
+                task();
+            }
+            catch (const std::exception& e)
+            {
+                logger.error("receive handler failed: %s", e.what());
+            }
+        }
+    }
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::atomic<size_t> next;
+};
+
+}
+
+#endif
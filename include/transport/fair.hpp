@@ -0,0 +1,128 @@
+#ifndef _INCLUDE_TRANSPORT_FAIR_
+#define _INCLUDE_TRANSPORT_FAIR_
+
+#include <stdint.h>
+#include <atomic>
+#include <deque>
+#include <list>
+#include <unordered_map>
+#include <utility>
+
+#define TRANSPORT_FAIR_QUANTUM 1500     // bytes a weight 1 peer may send per round
+
+namespace transport
+{
+
+/*
+ * Deficit round-robin over per-destination sub-queues. Every round each
+ * backlogged flow may send quantum * weight bytes, so a peer with a deep
+ * backlog delays the others by at most one quantum per round, whatever the
+ * frame sizes. Flows are keyed by an opaque pointer, the interned token of
+ * the peer. Only one thread may push and pop; size() may be read from any.
+ */
+template <typename T>
+class FairQueue
+{
+public:
+    explicit FairQueue(size_t quantum = TRANSPORT_FAIR_QUANTUM) : quantum(quantum ? quantum : 1), count(0) {}
+    FairQueue(const FairQueue&) = delete;
+
+    // false, and `item` is dropped, if the flow would hold more than `limit` bytes (0 for no limit)
+    bool push(T item, const void* key, size_t size, uint32_t weight, size_t limit)
+    {
+        Flow& flow = flows[key];
+        if (limit && flow.bytes + size > limit && !flow.items.empty())
+        {
+            return false;
+        }
+        flow.weight = weight ? weight : 1;
+        flow.items.emplace_back(std::move(item), size);
+        flow.bytes += size;
+        if (flow.items.size() == 1)
+        {
+            flow.deficit = 0;
+            flow.granted = false;
+            active.push_back(key);
+        }
+        count.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    bool pop(T& item)
+    {
+        while (!active.empty())
+        {
+            auto it = flows.find(active.front());
+            Flow& flow = it->second;
+            if (!flow.granted)
+            {
+                flow.deficit += quantum * flow.weight;
+                flow.granted = true;
+            }
+            size_t size = flow.items.front().second;
+            if (size > flow.deficit)
+            {
+                // turn over, the deficit carries to the next round
+                flow.granted = false;
+                active.splice(active.end(), active, active.begin());
+                continue;
+            }
+            item = std::move(flow.items.front().first);
+            flow.items.pop_front();
+            flow.deficit -= size;
+            flow.bytes -= size;
+            count.fetch_sub(1, std::memory_order_relaxed);
+            if (flow.items.empty())
+            {
+                active.pop_front();
+                flows.erase(it);
+            }
+            return true;
+        }
+        return false;
+    }
+
+    bool empty() const
+    {
+        return active.empty();
+    }
+
+    size_t size() const
+    {
+        return count.load(std::memory_order_relaxed);
+    }
+
+    // destinations with frames waiting
+    size_t flow_count() const
+    {
+        return active.size();
+    }
+
+    void clear()
+    {
+        flows.clear();
+        active.clear();
+        count.store(0, std::memory_order_relaxed);
+    }
+
+private:
+    struct Flow
+    {
+        std::deque<std::pair<T, size_t>> items;
+        size_t bytes;
+        size_t deficit;
+        uint32_t weight;
+        bool granted;       // quantum added for the current turn
+
+        Flow() : bytes(0), deficit(0), weight(1), granted(false) {}
+    };
+
+    size_t quantum;
+    std::unordered_map<const void*, Flow> flows;
+    std::list<const void*> active;
+    std::atomic<size_t> count;
+};
+
+}
+
+#endif
@@ -0,0 +1,198 @@
+#ifndef _INCLUDE_TRANSPORT_FILTER_
+#define _INCLUDE_TRANSPORT_FILTER_
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <linux/filter.h>
+#include <stdexcept>
+#include <vector>
+
+namespace transport
+{
+
+/*
+ * Builder for classic BPF socket filters. Datagrams that fail any rule are
+ * dropped in the kernel, before they wake the receive backend:
+ *
+ *     SocketFilter filter;
+ *     filter.magic("\xaa\x55", 2).length(8, 1024).length_field(2, 2, 4, 1020);
+ *     transport.attach_filter(filter);
+ *
+ * Offsets are relative to the frame; the transport compiles the rules with
+ * the size of the headers the kernel has in front of it when the filter
+ * runs, 8 bytes of UDP header for DatagramTransport and none for unix
+ * sockets. With fragmentation enabled the rules see every fragment,
+ * FragmentHeader included.
+ */
+class SocketFilter
+{
+public:
+    // the frame starts with `size` bytes equal to `bytes` at `offset`
+    SocketFilter& magic(const void* bytes, size_t size, uint32_t offset = 0)
+    {
+        const uint8_t* data = static_cast<const uint8_t*>(bytes);
+        while (size > 0)
+        {
+            uint32_t width = size >= 4 ? 4 : size >= 2 ? 2 : 1;
+            uint32_t value = 0;
+            for (uint32_t i = 0; i < width; ++i)
+                value = (value << 8) | data[i];     // BPF loads are big endian
+            Rule rule = {Rule::EQUAL, offset, width, true, value, value};
+            rules.push_back(rule);
+            data += width;
+            offset += width;
+            size -= width;
+        }
+        return *this;
+    }
+
+    // the frame is between `min` and `max` bytes long
+    SocketFilter& length(uint32_t min, uint32_t max)
+    {
+        Rule rule = {Rule::LENGTH, 0, 0, true, min, max};
+        rules.push_back(rule);
+        return *this;
+    }
+
+    // the `width` byte (1, 2 or 4) integer at `offset` is between `min` and `max`
+    SocketFilter& length_field(uint32_t offset, uint32_t width, uint32_t min, uint32_t max, bool big_endian = false)
+    {
+        if (width != 1 && width != 2 && width != 4)
+        {
+            throw std::invalid_argument("length field must be 1, 2 or 4 bytes");
+        }
+        Rule rule = {Rule::RANGE, offset, width, big_endian, min, max};
+        rules.push_back(rule);
+        return *this;
+    }
+
+    bool empty() const
+    {
+        return rules.empty();
+    }
+
+    // the program for a socket with `base` bytes of headers in front of the frame
+    std::vector<struct sock_filter> compile(uint32_t base) const
+    {
+        std::vector<struct sock_filter> program;
+        std::vector<Reject> rejects;
+        for (const Rule& rule : rules)
+        {
+            switch (rule.kind)
+            {
+            case Rule::EQUAL:
+                load(program, base + rule.offset, rule.width, true);
+                rejects.push_back(Reject{program.size(), false});
+                program.push_back(jump(BPF_JEQ, rule.min));
+                break;
+            case Rule::LENGTH:
+                program.push_back(statement(BPF_LD | BPF_W | BPF_LEN, 0));
+                range(program, rejects, base + rule.min, base + rule.max);
+                break;
+            case Rule::RANGE:
+                load(program, base + rule.offset, rule.width, rule.big_endian);
+                range(program, rejects, rule.min, rule.max);
+                break;
+            }
+        }
+        program.push_back(statement(BPF_RET | BPF_K, 0xffffffff));
+        size_t reject = program.size();
+        program.push_back(statement(BPF_RET | BPF_K, 0));
+
+        for (const Reject& jump : rejects)
+        {
+            size_t distance = reject - jump.index - 1;
+            if (distance > 255)
+            {
+                throw std::length_error("socket filter too long");
+            }
+            if (jump.on_true)
+                program[jump.index].jt = distance;
+            else
+                program[jump.index].jf = distance;
+        }
+        return program;
+    }
+
+private:
+    struct Rule
+    {
+        enum Kind { EQUAL, LENGTH, RANGE } kind;
+        uint32_t offset;
+        uint32_t width;
+        bool big_endian;
+        uint32_t min;
+        uint32_t max;
+    };
+
+    // a conditional jump to the final reject
+    struct Reject
+    {
+        size_t index;
+        bool on_true;
+    };
+
+    static struct sock_filter statement(uint16_t code, uint32_t k)
+    {
+        struct sock_filter insn = {code, 0, 0, k};
+        return insn;
+    }
+
+    // jump offsets are filled in once the position of the reject is known
+    static struct sock_filter jump(uint16_t op, uint32_t k)
+    {
+        struct sock_filter insn = {static_cast<uint16_t>(BPF_JMP | op | BPF_K), 0, 0, k};
+        return insn;
+    }
+
+    // A = integer at `offset`, little endian ones are put together byte by byte
+    static void load(std::vector<struct sock_filter>& program, uint32_t offset, uint32_t width, bool big_endian)
+    {
+        if (width == 1 || big_endian)
+        {
+            uint16_t size = width == 4 ? BPF_W : width == 2 ? BPF_H : BPF_B;
+            program.push_back(statement(BPF_LD | size | BPF_ABS, offset));
+            return;
+        }
+        program.push_back(statement(BPF_LD | BPF_B | BPF_ABS, offset + width - 1));
+        for (uint32_t i = width - 1; i-- > 0;)
+        {
+            program.push_back(statement(BPF_ALU | BPF_LSH | BPF_K, 8));
+            program.push_back(statement(BPF_MISC | BPF_TAX, 0));
+            program.push_back(statement(BPF_LD | BPF_B | BPF_ABS, offset + i));
+            program.push_back(statement(BPF_ALU | BPF_OR | BPF_X, 0));
+        }
+    }
+
+    // reject unless min <= A <= max
+    static void range(std::vector<struct sock_filter>& program, std::vector<Reject>& rejects,
+                      uint32_t min, uint32_t max)
+    {
+        rejects.push_back(Reject{program.size(), false});
+        program.push_back(jump(BPF_JGE, min));
+        rejects.push_back(Reject{program.size(), true});
+        program.push_back(jump(BPF_JGT, max));
+    }
+
+    std::vector<Rule> rules;
+};
+
+// returns the setsockopt result
+static inline int attach_socket_filter(int sockfd, const std::vector<struct sock_filter>& program)
+{
+    struct sock_fprog fprog;
+    fprog.len = static_cast<unsigned short>(program.size());
+    fprog.filter = const_cast<struct sock_filter*>(program.data());
+    return setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog));
+}
+
+static inline int detach_socket_filter(int sockfd)
+{
+    int unused = 0;
+    return setsockopt(sockfd, SOL_SOCKET, SO_DETACH_FILTER, &unused, sizeof(unused));
+}
+
+}
+
+#endif
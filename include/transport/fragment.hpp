@@ -0,0 +1,317 @@
+#ifndef _INCLUDE_TRANSPORT_FRAGMENT_
+#define _INCLUDE_TRANSPORT_FRAGMENT_
+
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <atomic>
+#include <chrono>
+#include <iterator>
+#include <list>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define TRANSPORT_FRAGMENT_MAGIC 0x4654           // "TF"
+#define TRANSPORT_FRAGMENT_MTU 1500
+#define TRANSPORT_FRAGMENT_OVERHEAD 28            // IPv4 and UDP headers
+#define TRANSPORT_FRAGMENT_MEMORY 64 * 1024 * 1024
+#define TRANSPORT_FRAGMENT_TIMEOUT 5000           // ms
+
+namespace transport
+{
+
+/*
+ * In front of every datagram once fragmentation is enabled, little endian
+ * on the wire whatever the host order; use store() and load(), not memcpy.
+ * A frame is split into datagrams of at most the MTU; every fragment
+ * carries its byte offset and the size of the whole frame, so the receiver
+ * needs to know nothing about the sender's MTU.
+ */
+struct FragmentHeader
+{
+    uint16_t magic;         // TRANSPORT_FRAGMENT_MAGIC
+    uint16_t reserved;
+    uint32_t msg_id;        // per sender, increments with every frame
+    uint32_t offset;        // of this fragment in the frame
+    uint32_t total;         // size of the frame
+
+    // `out` receives sizeof(FragmentHeader) bytes
+    void store(void* out) const
+    {
+        uint8_t* p = static_cast<uint8_t*>(out);
+        put(p, magic, 2);
+        put(p + 2, reserved, 2);
+        put(p + 4, msg_id, 4);
+        put(p + 8, offset, 4);
+        put(p + 12, total, 4);
+    }
+
+    static FragmentHeader load(const void* in)
+    {
+        const uint8_t* p = static_cast<const uint8_t*>(in);
+        FragmentHeader header;
+        header.magic = static_cast<uint16_t>(get(p, 2));
+        header.reserved = static_cast<uint16_t>(get(p + 2, 2));
+        header.msg_id = get(p + 4, 4);
+        header.offset = get(p + 8, 4);
+        header.total = get(p + 12, 4);
+        return header;
+    }
+
+private:
+    static void put(uint8_t* p, uint32_t value, size_t width)
+    {
+        for (size_t i = 0; i < width; ++i)
+            p[i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+
+    static uint32_t get(const uint8_t* p, size_t width)
+    {
+        uint32_t value = 0;
+        for (size_t i = 0; i < width; ++i)
+            value |= static_cast<uint32_t>(p[i]) << (8 * i);
+        return value;
+    }
+};
+
+static_assert(sizeof(FragmentHeader) == 16, "FragmentHeader is 16 bytes on the wire");
+
+struct FragmentConfig
+{
+    size_t max_memory;                      // bytes held by incomplete frames
+    std::chrono::milliseconds timeout;      // drop a frame not completed in time
+
+    FragmentConfig()
+        : max_memory(TRANSPORT_FRAGMENT_MEMORY), timeout(TRANSPORT_FRAGMENT_TIMEOUT) {}
+};
+
+struct FragmentStats
+{
+    uint64_t fragments;     // fragments received
+    uint64_t reassembled;   // frames completed
+    uint64_t expired;       // incomplete frames dropped after the timeout
+    uint64_t evicted;       // incomplete frames dropped to stay in the memory budget
+    uint64_t invalid;       // bad headers, overlapping or oversized fragments
+    size_t pending;         // incomplete frames
+    size_t memory;          // bytes held by incomplete frames
+};
+
+/*
+ * Reassembly table keyed by the peer address and message id. Only the
+ * receive backend adds fragments; stats() may be called from any thread.
+ * The buffer of a frame is allocated with its first fragment and counts
+ * against max_memory until the frame completes or is dropped; the oldest
+ * frames are evicted to make room for new ones.
+ */
+class FragmentReassembler
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    explicit FragmentReassembler(const FragmentConfig& config = FragmentConfig())
+        : config(config), memory(0), pending(0), memory_used(0)
+    {
+        for (auto& counter : counters)
+            counter.store(0, std::memory_order_relaxed);
+    }
+    FragmentReassembler(const FragmentReassembler&) = delete;
+
+    /*
+     * Add one datagram. Returns true when it completed a frame, which is
+     * then at `frame`, `frame_size` bytes: inside `datagram` for a frame
+     * sent in one datagram, so it is not copied, or in a buffer valid until
+     * the next add(). Fragments of unknown, expired or evicted frames are
+     * dropped.
+     */
+    bool add(const struct sockaddr* addr, socklen_t addr_len, const void* datagram, size_t size,
+             const uint8_t*& frame, size_t& frame_size)
+    {
+        Clock::time_point now = Clock::now();
+        expire(now);
+        std::vector<uint8_t>().swap(completed);
+
+        if (size < sizeof(FragmentHeader))
+        {
+            count(INVALID);
+            return false;
+        }
+        FragmentHeader header = FragmentHeader::load(datagram);
+        const uint8_t* data = static_cast<const uint8_t*>(datagram) + sizeof(header);
+        size_t length = size - sizeof(header);
+        if (header.magic != TRANSPORT_FRAGMENT_MAGIC || header.offset > header.total ||
+            length > header.total - header.offset)
+        {
+            count(INVALID);
+            return false;
+        }
+        count(FRAGMENTS);
+
+        // a frame in a single datagram never touches the table
+        if (header.offset == 0 && length == header.total)
+        {
+            frame = data;
+            frame_size = length;
+            count(REASSEMBLED);
+            return true;
+        }
+        if (length == 0 || header.total > config.max_memory)
+        {
+            count(INVALID);
+            return false;
+        }
+
+        std::string key = make_key(addr, addr_len, header.msg_id);
+        auto it = table.find(key);
+        if (it == table.end())
+        {
+            while (memory + header.total > config.max_memory && !order.empty())
+            {
+                drop(order.front(), EVICTED);
+            }
+            order.push_back(key);
+            Entry& entry = table[key];
+            entry.buffer.resize(header.total);
+            entry.received = 0;
+            entry.created = now;
+            entry.position = std::prev(order.end());
+            memory += header.total;
+            publish();
+            it = table.find(key);
+        }
+        Entry& entry = it->second;
+        if (entry.buffer.size() != header.total || overlaps(entry, header.offset, length))
+        {
+            count(INVALID);
+            return false;
+        }
+        entry.ranges[header.offset] = length;
+        memcpy(entry.buffer.data() + header.offset, data, length);
+        entry.received += length;
+        if (entry.received < entry.buffer.size())
+        {
+            return false;
+        }
+        completed.swap(entry.buffer);
+        memory -= completed.size();
+        order.erase(entry.position);
+        table.erase(it);
+        count(REASSEMBLED);
+        frame = completed.data();
+        frame_size = completed.size();
+        return true;
+    }
+
+    // like add(), but copies the completed frame into `frame`
+    bool add(const struct sockaddr* addr, socklen_t addr_len, const void* datagram, size_t size,
+             std::vector<uint8_t>& frame)
+    {
+        const uint8_t* data;
+        size_t length;
+        if (!add(addr, addr_len, datagram, size, data, length))
+            return false;
+        frame.assign(data, data + length);
+        return true;
+    }
+
+    FragmentStats stats() const
+    {
+        FragmentStats stats;
+        stats.fragments = counters[FRAGMENTS].load(std::memory_order_relaxed);
+        stats.reassembled = counters[REASSEMBLED].load(std::memory_order_relaxed);
+        stats.expired = counters[EXPIRED].load(std::memory_order_relaxed);
+        stats.evicted = counters[EVICTED].load(std::memory_order_relaxed);
+        stats.invalid = counters[INVALID].load(std::memory_order_relaxed);
+        stats.pending = pending.load(std::memory_order_relaxed);
+        stats.memory = memory_used.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+private:
+    enum Counter
+    {
+        FRAGMENTS,
+        REASSEMBLED,
+        EXPIRED,
+        EVICTED,
+        INVALID,
+        COUNTER_COUNT
+    };
+
+    struct Entry
+    {
+        std::vector<uint8_t> buffer;
+        std::map<uint32_t, uint32_t> ranges;    // offset -> length of the fragments received
+        size_t received;
+        Clock::time_point created;
+        std::list<std::string>::iterator position;
+    };
+
+    static std::string make_key(const struct sockaddr* addr, socklen_t addr_len, uint32_t msg_id)
+    {
+        std::string key(reinterpret_cast<const char*>(&msg_id), sizeof(msg_id));
+        if (addr)
+            key.append(reinterpret_cast<const char*>(addr), addr_len);
+        return key;
+    }
+
+    // duplicates count as overlapping, they would complete a frame with holes
+    static bool overlaps(const Entry& entry, uint32_t offset, size_t length)
+    {
+        auto next = entry.ranges.lower_bound(offset);
+        if (next != entry.ranges.end() && next->first < offset + length)
+            return true;
+        if (next != entry.ranges.begin())
+        {
+            auto prev = std::prev(next);
+            if (prev->first + prev->second > offset)
+                return true;
+        }
+        return false;
+    }
+
+    // entries are ordered by creation, so expired ones are at the front
+    void expire(Clock::time_point now)
+    {
+        while (!order.empty() && now - table[order.front()].created > config.timeout)
+        {
+            drop(order.front(), EXPIRED);
+        }
+        publish();
+    }
+
+    void drop(std::string key, Counter reason)
+    {
+        auto it = table.find(key);
+        memory -= it->second.buffer.size();
+        order.erase(it->second.position);
+        table.erase(it);
+        count(reason);
+    }
+
+    inline void count(Counter counter)
+    {
+        counters[counter].fetch_add(1, std::memory_order_relaxed);
+        publish();
+    }
+
+    inline void publish()
+    {
+        pending.store(table.size(), std::memory_order_relaxed);
+        memory_used.store(memory, std::memory_order_relaxed);
+    }
+
+    FragmentConfig config;
+    std::unordered_map<std::string, Entry> table;
+    std::list<std::string> order;
+    std::vector<uint8_t> completed;         // the last reassembled frame
+    size_t memory;
+    std::atomic<uint64_t> counters[COUNTER_COUNT];
+    std::atomic<size_t> pending;
+    std::atomic<size_t> memory_used;
+};
+
+}
+
+#endif
@@ -0,0 +1,394 @@
+#ifndef _INCLUDE_TRANSPORT_MEMORY_
+#define _INCLUDE_TRANSPORT_MEMORY_
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "base.hpp"
+
+namespace transport
+{
+
+// impairments of one direction of a MemoryLink, all off by default
+struct MemoryLinkConfig
+{
+    std::chrono::nanoseconds latency;   // one-way delay
+    std::chrono::nanoseconds jitter;    // uniform extra delay in [0, jitter]
+    uint64_t bandwidth;                 // bytes per second, 0 for unlimited
+    double loss;                        // probability a frame is dropped
+    double duplicate;                   // probability a frame is delivered twice
+    double reorder;                     // probability a frame skips latency and jitter
+    uint64_t seed;                      // seed of the impairment RNG
+
+    MemoryLinkConfig()
+        : latency(0), jitter(0), bandwidth(0), loss(0), duplicate(0), reorder(0), seed(0) {}
+};
+
+struct MemoryLinkStats
+{
+    uint64_t transmitted;   // frames handed to the link
+    uint64_t dropped;
+    uint64_t duplicated;
+    uint64_t reordered;
+    uint64_t delivered;     // frames taken out by the receiver
+};
+
+/*
+ * One direction of a MemoryLink: frames in flight ordered by delivery time.
+ * Only the sending endpoint's send backend calls transmit(), so the RNG
+ * sequence, and with it the loss pattern, is reproducible for a given seed.
+ */
+template <typename P>
+class MemoryChannel
+{
+public:
+    typedef typename P::FrameType FrameType;
+    typedef std::chrono::steady_clock Clock;
+
+    MemoryChannel(const MemoryLinkConfig& config, uint64_t stream)
+        : config(config), rng(config.seed * 2 + stream), seq(0), receiver_epoch(0),
+          next_free(Clock::time_point::min()), delivering(false)
+    {
+        memset(&counters, 0, sizeof(counters));
+    }
+    MemoryChannel(const MemoryChannel&) = delete;
+
+    // queue a frame, returns when the link has serialized it
+    Clock::time_point transmit(FrameType frame)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        Clock::time_point now = Clock::now();
+        Clock::time_point start = std::max(now, next_free);
+        next_free = start;
+        if (config.bandwidth)
+        {
+            next_free += std::chrono::nanoseconds(P::frame_size(frame) * 1000000000ull / config.bandwidth);
+        }
+        counters.transmitted++;
+        if (chance(config.loss))
+        {
+            counters.dropped++;
+            return next_free;
+        }
+        if (chance(config.duplicate))
+        {
+            counters.duplicated++;
+            schedule(frame);
+        }
+        schedule(std::move(frame));
+        cond.notify_one();
+        return next_free;
+    }
+
+    // current receiver, see detach()
+    uint64_t epoch()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return receiver_epoch;
+    }
+
+    /*
+     * Wait for the next due frame and pass it to `handle`, outside the
+     * channel lock so a slow handler does not hold up transmit(). Returns
+     * false once the receiver of `epoch` was detached; detach() waits for a
+     * running `handle`, so it is never called after detach() returns.
+     */
+    template <typename F>
+    bool receive(uint64_t epoch, F handle)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            if (epoch != receiver_epoch)
+                return false;
+            if (!in_flight.empty())
+            {
+                Clock::time_point due = in_flight.front().due;
+                if (due <= Clock::now())
+                    break;
+                cond.wait_until(lock, due);
+            }
+            else
+            {
+                cond.wait(lock);
+            }
+        }
+        std::pop_heap(in_flight.begin(), in_flight.end(), Later());
+        FrameType frame = std::move(in_flight.back().frame);
+        in_flight.pop_back();
+        counters.delivered++;
+        delivering = true;
+        delivering_thread = std::this_thread::get_id();
+        lock.unlock();
+        handle(std::move(frame));
+        lock.lock();
+        delivering = false;
+        delivered.notify_all();
+        return epoch == receiver_epoch;
+    }
+
+    void set_config(const MemoryLinkConfig& new_config)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        config = new_config;
+    }
+
+    MemoryLinkConfig get_config()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return config;
+    }
+
+    MemoryLinkStats stats()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return counters;
+    }
+
+    // drop everything in flight and stop the current receiver
+    void detach()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        receiver_epoch++;
+        in_flight.clear();
+        cond.notify_all();
+        // a handler may close its own endpoint, it must not wait for itself
+        if (delivering_thread != std::this_thread::get_id())
+            delivered.wait(lock, [this] { return !delivering; });
+    }
+
+private:
+    struct InFlight
+    {
+        Clock::time_point due;
+        uint64_t seq;
+        FrameType frame;
+    };
+
+    // min-heap on (due, seq), equal due times keep the send order
+    struct Later
+    {
+        bool operator()(const InFlight& a, const InFlight& b) const
+        {
+            return a.due != b.due ? a.due > b.due : a.seq > b.seq;
+        }
+    };
+
+    inline bool chance(double p)
+    {
+        return p > 0 && std::uniform_real_distribution<double>(0, 1)(rng) < p;
+    }
+
+    void schedule(FrameType frame)
+    {
+        Clock::time_point due = next_free;
+        if (chance(config.reorder))
+        {
+            counters.reordered++;
+        }
+        else
+        {
+            due += config.latency;
+            if (config.jitter.count() > 0)
+            {
+                due += std::chrono::nanoseconds(std::uniform_int_distribution<int64_t>(0, config.jitter.count())(rng));
+            }
+        }
+        in_flight.push_back(InFlight{due, seq++, std::move(frame)});
+        std::push_heap(in_flight.begin(), in_flight.end(), Later());
+    }
+
+    MemoryLinkConfig config;
+    std::mt19937_64 rng;
+    uint64_t seq;
+    uint64_t receiver_epoch;
+    Clock::time_point next_free;
+    MemoryLinkStats counters;
+    std::vector<InFlight> in_flight;
+    std::mutex mutex;
+    std::condition_variable cond;
+    bool delivering;                        // handle() running outside the lock
+    std::thread::id delivering_thread;
+    std::condition_variable delivered;
+};
+
+// the two directions shared by a pair of MemoryTransport endpoints
+template <typename P>
+class MemoryLink
+{
+public:
+    explicit MemoryLink(const MemoryLinkConfig& config = MemoryLinkConfig())
+        : channels{{config, 0}, {config, 1}} {}
+    MemoryLink(const MemoryLink&) = delete;
+
+    // frames sent by endpoint `side` (0 or 1)
+    inline MemoryChannel<P>& channel(unsigned side)
+    {
+        return channels[side & 1];
+    }
+
+private:
+    MemoryChannel<P> channels[2];
+};
+
+/*
+ * In-process transport, the socketpair of this library. Frames are moved
+ * between the two endpoints without any syscall, optionally through an
+ * impaired link:
+ *
+ *     MemoryLinkConfig config;
+ *     config.latency = std::chrono::milliseconds(5);
+ *     config.loss = 0.01;
+ *     auto pair = MemoryTransport<Protocol>::make_pair(config);
+ *     pair.first->send(frame);
+ *     pair.second->receive(std::chrono::seconds(1));
+ */
+template <typename P>
+class MemoryTransport : public BaseTransport<P>
+{
+public:
+    MemoryTransport(std::shared_ptr<MemoryLink<P>> link, unsigned side)
+        : link(std::move(link)), side(side & 1), receive_epoch(0),
+          send_generation(std::make_shared<std::atomic<uint64_t>>(0)) {}
+
+    ~MemoryTransport() override
+    {
+        close();
+    }
+
+    static std::pair<std::unique_ptr<MemoryTransport>, std::unique_ptr<MemoryTransport>>
+    make_pair(const MemoryLinkConfig& config = MemoryLinkConfig())
+    {
+        auto link = std::make_shared<MemoryLink<P>>(config);
+        return std::make_pair(std::unique_ptr<MemoryTransport>(new MemoryTransport(link, 0)),
+                              std::unique_ptr<MemoryTransport>(new MemoryTransport(link, 1)));
+    }
+
+    void open() override
+    {
+        // close() leaves is_open set, reopening is up to is_closed
+        if (this->is_open && !this->is_closed)
+        {
+            return;
+        }
+        else if (this->is_closed)
+        {
+            this->is_open = false;
+            this->is_closed = false;
+        }
+        receive_epoch = incoming().epoch();
+        super::open();
+    }
+
+    void close() override
+    {
+        incoming().detach();
+        send_generation->fetch_add(1, std::memory_order_acq_rel);
+        super::close();
+    }
+
+    // impairments of the frames this endpoint sends
+    void set_link_config(const MemoryLinkConfig& config)
+    {
+        outgoing().set_config(config);
+    }
+
+    MemoryLinkConfig link_config()
+    {
+        return outgoing().get_config();
+    }
+
+    MemoryLinkStats link_stats()
+    {
+        return outgoing().stats();
+    }
+
+    inline std::shared_ptr<MemoryLink<P>> get_link() const
+    {
+        return link;
+    }
+
+protected:
+    void send_backend() override
+    {
+        auto &logger = *logging::get_logger("transport");
+        logging::RateLimiter error_limit;
+        // a backend still sleeping on the link across close() and open()
+        // must not run next to the new one, nor touch a destroyed endpoint
+        std::shared_ptr<std::atomic<uint64_t>> shared_generation = send_generation;
+        uint64_t generation = shared_generation->load(std::memory_order_acquire);
+        while (!this->is_closed && shared_generation->load(std::memory_order_acquire) == generation)
+        {
+            auto frame_pair = this->pop_send();
+            if (frame_pair.second && frame_pair.second->template transport<P>() != this)
+            {
+                this->count_send_error();
+                this->complete_send(frame_pair, -EINVAL);
+                error_limit.log(logger, logging::LogLevel::ERROR, "invalid token received");
+                continue;
+            }
+            size_t size = P::frame_size(frame_pair.first);
+            this->capture(CaptureDirection::SENT, frame_pair.first, nullptr, 0);
+            uint64_t send_start = this->trace_clock();
+            // transmit cannot fail; count first, the peer may see the frame at once
+            this->count_send(size, size);
+            this->complete_send(frame_pair, size);
+            auto done = outgoing().transmit(std::move(frame_pair.first));
+            // hold the backend while the link is busy, like a blocking socket,
+            // in slices so close() does not wait for a slow link
+            auto now = MemoryChannel<P>::Clock::now();
+            while (now < done)
+            {
+                std::this_thread::sleep_until(std::min(done, now + std::chrono::milliseconds(50)));
+                if (shared_generation->load(std::memory_order_acquire) != generation)
+                    return;
+                now = MemoryChannel<P>::Clock::now();
+            }
+            this->trace_send(frame_pair.meta, send_start);
+        }
+    }
+
+    void receive_backend() override
+    {
+        // keep the link alive, the endpoint may be destroyed once detached
+        std::shared_ptr<MemoryLink<P>> shared_link = link;
+        MemoryChannel<P>& channel = shared_link->channel(side ^ 1);
+        uint64_t epoch = receive_epoch;
+        while (channel.receive(epoch, [this](FrameType frame) {
+            this->count_receive(P::frame_size(frame));
+            this->deliver(std::move(frame), std::make_shared<TransportToken>(this));
+        })) {}
+    }
+
+private:
+    typedef BaseTransport<P> super;
+    typedef typename P::FrameType FrameType;
+
+    inline MemoryChannel<P>& outgoing()
+    {
+        return link->channel(side);
+    }
+
+    inline MemoryChannel<P>& incoming()
+    {
+        return link->channel(side ^ 1);
+    }
+
+    std::shared_ptr<MemoryLink<P>> link;
+    unsigned side;
+    uint64_t receive_epoch;
+    std::shared_ptr<std::atomic<uint64_t>> send_generation;    // bumped by close()
+};
+
+}
+
+#endif
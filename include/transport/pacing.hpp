@@ -0,0 +1,116 @@
+#ifndef _INCLUDE_TRANSPORT_PACING_
+#define _INCLUDE_TRANSPORT_PACING_
+
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+
+namespace transport
+{
+
+// 0 rates are unlimited; a burst of 0 spaces every frame out evenly
+struct PacingConfig
+{
+    double bytes_per_second;
+    double frames_per_second;
+    double burst_bytes;         // sent back to back after an idle period
+    double burst_frames;
+
+    PacingConfig() : bytes_per_second(0), frames_per_second(0), burst_bytes(0), burst_frames(0) {}
+    PacingConfig(double bytes_per_second, double frames_per_second = 0,
+                 double burst_bytes = 0, double burst_frames = 0)
+        : bytes_per_second(bytes_per_second), frames_per_second(frames_per_second),
+          burst_bytes(burst_bytes), burst_frames(burst_frames) {}
+};
+
+/*
+ * A token bucket that may go into debt: a frame always takes its tokens, and
+ * the caller waits until the debt is paid off. Frames larger than the burst
+ * still go out, at the configured rate.
+ */
+class TokenBucket
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    TokenBucket() : rate(0), burst(0), tokens(0) {}
+
+    void configure(double new_rate, double new_burst, Clock::time_point now)
+    {
+        rate = new_rate > 0 ? new_rate : 0;
+        burst = new_burst > 0 ? new_burst : 0;
+        tokens = burst;
+        last = now;
+    }
+
+    bool enabled() const
+    {
+        return rate > 0;
+    }
+
+    // the time from which `amount` may be sent
+    Clock::time_point take(double amount, Clock::time_point now)
+    {
+        if (!enabled())
+            return now;
+        if (now > last)
+        {
+            tokens = std::min(burst, tokens + rate * std::chrono::duration<double>(now - last).count());
+            last = now;
+        }
+        tokens -= amount;
+        if (tokens >= 0)
+            return now;
+        return now + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(-tokens / rate));
+    }
+
+private:
+    double rate;        // tokens per second
+    double burst;
+    double tokens;
+    Clock::time_point last;
+};
+
+// byte and frame buckets of a transport or a peer, reconfigurable at any time
+class Pacer
+{
+public:
+    typedef TokenBucket::Clock Clock;
+
+    Pacer() : active(false) {}
+    Pacer(const Pacer&) = delete;
+
+    void configure(const PacingConfig& config)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        Clock::time_point now = Clock::now();
+        bytes.configure(config.bytes_per_second, config.burst_bytes, now);
+        frames.configure(config.frames_per_second, config.burst_frames, now);
+        active.store(bytes.enabled() || frames.enabled(), std::memory_order_release);
+    }
+
+    // lock-free, checked for every frame
+    bool enabled() const
+    {
+        return active.load(std::memory_order_acquire);
+    }
+
+    // the time from which a frame of `size` bytes may be sent
+    Clock::time_point take(size_t size, Clock::time_point now)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return std::max(bytes.take(static_cast<double>(size), now), frames.take(1, now));
+    }
+
+private:
+    TokenBucket bytes;
+    TokenBucket frames;
+    std::atomic<bool> active;
+    std::mutex mutex;
+};
+
+}
+
+#endif
@@ -0,0 +1,239 @@
+#ifndef _INCLUDE_TRANSPORT_PEER_
+#define _INCLUDE_TRANSPORT_PEER_
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <atomic>
+#include <chrono>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "pacing.hpp"
+
+#define TRANSPORT_PEER_CAPACITY 1024
+
+namespace transport
+{
+
+struct PeerStats
+{
+    uint64_t frames_sent;
+    uint64_t bytes_sent;
+    uint64_t send_errors;
+    uint64_t frames_dropped;        // over the peer's send queue limit
+    uint64_t frames_received;
+    uint64_t bytes_received;
+    uint64_t last_received;     // steady clock nanoseconds, 0 if never
+};
+
+// per-peer counters and application data, shared by all users of a token
+class PeerState
+{
+public:
+    PeerState() : weight(1), limit(0)
+    {
+        for (auto& counter : counters)
+            counter.store(0, std::memory_order_relaxed);
+    }
+    PeerState(const PeerState&) = delete;
+
+    inline void count_send(size_t size, ssize_t sent_size)
+    {
+        if (sent_size < 0)
+        {
+            counters[SEND_ERRORS].fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        counters[FRAMES_SENT].fetch_add(1, std::memory_order_relaxed);
+        counters[BYTES_SENT].fetch_add(size, std::memory_order_relaxed);
+    }
+
+    inline void count_drop()
+    {
+        counters[FRAMES_DROPPED].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    inline void count_receive(size_t size)
+    {
+        counters[FRAMES_RECEIVED].fetch_add(1, std::memory_order_relaxed);
+        counters[BYTES_RECEIVED].fetch_add(size, std::memory_order_relaxed);
+        uint64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+        counters[LAST_RECEIVED].store(now, std::memory_order_relaxed);
+    }
+
+    PeerStats stats() const
+    {
+        PeerStats stats;
+        stats.frames_sent = counters[FRAMES_SENT].load(std::memory_order_relaxed);
+        stats.bytes_sent = counters[BYTES_SENT].load(std::memory_order_relaxed);
+        stats.send_errors = counters[SEND_ERRORS].load(std::memory_order_relaxed);
+        stats.frames_dropped = counters[FRAMES_DROPPED].load(std::memory_order_relaxed);
+        stats.frames_received = counters[FRAMES_RECEIVED].load(std::memory_order_relaxed);
+        stats.bytes_received = counters[BYTES_RECEIVED].load(std::memory_order_relaxed);
+        stats.last_received = counters[LAST_RECEIVED].load(std::memory_order_relaxed);
+        return stats;
+    }
+
+    // share of the send bandwidth under fair queuing, relative to weight 1 peers
+    void set_send_weight(uint32_t value)
+    {
+        weight.store(value ? value : 1, std::memory_order_relaxed);
+    }
+
+    uint32_t send_weight() const
+    {
+        return weight.load(std::memory_order_relaxed);
+    }
+
+    // bytes this peer may have queued under fair queuing, 0 for the transport default
+    void set_send_limit(size_t bytes)
+    {
+        limit.store(bytes, std::memory_order_relaxed);
+    }
+
+    size_t send_limit() const
+    {
+        return limit.load(std::memory_order_relaxed);
+    }
+
+    // send pacing of this peer, on top of the transport's own
+    void set_pacing(const PacingConfig& config)
+    {
+        send_pacer.configure(config);
+    }
+
+    Pacer& pacer()
+    {
+        return send_pacer;
+    }
+
+    // any application object, e.g. a session, kept as long as the token lives
+    template <typename T>
+    std::shared_ptr<T> user_data() const
+    {
+        return std::static_pointer_cast<T>(std::atomic_load(&data));
+    }
+
+    void set_user_data(std::shared_ptr<void> value)
+    {
+        std::atomic_store(&data, std::move(value));
+    }
+
+private:
+    enum Counter
+    {
+        FRAMES_SENT,
+        BYTES_SENT,
+        SEND_ERRORS,
+        FRAMES_DROPPED,
+        FRAMES_RECEIVED,
+        BYTES_RECEIVED,
+        LAST_RECEIVED,
+        COUNTER_COUNT
+    };
+
+    std::atomic<uint64_t> counters[COUNTER_COUNT];
+    std::atomic<uint32_t> weight;
+    std::atomic<size_t> limit;
+    Pacer send_pacer;
+    std::shared_ptr<void> data;
+};
+
+/*
+ * Interns the tokens of a transport: every datagram from the same address
+ * gets the same token, so receiving allocates nothing for known peers and
+ * tokens compare by pointer. Lookups use a token built on the stack, hashed
+ * with std::hash<Token> and compared with Token::operator==. The least
+ * recently seen peer is dropped once `capacity` is exceeded; tokens still
+ * held by the application stay valid, the next datagram from that peer just
+ * gets a new one.
+ */
+template <typename Token>
+class PeerTable
+{
+public:
+    explicit PeerTable(size_t capacity = TRANSPORT_PEER_CAPACITY) : capacity(capacity ? capacity : 1) {}
+    PeerTable(const PeerTable&) = delete;
+
+    // the interned token equal to `probe`, created as a copy on the first lookup
+    std::shared_ptr<Token> intern(const Token& probe)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = index.find(&probe);
+        if (it != index.end())
+        {
+            lru.splice(lru.begin(), lru, it->second);
+            return *it->second;
+        }
+        lru.push_front(std::make_shared<Token>(probe));
+        index.emplace(lru.front().get(), lru.begin());
+        while (index.size() > capacity)
+        {
+            index.erase(lru.back().get());
+            lru.pop_back();
+        }
+        return lru.front();
+    }
+
+    void set_capacity(size_t value)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        capacity = value ? value : 1;
+        while (index.size() > capacity)
+        {
+            index.erase(lru.back().get());
+            lru.pop_back();
+        }
+    }
+
+    size_t size()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return index.size();
+    }
+
+    // most recently seen first
+    std::vector<std::shared_ptr<Token>> peers()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return std::vector<std::shared_ptr<Token>>(lru.begin(), lru.end());
+    }
+
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        index.clear();
+        lru.clear();
+    }
+
+private:
+    typedef std::list<std::shared_ptr<Token>> List;
+
+    struct Hash
+    {
+        size_t operator()(const Token* token) const
+        {
+            return std::hash<Token>()(*token);
+        }
+    };
+
+    struct Equal
+    {
+        bool operator()(const Token* a, const Token* b) const
+        {
+            return *a == *b;
+        }
+    };
+
+    size_t capacity;
+    List lru;
+    std::unordered_map<const Token*, typename List::iterator, Hash, Equal> index;
+    std::mutex mutex;
+};
+
+}
+
+#endif
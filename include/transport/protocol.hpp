@@ -21,12 +21,13 @@ public:
         return FrameType((uint8_t*)buf, (uint8_t*)buf + size);
     }
 
-    static size_t frame_size(FrameType frame) {
+    static size_t frame_size(const FrameType& frame) {
         return frame.size();
     }
 
-    static void* frame_data(FrameType frame) {
-        return frame.data();
+    // by reference, the returned pointer has to stay valid with the frame
+    static void* frame_data(const FrameType& frame) {
+        return const_cast<uint8_t*>(frame.data());
     }
 };
 
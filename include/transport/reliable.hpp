@@ -0,0 +1,592 @@
+#ifndef _INCLUDE_TRANSPORT_RELIABLE_
+#define _INCLUDE_TRANSPORT_RELIABLE_
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+#include "base.hpp"
+
+namespace transport
+{
+
+enum class ReliableFrameType: uint8_t
+{
+    DATA = 1,
+    ACK = 2
+};
+
+// wire header in front of every frame on the lower transport, little endian
+struct ReliableHeader
+{
+    uint8_t type;           // ReliableFrameType
+    uint8_t reserved[3];
+    uint32_t session;       // DATA: the sender's session, ACK: the session acknowledged
+    uint32_t seq;           // DATA: sequence number, ACK: seq of the DATA frame acknowledged
+    uint32_t ack;           // ACK: next sequence number expected in order
+    uint32_t sack;          // ACK: bit i set if ack + 1 + i was received
+
+    // `out` receives sizeof(ReliableHeader) bytes
+    void store(void* out) const
+    {
+        uint8_t* p = static_cast<uint8_t*>(out);
+        p[0] = type;
+        memcpy(p + 1, reserved, sizeof(reserved));
+        put(p + 4, session);
+        put(p + 8, seq);
+        put(p + 12, ack);
+        put(p + 16, sack);
+    }
+
+    static ReliableHeader load(const void* in)
+    {
+        const uint8_t* p = static_cast<const uint8_t*>(in);
+        ReliableHeader header;
+        header.type = p[0];
+        memcpy(header.reserved, p + 1, sizeof(header.reserved));
+        header.session = get(p + 4);
+        header.seq = get(p + 8);
+        header.ack = get(p + 12);
+        header.sack = get(p + 16);
+        return header;
+    }
+
+private:
+    static void put(uint8_t* p, uint32_t value)
+    {
+        for (size_t i = 0; i < 4; ++i)
+            p[i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+
+    static uint32_t get(const uint8_t* p)
+    {
+        uint32_t value = 0;
+        for (size_t i = 0; i < 4; ++i)
+            value |= static_cast<uint32_t>(p[i]) << (8 * i);
+        return value;
+    }
+};
+
+static_assert(sizeof(ReliableHeader) == 20, "ReliableHeader is 20 bytes on the wire");
+
+struct ReliableConfig
+{
+    uint32_t window;                        // frames in flight
+    uint32_t recv_window;                   // out of order frames buffered
+    std::chrono::milliseconds initial_rto;
+    std::chrono::milliseconds min_rto;
+    std::chrono::milliseconds max_rto;
+    uint32_t dup_threshold;                 // SACKed frames above a hole that mark it lost
+
+    ReliableConfig()
+        : window(64), recv_window(1024), initial_rto(200), min_rto(10), max_rto(2000), dup_threshold(3) {}
+};
+
+struct ReliableStats
+{
+    uint64_t retransmits;           // all retransmitted frames
+    uint64_t fast_retransmits;      // retransmitted because of SACK before the timer
+    uint64_t timeouts;              // retransmission timer expirations
+    uint64_t duplicates;            // received frames dropped as already seen
+    uint64_t out_of_order;          // received frames buffered for reordering
+    uint64_t peer_restarts;         // peer came back with a new session
+    uint64_t stale_frames;          // frames and ACKs of another session, or ACKs beyond next_seq
+    uint64_t srtt_us;               // smoothed round trip time
+    uint64_t rto_us;                // current retransmission timeout
+    size_t in_flight;               // frames sent but not acknowledged
+};
+
+/*
+ * Reliable, ordered delivery to a single peer over a datagram transport:
+ *
+ *     DatagramTransport<Protocol> udp;
+ *     udp.open();
+ *     udp.connect("10.0.0.2", 9000);
+ *     ReliableTransport<Protocol, DatagramTransport<Protocol>> channel(udp);
+ *     channel.send(frame);
+ *
+ * Frames get a sequence number and stay in a sliding window until the peer
+ * acknowledges them. ACKs are cumulative plus a 32 frame SACK bitmap. The
+ * retransmission timer follows RFC 6298 (SRTT/RTTVAR, Karn's rule,
+ * exponential backoff), and a frame with dup_threshold SACKed frames above
+ * it is retransmitted at once. The receiver buffers out of order frames and
+ * delivers them in sequence.
+ *
+ * Every transport picks a random session id, both sides number their frames
+ * from 0. A peer that restarts shows up with a new session at its frame 0,
+ * and the receive side starts over instead of dropping the new frames as
+ * duplicates; other frames of an unknown session are dropped unacknowledged.
+ * ACKs of another session, or for frames never sent, are ignored, so a frame
+ * only completes once this session's frame was delivered.
+ *
+ * L is the lower transport, it must outlive this object and carry byte
+ * vectors. Its receive queue is consumed by this transport. The peer is the
+ * lower transport's connected address, or the sender of the first frame.
+ * Frames are retransmitted until acknowledged.
+ */
+template <typename P, typename L>
+class ReliableTransport : public BaseTransport<P>
+{
+public:
+    explicit ReliableTransport(L& lower, const ReliableConfig& config = ReliableConfig())
+        : lower(lower), config(config), session(new_session()), next_seq(0), snd_una(0), srtt(0), rttvar(0), base_rto(config.initial_rto), rto(config.initial_rto),
+          timer_running(false), peer_session(0), rcv_next(0), running_backends(0)
+    {
+        memset(&reliable_counters, 0, sizeof(reliable_counters));
+    }
+
+    ~ReliableTransport() override
+    {
+        close();
+        // the backends poll the lower transport, wait until they let go of it
+        while (running_backends.load(std::memory_order_acquire) > 0)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    void open() override
+    {
+        if (this->is_open)
+        {
+            return;
+        }
+        else if (this->is_closed)
+        {
+            this->is_open = false;
+            this->is_closed = false;
+        }
+        running_backends.fetch_add(2, std::memory_order_acq_rel);
+        super::open();
+    }
+
+    void close() override
+    {
+        super::close();
+        window_cond.notify_all();
+    }
+
+    ReliableStats reliable_stats()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ReliableStats stats = reliable_counters;
+        stats.srtt_us = std::chrono::duration_cast<std::chrono::microseconds>(srtt).count();
+        stats.rto_us = std::chrono::duration_cast<std::chrono::microseconds>(rto).count();
+        stats.in_flight = window.size();
+        return stats;
+    }
+
+protected:
+    typedef std::chrono::steady_clock Clock;
+    typedef typename L::Protocol::FrameType WireFrame;
+
+    void send_backend() override
+    {
+        BackendGuard guard(running_backends);
+        while (!this->is_closed)
+        {
+            auto entry = this->pop_send();
+            size_t size = P::frame_size(entry.first);
+            const uint8_t* data = static_cast<const uint8_t*>(P::frame_data(entry.first));
+
+            std::unique_lock<std::mutex> lock(mutex);
+            while (window.size() >= config.window && !this->is_closed)
+            {
+                window_cond.wait_for(lock, std::chrono::milliseconds(100));
+            }
+            if (this->is_closed)
+            {
+                break;
+            }
+            ReliableHeader header;
+            memset(&header, 0, sizeof(header));
+            header.type = static_cast<uint8_t>(ReliableFrameType::DATA);
+            header.session = session;
+            header.seq = next_seq++;
+
+            Segment segment;
+            segment.frame.resize(sizeof(header) + size);
+            header.store(segment.frame.data());
+            memcpy(segment.frame.data() + sizeof(header), data, size);
+            segment.sent = Clock::now();
+            segment.retransmitted = false;
+            segment.sacked = false;
+            segment.fast_retransmitted = false;
+            window.push_back(segment);
+            window.back().completion = std::move(entry.meta.completion);
+            if (!timer_running)
+            {
+                restart_timer(segment.sent);
+            }
+            WireFrame frame = segment.frame;
+            std::shared_ptr<TransportToken> token = peer;
+            lock.unlock();
+
+            uint64_t send_start = this->trace_clock();
+            lower.send(std::move(frame), token, entry.meta.priority);
+            this->trace_send(entry.meta, send_start);
+            this->count_send(size, size);
+        }
+    }
+
+    void receive_backend() override
+    {
+        BackendGuard guard(running_backends);
+        while (!this->is_closed)
+        {
+            try
+            {
+                auto frame_pair = lower.receive(poll_interval());
+                handle_frame(frame_pair.first, frame_pair.second);
+            }
+            catch (const QueueTimeout&) {}
+            check_timer();
+        }
+    }
+
+private:
+    typedef BaseTransport<P> super;
+
+    struct BackendGuard
+    {
+        explicit BackendGuard(std::atomic<int>& count) : count(count) {}
+        ~BackendGuard()
+        {
+            count.fetch_sub(1, std::memory_order_acq_rel);
+        }
+        std::atomic<int>& count;
+    };
+
+    struct Segment
+    {
+        WireFrame frame;
+        Clock::time_point sent;
+        bool retransmitted;
+        bool sacked;
+        bool fast_retransmitted;
+        CompletionRef completion;   // resolved when the peer acknowledges the segment
+    };
+
+    // random and never 0, which stands for no peer session yet
+    static uint32_t new_session()
+    {
+        std::random_device device;
+        uint32_t value = 0;
+        while (!value)
+            value = device();
+        return value;
+    }
+
+    // wrap-around safe sequence comparison
+    static inline bool seq_before(uint32_t a, uint32_t b)
+    {
+        return static_cast<int32_t>(a - b) < 0;
+    }
+
+    std::chrono::milliseconds poll_interval()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!timer_running)
+        {
+            return std::chrono::milliseconds(10);
+        }
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(timer_deadline - Clock::now());
+        return std::max(std::chrono::milliseconds(1), std::min(left, std::chrono::milliseconds(10)));
+    }
+
+    void handle_frame(const WireFrame& frame, const std::shared_ptr<TransportToken>& token)
+    {
+        auto &logger = *logging::get_logger("transport");
+        size_t size = frame.size();
+        const uint8_t* data = frame.data();
+        ReliableHeader header;
+        if (size < sizeof(header))
+        {
+            this->count_invalid_frame();
+            error_limit.log(logger, logging::LogLevel::ERROR, "reliable frame too short (%zu bytes)", size);
+            return;
+        }
+        header = ReliableHeader::load(data);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!peer && token)
+            {
+                peer = token;
+            }
+        }
+        switch (static_cast<ReliableFrameType>(header.type))
+        {
+        case ReliableFrameType::DATA:
+            receive_data(header.session, header.seq, data + sizeof(header), size - sizeof(header));
+            break;
+        case ReliableFrameType::ACK:
+            receive_ack(header.session, header.seq, header.ack, header.sack);
+            break;
+        default:
+            this->count_invalid_frame();
+            error_limit.log(logger, logging::LogLevel::ERROR, "unknown reliable frame type %u", header.type);
+        }
+    }
+
+    // receive side, only touched by the receive backend
+    void receive_data(uint32_t sender, uint32_t seq, const uint8_t* data, size_t size)
+    {
+        if (sender != peer_session)
+        {
+            if (peer_session && seq != 0)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                reliable_counters.stale_frames++;
+                return;
+            }
+            if (peer_session)
+            {
+                // the peer restarted, its numbering starts over
+                rcv_next = 0;
+                reorder_buffer.clear();
+                std::lock_guard<std::mutex> lock(mutex);
+                reliable_counters.peer_restarts++;
+            }
+            peer_session = sender;
+        }
+        if (seq_before(seq, rcv_next) || reorder_buffer.count(seq))
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            reliable_counters.duplicates++;
+        }
+        else if (seq == rcv_next)
+        {
+            deliver_payload(data, size);
+            rcv_next++;
+            auto it = reorder_buffer.find(rcv_next);
+            for (; it != reorder_buffer.end(); it = reorder_buffer.find(rcv_next))
+            {
+                deliver_payload(it->second.data(), it->second.size());
+                reorder_buffer.erase(it);
+                rcv_next++;
+            }
+        }
+        else if (seq_before(seq, rcv_next + config.recv_window))
+        {
+            reorder_buffer[seq].assign(data, data + size);
+            std::lock_guard<std::mutex> lock(mutex);
+            reliable_counters.out_of_order++;
+        }
+        send_ack(seq);
+    }
+
+    void deliver_payload(const uint8_t* data, size_t size)
+    {
+        this->count_receive(size);
+        this->deliver(P::make_frame(const_cast<uint8_t*>(data), size), std::make_shared<TransportToken>(this));
+    }
+
+    void send_ack(uint32_t echo)
+    {
+        ReliableHeader header;
+        memset(&header, 0, sizeof(header));
+        header.type = static_cast<uint8_t>(ReliableFrameType::ACK);
+        header.session = peer_session;
+        header.seq = echo;
+        header.ack = rcv_next;
+        for (uint32_t i = 0; i < 32; ++i)
+        {
+            if (reorder_buffer.count(rcv_next + 1 + i))
+            {
+                header.sack |= 1u << i;
+            }
+        }
+        std::shared_ptr<TransportToken> token;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            token = peer;
+        }
+        WireFrame frame(sizeof(header));
+        header.store(frame.data());
+        lower.send(std::move(frame), token, Priority::CONTROL);
+    }
+
+    // send side, shared with the send backend under `mutex`
+    void receive_ack(uint32_t acked_session, uint32_t echo, uint32_t ack, uint32_t sack)
+    {
+        std::vector<WireFrame> resend;
+        std::vector<std::pair<CompletionRef, size_t>> acked;
+        std::shared_ptr<TransportToken> token;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            // `ack` is the next frame expected, next_seq once all are delivered
+            if (acked_session != session || seq_before(next_seq, ack))
+            {
+                reliable_counters.stale_frames++;
+                return;
+            }
+            Clock::time_point now = Clock::now();
+            // RTT sample from the frame that triggered this ACK, if this is
+            // its first acknowledgement; Karn's rule: never from a retransmission
+            uint32_t echo_offset = echo - snd_una;
+            if (echo_offset < window.size())
+            {
+                const Segment& segment = window[echo_offset];
+                if (!segment.retransmitted && !segment.sacked)
+                {
+                    update_rtt(now - segment.sent);
+                }
+            }
+
+            bool advanced = false;
+            while (!window.empty() && seq_before(snd_una, ack))
+            {
+                Segment& segment = window.front();
+                if (segment.completion)
+                {
+                    acked.emplace_back(std::move(segment.completion), segment.frame.size() - sizeof(ReliableHeader));
+                }
+                window.pop_front();
+                snd_una++;
+                advanced = true;
+            }
+            for (uint32_t i = 0; i < 32; ++i)
+            {
+                uint32_t offset = ack + 1 + i - snd_una;
+                if ((sack & (1u << i)) && offset < window.size())
+                {
+                    window[offset].sacked = true;
+                }
+            }
+
+            // a hole with dup_threshold SACKed frames above it is lost
+            uint32_t sacked_above = 0;
+            for (size_t i = window.size(); i-- > 0;)
+            {
+                Segment& segment = window[i];
+                if (segment.sacked)
+                {
+                    sacked_above++;
+                }
+                else if (sacked_above >= config.dup_threshold && !segment.fast_retransmitted)
+                {
+                    segment.fast_retransmitted = true;
+                    segment.retransmitted = true;
+                    segment.sent = now;
+                    resend.push_back(segment.frame);
+                    reliable_counters.fast_retransmits++;
+                    reliable_counters.retransmits++;
+                }
+            }
+
+            if (window.empty())
+            {
+                timer_running = false;
+            }
+            else if (advanced)
+            {
+                // the peer is making progress, drop the backoff
+                rto = base_rto;
+                restart_timer(now);
+            }
+            token = peer;
+        }
+        window_cond.notify_all();
+        // outside the lock, the callbacks may call back into the transport
+        for (auto& completion : acked)
+        {
+            completion.first.complete(completion.second);
+        }
+        for (auto& frame : resend)
+        {
+            lower.send(std::move(frame), token);
+        }
+    }
+
+    // RFC 6298 section 2
+    void update_rtt(Clock::duration sample)
+    {
+        if (srtt.count() == 0)
+        {
+            srtt = sample;
+            rttvar = sample / 2;
+        }
+        else
+        {
+            Clock::duration delta = srtt > sample ? srtt - sample : sample - srtt;
+            rttvar = (rttvar * 3 + delta) / 4;
+            srtt = (srtt * 7 + sample) / 8;
+        }
+        auto value = std::chrono::duration_cast<std::chrono::milliseconds>(srtt + rttvar * 4);
+        base_rto = std::min(std::max(value, config.min_rto), config.max_rto);
+        rto = base_rto;
+    }
+
+    void restart_timer(Clock::time_point now)
+    {
+        timer_running = true;
+        timer_deadline = now + rto;
+    }
+
+    // RFC 6298 section 5: resend the oldest lost frame and back off
+    void check_timer()
+    {
+        WireFrame frame;
+        std::shared_ptr<TransportToken> token;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            Clock::time_point now = Clock::now();
+            if (!timer_running || now < timer_deadline)
+            {
+                return;
+            }
+            auto it = std::find_if(window.begin(), window.end(), [](const Segment& s) { return !s.sacked; });
+            if (it == window.end())
+            {
+                it = window.begin();
+            }
+            it->retransmitted = true;
+            it->fast_retransmitted = false;
+            it->sent = now;
+            frame = it->frame;
+            token = peer;
+            reliable_counters.timeouts++;
+            reliable_counters.retransmits++;
+            rto = std::min(rto * 2, config.max_rto);
+            restart_timer(now);
+        }
+        lower.send(std::move(frame), token);
+    }
+
+    L& lower;
+    ReliableConfig config;
+
+    std::mutex mutex;
+    std::condition_variable window_cond;
+    std::deque<Segment> window;
+    const uint32_t session;
+    uint32_t next_seq;
+    uint32_t snd_una;
+    Clock::duration srtt;
+    Clock::duration rttvar;
+    std::chrono::milliseconds base_rto;     // from the estimator
+    std::chrono::milliseconds rto;          // base_rto with backoff
+    bool timer_running;
+    Clock::time_point timer_deadline;
+    std::shared_ptr<TransportToken> peer;
+    ReliableStats reliable_counters;
+
+    uint32_t peer_session;
+    uint32_t rcv_next;
+    std::map<uint32_t, WireFrame> reorder_buffer;
+    logging::RateLimiter error_limit;
+    std::atomic<int> running_backends;
+};
+
+}
+
+#endif
@@ -0,0 +1,234 @@
+#ifndef _INCLUDE_TRANSPORT_REPLAY_
+#define _INCLUDE_TRANSPORT_REPLAY_
+
+#include <string.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include "base.hpp"
+#include "capture.hpp"
+
+// replay pauses while this many frames wait in the receive queue
+#define TRANSPORT_REPLAY_MAX_PENDING 4096
+
+namespace transport
+{
+
+enum class ReplayMode: uint8_t
+{
+    FAST = 0,       // as fast as the application receives
+    ORIGINAL        // keep the captured inter-frame timing (scaled by speed)
+};
+
+// peer of a replayed frame, as recorded in the capture
+class ReplayTransportToken : public TransportToken
+{
+public:
+    ReplayTransportToken(_transport_base* transport, const struct sockaddr* addr, socklen_t addr_len)
+        : TransportToken(transport), addr_len(addr_len < sizeof(this->addr) ? addr_len : sizeof(this->addr))
+    {
+        memset(&this->addr, 0, sizeof(this->addr));
+        if (addr)
+            memcpy(&this->addr, addr, this->addr_len);
+    }
+
+    bool operator==(const TransportToken& other) const override
+    {
+        auto other_token = token_cast<ReplayTransportToken>(&other);
+        if (!other_token)
+        {
+            return false;
+        }
+        if (transport_ != other_token->transport_ || addr_len != other_token->addr_len)
+        {
+            return false;
+        }
+        return memcmp(&addr, &other_token->addr, addr_len) == 0;
+    }
+
+    size_t peer_hash() const override
+    {
+        size_t hash = TransportToken::peer_hash();
+        const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&addr);
+        for (socklen_t i = 0; i < addr_len; ++i)
+            hash ^= (bytes[i] + 0x9e3779b9 + (hash << 6) + (hash >> 2));
+        return hash;
+    }
+
+    const struct sockaddr* peer_address(socklen_t* len) const override
+    {
+        *len = addr_len;
+        return addr_len ? reinterpret_cast<const struct sockaddr*>(&addr) : nullptr;
+    }
+
+protected:
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+};
+
+/*
+ * Feeds the frames of a capture file into the receive queue, for profiling
+ * the protocol and application layers with recorded traffic:
+ *
+ *     ReplayTransport<MyProtocol> replay("/tmp/link.pcap", ReplayMode::ORIGINAL);
+ *     replay.open();
+ *     auto frame_pair = replay.receive(std::chrono::seconds(1));
+ *
+ * Only frames of one direction are replayed, the received ones by default.
+ * The captured time is passed on as FrameMeta::kernel_time. Frames sent to
+ * a ReplayTransport are counted and dropped.
+ */
+template <typename P>
+class ReplayTransport : public BaseTransport<P>
+{
+public:
+    explicit ReplayTransport(const std::string& path, ReplayMode mode = ReplayMode::FAST)
+        : path(path), mode(mode), speed(1), loop(false),
+          direction(CaptureDirection::RECEIVED), is_finished(false) {}
+
+    ~ReplayTransport() override
+    {
+        this->close();
+    }
+
+    void open() override
+    {
+        auto &logger = *logging::get_logger("transport");
+        if (this->is_open)
+        {
+            return;
+        }
+        else if (this->is_closed)
+        {
+            logger.info("reopen replay transport");
+            this->is_open = false;
+            this->is_closed = false;
+        }
+        logger.info("replay capture %s", path.c_str());
+        reader.reset(new CaptureReader(path));
+        is_finished = false;
+        super::open();
+    }
+
+    // playback speed of ReplayMode::ORIGINAL, 2 replays twice as fast
+    void set_speed(double value)
+    {
+        speed = value > 0 ? value : 1;
+    }
+
+    // start over at the end of the capture instead of finishing
+    void set_loop(bool value)
+    {
+        loop = value;
+    }
+
+    void set_direction(CaptureDirection value)
+    {
+        direction = value;
+    }
+
+    // all frames were queued
+    bool finished() const
+    {
+        return is_finished.load(std::memory_order_acquire);
+    }
+
+protected:
+    void send_backend() override
+    {
+        while (!this->is_closed)
+        {
+            auto frame_pair = this->pop_send();
+            size_t size = P::frame_size(frame_pair.first);
+            this->count_send(size, size);
+            this->complete_send(frame_pair, size);
+        }
+    }
+
+    void receive_backend() override
+    {
+        typedef std::chrono::steady_clock Clock;
+        CaptureRecord record;
+        bool started = false;
+        uint64_t first_time = 0;
+        Clock::time_point start;
+        while (!this->is_closed)
+        {
+            if (!reader->next(record))
+            {
+                if (!loop)
+                {
+                    break;
+                }
+                reader->rewind();
+                started = false;
+                continue;
+            }
+            if (record.direction != direction)
+            {
+                continue;
+            }
+            if (mode == ReplayMode::ORIGINAL)
+            {
+                if (!started)
+                {
+                    started = true;
+                    first_time = record.time;
+                    start = Clock::now();
+                }
+                uint64_t offset = record.time > first_time ? record.time - first_time : 0;
+                if (!wait_until(start + std::chrono::nanoseconds((uint64_t)(offset / speed))))
+                {
+                    break;
+                }
+            }
+            else
+            {
+                while (this->recv_que.Size() >= TRANSPORT_REPLAY_MAX_PENDING && !this->is_closed)
+                {
+                    std::this_thread::sleep_for(std::chrono::microseconds(50));
+                }
+            }
+            FrameMeta meta;
+            meta.kernel_time = record.time;
+            this->count_receive(record.size);
+            this->deliver(P::make_frame(const_cast<uint8_t*>(record.data), record.size),
+                          std::make_shared<ReplayTransportToken>(this, record.addr, record.addr_len), meta);
+        }
+        is_finished.store(true, std::memory_order_release);
+    }
+
+private:
+    typedef BaseTransport<P> super;
+
+    // sleep in short steps so close() is noticed, false once closed
+    bool wait_until(std::chrono::steady_clock::time_point deadline)
+    {
+        while (!this->is_closed)
+        {
+            auto now = std::chrono::steady_clock::now();
+            if (now >= deadline)
+            {
+                return true;
+            }
+            std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(
+                deadline - now, std::chrono::milliseconds(100)));
+        }
+        return false;
+    }
+
+    std::string path;
+    ReplayMode mode;
+    double speed;
+    bool loop;
+    CaptureDirection direction;
+    std::atomic<bool> is_finished;
+    std::unique_ptr<CaptureReader> reader;
+};
+
+}
+
+#endif
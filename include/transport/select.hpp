@@ -0,0 +1,156 @@
+#ifndef _INCLUDE_TRANSPORT_SELECT_
+#define _INCLUDE_TRANSPORT_SELECT_
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include "base.hpp"
+
+namespace transport
+{
+
+/*
+ * Waits on the receive queues of several transports from one thread. All
+ * members share a QueueNotifier, so a frame queued on any of them wakes the
+ * selecting thread directly, with no polling interval. Scanning starts after
+ * the transport served last, so a busy member cannot starve the others.
+ * Closed members are skipped. Transports must stay alive until removed or
+ * the set is destroyed; frames taken by on_receive() handlers never reach
+ * the set.
+ */
+template <typename P>
+class TransportSet
+{
+public:
+    typedef BaseTransport<P> Transport;
+    typedef typename Transport::DataPair DataPair;
+    typedef typename Transport::FrameEntry FrameEntry;
+
+    TransportSet() : notifier(std::make_shared<QueueNotifier>()), next(0) {}
+    TransportSet(const TransportSet&) = delete;
+
+    ~TransportSet()
+    {
+        for (Transport* transport : members)
+            transport->unwatch_receive(notifier);
+    }
+
+    void add(Transport& transport)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (Transport* member : members)
+        {
+            if (member == &transport)
+                return;
+        }
+        transport.watch_receive(notifier);
+        members.push_back(&transport);
+        // frames queued before joining are picked up by the next scan
+        notifier->Notify();
+    }
+
+    void remove(Transport& transport)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (auto it = members.begin(); it != members.end(); ++it)
+        {
+            if (*it == &transport)
+            {
+                transport.unwatch_receive(notifier);
+                members.erase(it);
+                return;
+            }
+        }
+    }
+
+    size_t size()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return members.size();
+    }
+
+    // the transport a frame came from and the frame, like receive()
+    template <typename Rep = uint64_t, typename Period = std::milli>
+    std::pair<Transport*, DataPair> select(std::chrono::duration<Rep, Period> dur = std::chrono::milliseconds(0))
+    {
+        std::pair<Transport*, FrameEntry> selected = select_entry(dur);
+        return std::make_pair(selected.first, DataPair(std::move(selected.second)));
+    }
+
+    // like select(), but keeps the FrameMeta; throws QueueTimeout if `dur`
+    // is positive and no member receives a frame in time, and
+    // std::runtime_error once no member is open
+    template <typename Rep = uint64_t, typename Period = std::milli>
+    std::pair<Transport*, FrameEntry> select_entry(std::chrono::duration<Rep, Period> dur = std::chrono::milliseconds(0))
+    {
+        auto until = std::chrono::steady_clock::now() + dur;
+        FrameEntry entry;
+        while (true)
+        {
+            // read before the scan, so a push during the scan ends the wait;
+            // close() clears the receive queue, which wakes the wait as well
+            uint64_t seen = notifier->Sequence();
+            bool any_open = false;
+            Transport* transport = scan(entry, any_open);
+            if (transport)
+                return std::make_pair(transport, std::move(entry));
+            if (!any_open)
+            {
+                auto &logger = *logging::get_logger("transport");
+                logger.error("no open transport to select from");
+                throw std::runtime_error("no open transport to select from");
+            }
+            if (!dur.count())
+            {
+                notifier->Wait(seen);
+                continue;
+            }
+            auto remaining = until - std::chrono::steady_clock::now();
+            if (remaining.count() <= 0 || !notifier->Wait(seen, remaining))
+                throw QueueTimeout(nullptr);
+        }
+    }
+
+private:
+    Transport* scan(FrameEntry& entry, bool& any_open)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t count = members.size();
+        for (size_t i = 0; i < count; ++i)
+        {
+            size_t index = (next + i) % count;
+            Transport* transport = members[index];
+            if (transport->closed())
+                continue;
+            bool received;
+            try
+            {
+                received = transport->try_receive_entry(entry);
+            }
+            catch (const std::runtime_error&)
+            {
+                // closed since the check above
+                continue;
+            }
+            any_open = true;
+            if (received)
+            {
+                next = index + 1;
+                return transport;
+            }
+        }
+        return nullptr;
+    }
+
+    std::shared_ptr<QueueNotifier> notifier;
+    std::vector<Transport*> members;
+    std::mutex mutex;
+    size_t next;
+};
+
+}
+
+#endif
@@ -180,27 +180,34 @@ protected:
         // this->ensure_open();
         auto &logger = *logging::get_logger("transport");
         logger.debug("start serial port send backend");
+        logging::RateLimiter error_limit;
         while (!this->is_closed)
         {
-            auto frame_pair = this->send_que.Pop();
-            auto frame = frame_pair.first;
+            auto frame_pair = this->pop_send();
+            auto& frame = frame_pair.first;
             if (frame_pair.second && frame_pair.second->template transport<P>() != this)
             {
-                logger.error("invalid token received");
+                this->count_send_error();
+                this->complete_send(frame_pair, -EINVAL);
+                error_limit.log(logger, logging::LogLevel::ERROR, "invalid token received");
                 continue;
             }
             size_t remaining_size = P::frame_size(frame);
             if (remaining_size == 0) {
+                this->complete_send(frame_pair, 0);
                 continue;
             }
             logger.debug("send data %zu", remaining_size);
+            size_t frame_size = remaining_size;
             size_t offset = 0;
+            uint64_t send_start = this->trace_clock();
             while (remaining_size > 0)
             {
                 auto written_size = write(tty_id, static_cast<uint8_t*>(P::frame_data(frame)) + offset, remaining_size);
                 if (written_size < 0)
                 {
-                    logger.error("write serial port failed: %s", strerror(errno));
+                    this->count_send_error();
+                    error_limit.log(logger, logging::LogLevel::ERROR, "write serial port failed: %s", strerror(errno));
                 }
                 else
                 {
@@ -208,6 +215,10 @@ protected:
                     offset += written_size;
                 }
             }
+            this->trace_send(frame_pair.meta, send_start);
+            this->count_send(frame_size, frame_size);
+            this->complete_send(frame_pair, frame_size);
+            this->capture(CaptureDirection::SENT, frame, nullptr, 0);
         }
     }
     
@@ -216,6 +227,7 @@ protected:
         // this->ensure_open();
         auto &logger = *logging::get_logger("transport");
         logger.debug("start serial port receive backend");
+        logging::RateLimiter error_limit;
         bool find_head = false;
         size_t min_size = P::pred_size(nullptr, 0);
         if (!min_size) min_size = 1;
@@ -262,7 +274,8 @@ protected:
                         logger.debug("find valid data (length=%zu)", pred_size);
                         if (pred_size > buffer_size)
                         {
-                            logger.error("data size is too large (%zu)\n", pred_size);
+                            this->count_invalid_frame();
+                            error_limit.log(logger, logging::LogLevel::ERROR, "data size is too large (%zu)", pred_size);
                             find_head = false;
                             pred_size = min_size * 2;
                             continue;
@@ -277,7 +290,8 @@ protected:
                 // all data received
                 auto frame = P::make_frame((uint8_t *)buffer + offset, pred_size);
                 logger.debug("receive data %zu", pred_size);
-                this->recv_que.Push(std::make_pair(std::move(frame), std::make_shared<TransportToken>(this)));
+                this->count_receive(pred_size);
+                this->deliver(std::move(frame), std::make_shared<TransportToken>(this));
                 offset += pred_size; // update offset for next run
             }
 
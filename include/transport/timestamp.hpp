@@ -0,0 +1,91 @@
+#ifndef _INCLUDE_TRANSPORT_TIMESTAMP_
+#define _INCLUDE_TRANSPORT_TIMESTAMP_
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+
+// room for one SCM_TIMESTAMPNS or SCM_TIMESTAMPING control message
+#define TRANSPORT_CMSG_BUFFER_SIZE 128
+
+namespace transport
+{
+
+enum class TimestampMode: uint8_t
+{
+    NONE = 0,
+    SOFTWARE,       // SO_TIMESTAMPNS, stamped when the packet enters the stack
+    HARDWARE        // SO_TIMESTAMPING, raw NIC time when the device provides it
+};
+
+/*
+ * Hardware stamps are in the NIC's PTP hardware clock (PHC), which is not
+ * CLOCK_REALTIME: they order frames received on the same NIC precisely, but
+ * compare with software stamps or other NICs only if the PHC is kept in
+ * sync with the system clock, e.g. by phc2sys.
+ */
+
+// returns the setsockopt result
+static inline int enable_timestamping(int sockfd, TimestampMode mode)
+{
+    int on = mode == TimestampMode::SOFTWARE;
+    int ret = setsockopt(sockfd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+    if (ret < 0)
+        return ret;
+
+    // hardware stamps also need the NIC configured with SIOCSHWTSTAMP,
+    // software stamps are requested as well as a fallback
+    int flags = 0;
+    if (mode == TimestampMode::HARDWARE) {
+        flags = SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE |
+                SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+    }
+    return setsockopt(sockfd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags));
+}
+
+static inline uint64_t timespec_ns(const struct timespec& ts)
+{
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// kernel receive time of a message in nanoseconds, 0 if none; CLOCK_REALTIME
+// unless it is a raw hardware stamp, then `raw` is set
+static inline uint64_t receive_timestamp(struct msghdr* msg, bool* raw = nullptr)
+{
+    if (raw)
+        *raw = false;
+    if (!msg->msg_controllen)
+        return 0;
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg))
+    {
+        if (cmsg->cmsg_level != SOL_SOCKET)
+            continue;
+        if (cmsg->cmsg_type == SCM_TIMESTAMPNS)
+        {
+            struct timespec ts;
+            memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+            return timespec_ns(ts);
+        }
+        if (cmsg->cmsg_type == SCM_TIMESTAMPING)
+        {
+            struct scm_timestamping tss;
+            memcpy(&tss, CMSG_DATA(cmsg), sizeof(tss));
+            // ts[2] is the raw hardware stamp, ts[0] the software one
+            if (tss.ts[2].tv_sec || tss.ts[2].tv_nsec)
+            {
+                if (raw)
+                    *raw = true;
+                return timespec_ns(tss.ts[2]);
+            }
+            return timespec_ns(tss.ts[0]);
+        }
+    }
+    return 0;
+}
+
+}
+
+#endif
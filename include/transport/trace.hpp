@@ -0,0 +1,133 @@
+#ifndef _INCLUDE_TRANSPORT_TRACE_
+#define _INCLUDE_TRANSPORT_TRACE_
+
+#include <stdint.h>
+#include <time.h>
+#include <atomic>
+
+namespace transport
+{
+
+// where a frame spends its time, see BaseTransport::enable_tracing
+enum class TraceStage: uint8_t
+{
+    SEND_QUEUE = 0,     // send() until the send backend picks the frame up
+    SEND_SYSCALL,       // blocked in sendto/write
+    RECV_QUEUE,         // receive syscall returned until receive() dequeued it
+    COUNT
+};
+
+struct LatencySummary
+{
+    uint64_t count;
+    uint64_t mean;      // all values in nanoseconds
+    uint64_t max;
+    uint64_t p50;
+    uint64_t p99;
+    uint64_t p999;
+};
+
+/*
+ * Lock-free log-linear histogram of nanosecond latencies. Every power of two
+ * is split into 8 linear buckets, which bounds the relative error of a
+ * percentile to 1/16. record() is one relaxed fetch_add per counter.
+ */
+class LatencyHistogram
+{
+public:
+    static constexpr unsigned SUB_BITS = 3;
+    static constexpr unsigned SUB_COUNT = 1 << SUB_BITS;
+    static constexpr unsigned BUCKET_COUNT = (64 - SUB_BITS + 1) * SUB_COUNT;
+
+    LatencyHistogram()
+    {
+        reset();
+    }
+    LatencyHistogram(const LatencyHistogram&) = delete;
+
+    inline void record(uint64_t value)
+    {
+        buckets[index(value)].fetch_add(1, std::memory_order_relaxed);
+        total.fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(value, std::memory_order_relaxed);
+        uint64_t curr = peak.load(std::memory_order_relaxed);
+        while (value > curr && !peak.compare_exchange_weak(curr, value, std::memory_order_relaxed)) {}
+    }
+
+    // value below which a fraction q of the samples fall
+    uint64_t percentile(double q) const
+    {
+        uint64_t count = total.load(std::memory_order_relaxed);
+        if (!count)
+            return 0;
+        uint64_t rank = (uint64_t)(q * count);
+        if (rank >= count) rank = count - 1;
+        uint64_t seen = 0;
+        for (unsigned i = 0; i < BUCKET_COUNT; ++i) {
+            seen += buckets[i].load(std::memory_order_relaxed);
+            if (seen > rank) {
+                uint64_t value = midpoint(i);
+                uint64_t max_value = peak.load(std::memory_order_relaxed);
+                return value < max_value ? value : max_value;
+            }
+        }
+        return peak.load(std::memory_order_relaxed);
+    }
+
+    LatencySummary summary() const
+    {
+        LatencySummary result;
+        result.count = total.load(std::memory_order_relaxed);
+        result.mean = result.count ? sum.load(std::memory_order_relaxed) / result.count : 0;
+        result.max = peak.load(std::memory_order_relaxed);
+        result.p50 = percentile(0.5);
+        result.p99 = percentile(0.99);
+        result.p999 = percentile(0.999);
+        return result;
+    }
+
+    void reset()
+    {
+        for (auto& bucket : buckets)
+            bucket.store(0, std::memory_order_relaxed);
+        total.store(0, std::memory_order_relaxed);
+        sum.store(0, std::memory_order_relaxed);
+        peak.store(0, std::memory_order_relaxed);
+    }
+
+    static inline unsigned index(uint64_t value)
+    {
+        if (value < SUB_COUNT)
+            return value;
+        unsigned msb = 63 - __builtin_clzll(value);
+        unsigned shift = msb - SUB_BITS;
+        return (shift + 1) * SUB_COUNT + ((value >> shift) & (SUB_COUNT - 1));
+    }
+
+    static inline uint64_t midpoint(unsigned index)
+    {
+        if (index < SUB_COUNT)
+            return index;
+        unsigned shift = index / SUB_COUNT - 1;
+        uint64_t lower = (uint64_t)(SUB_COUNT + index % SUB_COUNT) << shift;
+        return lower + ((1ull << shift) >> 1);
+    }
+
+private:
+    std::atomic<uint64_t> buckets[BUCKET_COUNT];
+    std::atomic<uint64_t> total;
+    std::atomic<uint64_t> sum;
+    std::atomic<uint64_t> peak;
+};
+
+// monotonic nanoseconds used for frame timestamps
+static inline uint64_t trace_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+}
+
+#endif
@@ -1,15 +1,26 @@
 #ifndef _INCLUDE_TRANSPORT_UDP_
 #define _INCLUDE_TRANSPORT_UDP_
 
+#include <algorithm>
+#include <atomic>
 #include <memory>
 #include <string>
+#include <typeinfo>
+#include <vector>
 #include <unistd.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <netinet/udp.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include "base.hpp"
+#include "filter.hpp"
+#include "peer.hpp"
+#include "fragment.hpp"
+#include "timestamp.hpp"
+#include "zerocopy.hpp"
 
 #define TRANSPORT_UDP_BUFFER_SIZE 1024 * 64
 
@@ -20,23 +31,41 @@ public:
     explicit DatagramTransportToken(_transport_base* transport, const struct sockaddr_in& addr, socklen_t addr_len)
         : TransportToken(transport), addr(addr), addr_len(addr_len) {}
     
+    // copies the address only, every interned token has its own PeerState
+    DatagramTransportToken(const DatagramTransportToken& other)
+        : TransportToken(other.transport_), addr(other.addr), addr_len(other.addr_len) {}
+
     bool operator==(const TransportToken& other) const override
     {
-        auto other_token = dynamic_cast<const DatagramTransportToken*>(&other);
-        if (!other_token)
+        if (this == &other)
         {
-            return false;
+            return true;
         }
-        if (transport_ != other_token->transport_ || addr_len != other_token->addr_len)
+        auto other_token = token_cast<DatagramTransportToken>(&other);
+        if (!other_token || transport_ != other_token->transport_ || addr_len != other_token->addr_len)
         {
             return false;
         }
         return memcmp(&addr, &other_token->addr, addr_len) == 0;
     }
 
+    const struct sockaddr* peer_address(socklen_t* len) const override
+    {
+        *len = addr_len;
+        return reinterpret_cast<const struct sockaddr*>(&addr);
+    }
+
+    size_t peer_hash() const override;
+
+    PeerState* peer_state() const override
+    {
+        return &state;
+    }
+
 protected:
     struct sockaddr_in addr;
     socklen_t addr_len;
+    mutable PeerState state;
 
     friend std::hash<DatagramTransportToken>;
     template<typename P>
@@ -47,12 +76,14 @@ template<typename P>
 class DatagramTransport : public BaseTransport<P> {
 public:
     explicit DatagramTransport(size_t buffer_size = TRANSPORT_UDP_BUFFER_SIZE)
-        : sockfd(-1), buffer_size(buffer_size)
+        : sockfd(-1), buffer_size(buffer_size), timestamp_mode(TimestampMode::NONE), fragment_mtu(0), next_msg_id(0),
+          reuse_address(false), multicast_ttl(-1), multicast_loop(-1), zerocopy_threshold(0), zerocopy_active(false)
     {
         memset(&bind_addr, 0, sizeof(bind_addr));
         memset(&connect_addr, 0, sizeof(connect_addr));
         bind_addr.sin_family = AF_INET;
         connect_addr.sin_family = AF_INET;
+        multicast_if.s_addr = INADDR_ANY;
     }
 
     DatagramTransport(std::pair<const char*, int> local_addr, std::pair<const char*, int> remote_addr, size_t buffer_size = TRANSPORT_UDP_BUFFER_SIZE)
@@ -90,6 +121,17 @@ public:
         } else {
             logger.info("open socket fd %d", sockfd);
         }
+        if (timestamp_mode != TimestampMode::NONE && enable_timestamping(sockfd, timestamp_mode) < 0)
+        {
+            logger.raise_from_errno("failed to enable timestamping");
+        }
+        if (!filter_program.empty() && attach_socket_filter(sockfd, filter_program) < 0)
+        {
+            logger.raise_from_errno("failed to attach socket filter");
+        }
+        apply_socket_options();
+        zerocopy.reset();
+        apply_zerocopy();
 
         super::open();
 
@@ -138,6 +180,194 @@ public:
         logger[logging::LogLevel::INFO] << "connecting to " << address << ":" << port << std::endl;
     }
 
+    /*
+     * Drop datagrams that fail `filter` in the kernel, before they are
+     * received, see filter.hpp. The filter is kept across reopen.
+     */
+    void attach_filter(const SocketFilter& filter)
+    {
+        set_filter(filter.compile(sizeof(struct udphdr)));
+    }
+
+    // a raw classic BPF program, absolute offsets start at the UDP header
+    void attach_filter(const struct sock_fprog& program)
+    {
+        set_filter(std::vector<struct sock_filter>(program.filter, program.filter + program.len));
+    }
+
+    void detach_filter()
+    {
+        filter_program.clear();
+        if (this->is_open && !this->closed() && detach_socket_filter(sockfd) < 0 && errno != ENOENT)
+        {
+            auto &logger = *logging::get_logger("transport");
+            logger.raise_from_errno("failed to detach socket filter");
+        }
+    }
+
+    // tokens of the known peers, most recently seen first
+    std::vector<std::shared_ptr<DatagramTransportToken>> peers()
+    {
+        return peer_table.peers();
+    }
+
+    size_t peer_count()
+    {
+        return peer_table.size();
+    }
+
+    // the least recently seen peers beyond `capacity` are forgotten
+    void set_peer_capacity(size_t capacity)
+    {
+        peer_table.set_capacity(capacity);
+    }
+
+    // interned token of `address`, the same one its frames are received with
+    std::shared_ptr<DatagramTransportToken> peer(const std::string& address, int port)
+    {
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        resolve_hostname(address, addr);
+        return peer_table.intern(DatagramTransportToken(this, addr, sizeof(addr)));
+    }
+
+    // stamp received datagrams in the kernel, see FrameMeta::kernel_time
+    void set_timestamping(TimestampMode mode)
+    {
+        timestamp_mode = mode;
+        if (this->is_open && !this->closed() && enable_timestamping(sockfd, mode) < 0)
+        {
+            auto &logger = *logging::get_logger("transport");
+            logger.raise_from_errno("failed to enable timestamping");
+        }
+    }
+
+    // SO_REUSEADDR, lets several subscribers on one host bind the same group port
+    void set_reuse_address(bool enable)
+    {
+        reuse_address = enable;
+        if (this->is_open && !this->closed())
+            apply_socket_options();
+    }
+
+    // hops of datagrams sent to a group, 1 keeps them in the local network
+    void set_multicast_ttl(int ttl)
+    {
+        multicast_ttl = ttl;
+        if (this->is_open && !this->closed())
+            apply_socket_options();
+    }
+
+    // deliver datagrams sent to a group to subscribers on this host as well
+    void set_multicast_loopback(bool enable)
+    {
+        multicast_loop = enable;
+        if (this->is_open && !this->closed())
+            apply_socket_options();
+    }
+
+    // local address of the interface group datagrams are sent from
+    void set_multicast_interface(const std::string& address)
+    {
+        struct sockaddr_in addr;
+        resolve_hostname(address, addr);
+        multicast_if = addr.sin_addr;
+        if (this->is_open && !this->closed())
+            apply_socket_options();
+    }
+
+    /*
+     * Subscribe to a multicast group on the interface with the local address
+     * `interface`, or on the default one. Bind to the group port first; to
+     * publish, connect() to the group address.
+     */
+    void join_group(const std::string& group, const std::string& interface = "")
+    {
+        this->ensure_open();
+        auto &logger = *logging::get_logger("transport");
+        struct ip_mreq mreq = make_membership(group, interface);
+#ifdef IP_MULTICAST_ALL
+        // only the groups joined on this socket, not those of every socket on the port
+        int all = 0;
+        if (setsockopt(sockfd, IPPROTO_IP, IP_MULTICAST_ALL, &all, sizeof(all)) < 0)
+        {
+            logger.raise_from_errno("failed to clear IP_MULTICAST_ALL");
+        }
+#endif
+        if (setsockopt(sockfd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0)
+        {
+            logger.raise_from_errno("failed to join multicast group");
+        }
+        logger.info("joined multicast group %s", group.c_str());
+    }
+
+    void leave_group(const std::string& group, const std::string& interface = "")
+    {
+        this->ensure_open();
+        auto &logger = *logging::get_logger("transport");
+        struct ip_mreq mreq = make_membership(group, interface);
+        if (setsockopt(sockfd, IPPROTO_IP, IP_DROP_MEMBERSHIP, &mreq, sizeof(mreq)) < 0)
+        {
+            logger.raise_from_errno("failed to leave multicast group");
+        }
+        logger.info("left multicast group %s", group.c_str());
+    }
+
+    /*
+     * Send frames of at least `threshold` bytes with MSG_ZEROCOPY, 0 turns
+     * it off. The kernel then reads the frame from its own pages, which are
+     * kept alive in the send backend until the socket error queue reports
+     * them done; the application hands over frames as before. Without
+     * kernel support, frames are copied as usual.
+     */
+    void set_zerocopy(size_t threshold = TRANSPORT_ZEROCOPY_THRESHOLD)
+    {
+        zerocopy_threshold.store(threshold, std::memory_order_relaxed);
+        if (this->is_open && !this->closed())
+            apply_zerocopy();
+    }
+
+    ZeroCopyStats zerocopy_stats() const
+    {
+        return zerocopy.stats();
+    }
+
+    /*
+     * Split frames into datagrams of at most `mtu` bytes on the wire, with a
+     * FragmentHeader in front of each, and reassemble them on receive. Large
+     * frames then pass without IP fragmentation. Both ends must enable it,
+     * before open().
+     */
+    void enable_fragmentation(size_t mtu = TRANSPORT_FRAGMENT_MTU, const FragmentConfig& config = FragmentConfig())
+    {
+        auto &logger = *logging::get_logger("transport");
+        if (this->is_open && !this->closed())
+        {
+            logger.error("fragmentation must be enabled before open");
+            throw std::runtime_error("fragmentation must be enabled before open");
+        }
+        if (mtu <= TRANSPORT_FRAGMENT_OVERHEAD + sizeof(FragmentHeader) || mtu > buffer_size)
+        {
+            logger.error("invalid fragmentation mtu %zu", mtu);
+            throw std::runtime_error("invalid fragmentation mtu");
+        }
+        fragment_mtu = mtu;
+        reassembler.reset(new FragmentReassembler(config));
+    }
+
+    FragmentStats fragment_stats() const
+    {
+        if (!reassembler)
+        {
+            FragmentStats empty;
+            memset(&empty, 0, sizeof(empty));
+            return empty;
+        }
+        return reassembler->stats();
+    }
+
     constexpr static std::pair<const char*, int> nulladdr = {"", 0};
 
 protected:
@@ -146,26 +376,84 @@ protected:
         // this->ensure_open();
         auto &logger = *logging::get_logger("transport");
         logger.debug("start datagram send backend");
+        logging::RateLimiter error_limit;
         while (!this->is_closed)
         {
-            auto frame_pair = this->send_que.Pop();
-            auto frame = frame_pair.first;
-            if (!P::frame_size(frame))
+            typename super::FrameEntry frame_pair;
+            if (zerocopy.size())
+            {
+                // poll the error queue while idle, so held frames are released
+                try
+                {
+                    frame_pair = this->pop_send(std::chrono::milliseconds(10));
+                }
+                catch (const QueueTimeout&)
+                {
+                    zerocopy.drain(sockfd);
+                    continue;
+                }
+            }
+            else
+            {
+                frame_pair = this->pop_send();
+            }
+            auto& frame = frame_pair.first;
+            size_t size = P::frame_size(frame);
+            if (!size)
+            {
+                this->complete_send(frame_pair, 0);
                 continue;
-            auto token = dynamic_cast<DatagramTransportToken *>((frame_pair.second.get()));
+            }
+            auto token = token_cast<DatagramTransportToken>(frame_pair.second.get());
+            if (frame_pair.second && !token)
+            {
+                error_limit.log(logger, logging::LogLevel::WARN, "token without a peer address, sending to the connected address");
+            }
             struct sockaddr* addr = (struct sockaddr *)((token) ? &token->addr : &connect_addr);
             socklen_t addr_len = (token) ? token->addr_len : sizeof(connect_addr);
             
-            ssize_t sent_size = sendto(sockfd, P::frame_data(frame), P::frame_size(frame), 0,
-                                    addr, addr_len);
+            uint64_t send_start = this->trace_clock();
+            bool held = false;
+            ssize_t sent_size;
+            if (fragment_mtu)
+                sent_size = send_fragments(static_cast<const uint8_t*>(P::frame_data(frame)), size, addr, addr_len);
+            else if (zerocopy_active.load(std::memory_order_relaxed) &&
+                     size >= zerocopy_threshold.load(std::memory_order_relaxed))
+                sent_size = send_zerocopy(P::frame_data(frame), size, addr, addr_len, held);
+            else
+                sent_size = sendto(sockfd, P::frame_data(frame), size, 0, addr, addr_len);
+            int send_errno = errno;
+            this->trace_send(frame_pair.meta, send_start);
             logger.debug("send data %zd", sent_size);
+            this->count_send(size, sent_size);
+            this->complete_send(frame_pair, sent_size < 0 ? -send_errno : sent_size);
+            if (token)
+            {
+                token->state.count_send(size, sent_size);
+            }
             if (sent_size < 0)
             {
-                logger.error("udp send failed: %s", strerror(errno));
+                error_limit.log(logger, logging::LogLevel::ERROR, "udp send failed: %s", strerror(send_errno));
             }
-            else if ((size_t)sent_size < P::frame_size(frame))
+            else if ((size_t)sent_size < size)
             {
-                logger.warn("sendto failed, only %zd bytes sent", sent_size);
+                error_limit.log(logger, logging::LogLevel::WARN, "sendto failed, only %zd bytes sent", sent_size);
+            }
+            if (sent_size >= 0)
+            {
+                this->capture(CaptureDirection::SENT, frame, addr, addr_len);
+            }
+            if (held)
+            {
+                zerocopy.hold(std::move(frame));
+            }
+            if (zerocopy.size())
+            {
+                zerocopy.drain(sockfd);
+                while (zerocopy.size() >= TRANSPORT_ZEROCOPY_MAX_PENDING && !this->is_closed)
+                {
+                    zerocopy.wait(sockfd, 100);
+                }
             }
         }
     }
@@ -175,33 +463,189 @@ protected:
         // this->ensure_open();
         auto &logger = *logging::get_logger("transport");
         logger.debug("start datagram receive backend");
+        logging::RateLimiter error_limit;
         uint8_t *buffer = new uint8_t[buffer_size];
         while (!this->is_closed)
         {
             struct sockaddr_in addr;
-            socklen_t addr_len = sizeof(addr);
-            ssize_t recv_size = recvfrom(sockfd, buffer, buffer_size, 0,
-                                        (struct sockaddr *)&addr, &addr_len);
+            struct iovec iov = {buffer, buffer_size};
+            alignas(struct cmsghdr) char control[TRANSPORT_CMSG_BUFFER_SIZE];
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_name = &addr;
+            msg.msg_namelen = sizeof(addr);
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+            // MSG_TRUNC reports the real length of an oversized datagram
+            ssize_t recv_size = recvmsg(sockfd, &msg, MSG_TRUNC);
+            socklen_t addr_len = msg.msg_namelen;
             if (recv_size < 0)
             {
-                logger.error("udp recv failed: %s", strerror(errno));
+                this->count_receive_error();
+                error_limit.log(logger, logging::LogLevel::ERROR, "udp recv failed: %s", strerror(errno));
                 continue;
             }
+            if ((size_t)recv_size > buffer_size)
+            {
+                this->count_truncated();
+                error_limit.log(logger, logging::LogLevel::WARN, "datagram truncated (%zd > %zu bytes)", recv_size, buffer_size);
+                recv_size = buffer_size;
+            }
             logger.debug("receive data %zd", recv_size);
-            ssize_t pred_size = P::pred_size(buffer, recv_size);
+            uint8_t *data = buffer;
+            if (reassembler)
+            {
+                const uint8_t* frame_data;
+                size_t frame_size;
+                if (!reassembler->add((struct sockaddr *)&addr, addr_len, buffer, recv_size, frame_data, frame_size))
+                    continue;
+                data = const_cast<uint8_t*>(frame_data);
+                recv_size = frame_size;
+            }
+            ssize_t pred_size = P::pred_size(data, recv_size);
             if (pred_size < 0)
             {
-                logger.error("invalid frame received");
+                this->count_invalid_frame();
+                error_limit.log(logger, logging::LogLevel::ERROR, "invalid frame received");
                 continue;
             }
-            auto frame = P::make_frame(buffer, recv_size);
-            this->recv_que.Push(std::make_pair(frame, std::make_shared<DatagramTransportToken>(this, addr, addr_len)));
+            this->count_receive(recv_size);
+            FrameMeta meta;
+            meta.kernel_time = receive_timestamp(&msg, &meta.kernel_raw);
+            auto frame = P::make_frame(data, recv_size);
+            auto token = peer_table.intern(DatagramTransportToken(this, addr, addr_len));
+            token->state.count_receive(recv_size);
+            this->deliver(std::move(frame), std::move(token), meta);
         }
 
         delete[] buffer;
     }
 
 private:
+    void set_filter(std::vector<struct sock_filter> program)
+    {
+        filter_program = std::move(program);
+        if (this->is_open && !this->closed() && attach_socket_filter(sockfd, filter_program) < 0)
+        {
+            auto &logger = *logging::get_logger("transport");
+            logger.raise_from_errno("failed to attach socket filter");
+        }
+    }
+
+    void apply_zerocopy()
+    {
+        zerocopy_active.store(false, std::memory_order_relaxed);
+        if (!zerocopy_threshold.load(std::memory_order_relaxed))
+            return;
+        if (enable_zerocopy(sockfd) < 0)
+        {
+            auto &logger = *logging::get_logger("transport");
+            logger.warn("SO_ZEROCOPY not available, frames are copied: %s", strerror(errno));
+            return;
+        }
+        zerocopy_active.store(true, std::memory_order_relaxed);
+    }
+
+    // `held` is set when the kernel still references the frame after the call
+    ssize_t send_zerocopy(const void* data, size_t size, struct sockaddr* addr, socklen_t addr_len, bool& held)
+    {
+        ssize_t sent_size = sendto(sockfd, data, size, MSG_ZEROCOPY, addr, addr_len);
+        if (sent_size >= 0)
+        {
+            held = true;
+            return sent_size;
+        }
+        // out of optmem for the page pins, copy instead
+        if (errno == ENOBUFS)
+        {
+            zerocopy.count_fallback();
+            return sendto(sockfd, data, size, 0, addr, addr_len);
+        }
+        return sent_size;
+    }
+
+    // one sendmsg per fragment, the payload is sent from the frame in place
+    ssize_t send_fragments(const uint8_t* data, size_t size, struct sockaddr* addr, socklen_t addr_len)
+    {
+        if (size > UINT32_MAX)
+        {
+            errno = EMSGSIZE;
+            return -1;
+        }
+        size_t chunk = fragment_mtu - TRANSPORT_FRAGMENT_OVERHEAD - sizeof(FragmentHeader);
+        FragmentHeader header = {TRANSPORT_FRAGMENT_MAGIC, 0, next_msg_id++, 0, static_cast<uint32_t>(size)};
+        uint8_t wire[sizeof(FragmentHeader)];
+        struct iovec iov[2];
+        iov[0].iov_base = wire;
+        iov[0].iov_len = sizeof(wire);
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_name = addr;
+        msg.msg_namelen = addr_len;
+        msg.msg_iov = iov;
+        msg.msg_iovlen = 2;
+        size_t offset = 0;
+        do
+        {
+            size_t length = std::min(chunk, size - offset);
+            header.offset = static_cast<uint32_t>(offset);
+            header.store(wire);
+            iov[1].iov_base = const_cast<uint8_t*>(data) + offset;
+            iov[1].iov_len = length;
+            if (sendmsg(sockfd, &msg, 0) < 0)
+            {
+                return -1;
+            }
+            offset += length;
+        } while (offset < size);
+        return offset;
+    }
+
+    // options that must be set again on every new socket
+    void apply_socket_options()
+    {
+        auto &logger = *logging::get_logger("transport");
+        int value = reuse_address;
+        if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &value, sizeof(value)) < 0)
+        {
+            logger.raise_from_errno("failed to set SO_REUSEADDR");
+        }
+        if (multicast_ttl >= 0)
+        {
+            unsigned char ttl = multicast_ttl;
+            if (setsockopt(sockfd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) < 0)
+            {
+                logger.raise_from_errno("failed to set multicast ttl");
+            }
+        }
+        if (multicast_loop >= 0)
+        {
+            unsigned char loop = multicast_loop;
+            if (setsockopt(sockfd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop)) < 0)
+            {
+                logger.raise_from_errno("failed to set multicast loopback");
+            }
+        }
+        if (multicast_if.s_addr != INADDR_ANY &&
+            setsockopt(sockfd, IPPROTO_IP, IP_MULTICAST_IF, &multicast_if, sizeof(multicast_if)) < 0)
+        {
+            logger.raise_from_errno("failed to set multicast interface");
+        }
+    }
+
+    static struct ip_mreq make_membership(const std::string& group, const std::string& interface)
+    {
+        struct sockaddr_in addr;
+        struct ip_mreq mreq;
+        resolve_hostname(group, addr);
+        mreq.imr_multiaddr = addr.sin_addr;
+        resolve_hostname(interface, addr);
+        mreq.imr_interface = addr.sin_addr;
+        return mreq;
+    }
+
     static void resolve_hostname(const std::string& hostname, struct sockaddr_in& result)
     {
         if (hostname.empty())
@@ -226,6 +670,20 @@ private:
     struct sockaddr_in bind_addr;
     struct sockaddr_in connect_addr;
     size_t buffer_size;
+    TimestampMode timestamp_mode;
+    std::vector<struct sock_filter> filter_program;
+    PeerTable<DatagramTransportToken> peer_table;
+    size_t fragment_mtu;
+    uint32_t next_msg_id;
+    std::unique_ptr<FragmentReassembler> reassembler;
+    bool reuse_address;
+    int multicast_ttl;          // -1 for the system default
+    int multicast_loop;         // -1 for the system default
+    struct in_addr multicast_if;
+    // set_zerocopy() may run while the send backend reads these
+    std::atomic<size_t> zerocopy_threshold;
+    std::atomic<bool> zerocopy_active;
+    ZeroCopyTracker<typename P::FrameType> zerocopy;
 };
 
 }
@@ -244,4 +702,13 @@ namespace std {
         }
     };
 }
+
+namespace transport {
+
+inline size_t DatagramTransportToken::peer_hash() const
+{
+    return std::hash<DatagramTransportToken>()(*this);
+}
+
+}
 #endif
\ No newline at end of file
@@ -3,12 +3,18 @@
 
 #include <memory>
 #include <string>
+#include <typeinfo>
+#include <vector>
+#include <stddef.h>
 #include <unistd.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <netdb.h>
 #include <sys/socket.h>
 #include "base.hpp"
+#include "filter.hpp"
+#include "peer.hpp"
+#include "timestamp.hpp"
 
 #define TRANSPORT_UDP_BUFFER_SIZE 1024
 
@@ -19,23 +25,41 @@ public:
     explicit UnixDatagramTransportToken(_transport_base* transport, const struct sockaddr_un& addr, socklen_t addr_len)
         : TransportToken(transport), addr(addr), addr_len(addr_len) {}
 
+    // copies the address only, every interned token has its own PeerState
+    UnixDatagramTransportToken(const UnixDatagramTransportToken& other)
+        : TransportToken(other.transport_), addr(other.addr), addr_len(other.addr_len) {}
+
     bool operator==(const TransportToken& other) const override
     {
-        auto other_token = dynamic_cast<const UnixDatagramTransportToken*>(&other);
-        if (!other_token)
+        if (this == &other)
         {
-            return false;
+            return true;
         }
-        if (transport_ != other_token->transport_ || addr_len != other_token->addr_len)
+        auto other_token = token_cast<UnixDatagramTransportToken>(&other);
+        if (!other_token || transport_ != other_token->transport_ || addr_len != other_token->addr_len)
         {
             return false;
         }
         return memcmp(&addr, &other_token->addr, addr_len) == 0;
     }
 
+    const struct sockaddr* peer_address(socklen_t* len) const override
+    {
+        *len = addr_len;
+        return reinterpret_cast<const struct sockaddr*>(&addr);
+    }
+
+    size_t peer_hash() const override;
+
+    PeerState* peer_state() const override
+    {
+        return &state;
+    }
+
 protected:
     struct sockaddr_un addr;
     socklen_t addr_len;
+    mutable PeerState state;
 
     friend std::hash<UnixDatagramTransportToken>;
     template <typename P>
@@ -46,7 +70,7 @@ template <typename P>
 class UnixDatagramTransport : public BaseTransport<P> {
 public:
     explicit UnixDatagramTransport(size_t buffer_size = TRANSPORT_UDP_BUFFER_SIZE)
-        : sockfd(-1), buffer_size(buffer_size)
+        : sockfd(-1), buffer_size(buffer_size), timestamp_mode(TimestampMode::NONE)
     {
         memset(&bind_addr, 0, sizeof(bind_addr));
         memset(&connect_addr, 0, sizeof(connect_addr));
@@ -85,6 +109,14 @@ public:
         } else {
             logger.info("open socket fd %d", sockfd);
         }
+        if (timestamp_mode != TimestampMode::NONE && enable_timestamping(sockfd, timestamp_mode) < 0)
+        {
+            logger.raise_from_errno("failed to enable timestamping");
+        }
+        if (!filter_program.empty() && attach_socket_filter(sockfd, filter_program) < 0)
+        {
+            logger.raise_from_errno("failed to attach socket filter");
+        }
 
         super::open();
 
@@ -121,32 +153,118 @@ public:
         logger[logging::LogLevel::INFO] << "connecting to " << address << std::endl;
     }
 
+    /*
+     * Drop datagrams that fail `filter` in the kernel, before they are
+     * received, see filter.hpp. The filter is kept across reopen.
+     */
+    void attach_filter(const SocketFilter& filter)
+    {
+        set_filter(filter.compile(0));
+    }
+
+    // a raw classic BPF program, absolute offsets start at the frame
+    void attach_filter(const struct sock_fprog& program)
+    {
+        set_filter(std::vector<struct sock_filter>(program.filter, program.filter + program.len));
+    }
+
+    void detach_filter()
+    {
+        filter_program.clear();
+        if (this->is_open && !this->closed() && detach_socket_filter(sockfd) < 0 && errno != ENOENT)
+        {
+            auto &logger = *logging::get_logger("transport");
+            logger.raise_from_errno("failed to detach socket filter");
+        }
+    }
+
+    // tokens of the known peers, most recently seen first
+    std::vector<std::shared_ptr<UnixDatagramTransportToken>> peers()
+    {
+        return peer_table.peers();
+    }
+
+    size_t peer_count()
+    {
+        return peer_table.size();
+    }
+
+    // the least recently seen peers beyond `capacity` are forgotten
+    void set_peer_capacity(size_t capacity)
+    {
+        peer_table.set_capacity(capacity);
+    }
+
+    // interned token of `address`, the same one its frames are received with
+    std::shared_ptr<UnixDatagramTransportToken> peer(const std::string& address)
+    {
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        set_sock_path(address, addr);
+        // the kernel reports path addresses with the terminating NUL
+        socklen_t addr_len = offsetof(struct sockaddr_un, sun_path) + address.size() + 1;
+        return peer_table.intern(UnixDatagramTransportToken(this, addr, addr_len));
+    }
+
+    // stamp received datagrams in the kernel, see FrameMeta::kernel_time
+    void set_timestamping(TimestampMode mode)
+    {
+        timestamp_mode = mode;
+        if (this->is_open && !this->closed() && enable_timestamping(sockfd, mode) < 0)
+        {
+            auto &logger = *logging::get_logger("transport");
+            logger.raise_from_errno("failed to enable timestamping");
+        }
+    }
+
 protected:
     void send_backend() override
     {
         // this->ensure_open();
         auto& logger = *logging::get_logger("transport");
         logger.debug("start datagram send backend");
+        logging::RateLimiter error_limit;
         while (!this->is_closed)
         {
-            auto frame_pair = this->send_que.Pop();
-            auto frame = frame_pair.first;
+            auto frame_pair = this->pop_send();
+            auto& frame = frame_pair.first;
             if (!P::frame_size(frame))
+            {
+                this->complete_send(frame_pair, 0);
                 continue;
-            auto token = dynamic_cast<UnixDatagramTransportToken *>((frame_pair.second.get()));
+            }
+            auto token = token_cast<UnixDatagramTransportToken>(frame_pair.second.get());
+            if (frame_pair.second && !token)
+            {
+                error_limit.log(logger, logging::LogLevel::WARN, "token without a peer address, sending to the connected address");
+            }
             struct sockaddr* addr = (struct sockaddr *)((token) ? &token->addr : &connect_addr);
             socklen_t addr_len = (token) ? token->addr_len : sizeof(connect_addr);
             
+            uint64_t send_start = this->trace_clock();
             ssize_t sent_size = sendto(sockfd, P::frame_data(frame), P::frame_size(frame), 0,
                                     addr, addr_len);
+            int send_errno = errno;
+            this->trace_send(frame_pair.meta, send_start);
             logger.debug("send data %zd", sent_size);
+            this->count_send(P::frame_size(frame), sent_size);
+            this->complete_send(frame_pair, sent_size < 0 ? -send_errno : sent_size);
+            if (token)
+            {
+                token->state.count_send(P::frame_size(frame), sent_size);
+            }
             if (sent_size < 0)
             {
-                logger.error("unix udp send failed: %s", strerror(errno));
+                error_limit.log(logger, logging::LogLevel::ERROR, "unix udp send failed: %s", strerror(send_errno));
             }
             else if ((size_t)sent_size < P::frame_size(frame))
             {
-                logger.warn("sendto failed, only %zd bytes sent", sent_size);
+                error_limit.log(logger, logging::LogLevel::WARN, "sendto failed, only %zd bytes sent", sent_size);
+            }
+            if (sent_size >= 0)
+            {
+                this->capture(CaptureDirection::SENT, frame, addr, addr_len);
             }
         }
     }
@@ -156,32 +274,68 @@ protected:
         // this->ensure_open();
         auto& logger = *logging::get_logger("transport");
         logger.debug("start datagram receive backend");
+        logging::RateLimiter error_limit;
         uint8_t *buffer = new uint8_t[buffer_size];
         while (!this->is_closed)
         {
             struct sockaddr_un addr;
-            socklen_t addr_len = sizeof(addr);
-            ssize_t recv_size = recvfrom(sockfd, buffer, buffer_size, 0,
-                                        (struct sockaddr *)&addr, &addr_len);
+            // unnamed peers fill only sun_family, the rest is hashed and compared
+            memset(&addr, 0, sizeof(addr));
+            struct iovec iov = {buffer, buffer_size};
+            alignas(struct cmsghdr) char control[TRANSPORT_CMSG_BUFFER_SIZE];
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_name = &addr;
+            msg.msg_namelen = sizeof(addr);
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+            // MSG_TRUNC reports the real length of an oversized datagram
+            ssize_t recv_size = recvmsg(sockfd, &msg, MSG_TRUNC);
+            socklen_t addr_len = msg.msg_namelen;
             if (recv_size < 0)
             {
-                logger.error("unix udp recv failed: %s", strerror(errno));
+                this->count_receive_error();
+                error_limit.log(logger, logging::LogLevel::ERROR, "unix udp recv failed: %s", strerror(errno));
                 continue;
             }
+            if ((size_t)recv_size > buffer_size)
+            {
+                this->count_truncated();
+                error_limit.log(logger, logging::LogLevel::WARN, "datagram truncated (%zd > %zu bytes)", recv_size, buffer_size);
+                recv_size = buffer_size;
+            }
             logger.debug("receive data %zd", recv_size);
             ssize_t pred_size = P::pred_size(buffer, recv_size);
             if (pred_size < 0)
             {
-                logger.error("invalid frame received");
+                this->count_invalid_frame();
+                error_limit.log(logger, logging::LogLevel::ERROR, "invalid frame received");
                 continue;
             }
+            this->count_receive(recv_size);
+            FrameMeta meta;
+            meta.kernel_time = receive_timestamp(&msg, &meta.kernel_raw);
             auto frame = P::make_frame(buffer, recv_size);
-            this->recv_que.Push(std::make_pair(frame, std::make_shared<UnixDatagramTransportToken>(this, addr, addr_len)));
+            auto token = peer_table.intern(UnixDatagramTransportToken(this, addr, addr_len));
+            token->state.count_receive(recv_size);
+            this->deliver(std::move(frame), std::move(token), meta);
         }
         delete[] buffer;
     }
 
 private:
+    void set_filter(std::vector<struct sock_filter> program)
+    {
+        filter_program = std::move(program);
+        if (this->is_open && !this->closed() && attach_socket_filter(sockfd, filter_program) < 0)
+        {
+            auto &logger = *logging::get_logger("transport");
+            logger.raise_from_errno("failed to attach socket filter");
+        }
+    }
+
     static void set_sock_path(const std::string& path, struct sockaddr_un& result)
     {
         if (path.size() + 1 >= sizeof(result.sun_path))
@@ -211,6 +365,9 @@ private:
     struct sockaddr_un bind_addr;
     struct sockaddr_un connect_addr;
     size_t buffer_size;
+    TimestampMode timestamp_mode;
+    std::vector<struct sock_filter> filter_program;
+    PeerTable<UnixDatagramTransportToken> peer_table;
 };
 
 }
@@ -227,4 +384,13 @@ namespace std {
         }
     };
 }
+
+namespace transport {
+
+inline size_t UnixDatagramTransportToken::peer_hash() const
+{
+    return std::hash<UnixDatagramTransportToken>()(*this);
+}
+
+}
 #endif
\ No newline at end of file
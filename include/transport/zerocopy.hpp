@@ -0,0 +1,184 @@
+#ifndef _INCLUDE_TRANSPORT_ZEROCOPY_
+#define _INCLUDE_TRANSPORT_ZEROCOPY_
+
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <string.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <linux/errqueue.h>
+#include <atomic>
+#include <deque>
+#include <utility>
+
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+
+// below this size the page pinning costs more than the copy
+#define TRANSPORT_ZEROCOPY_THRESHOLD 16 * 1024
+// frames waiting for the kernel before the send backend blocks
+#define TRANSPORT_ZEROCOPY_MAX_PENDING 256
+#define TRANSPORT_ZEROCOPY_CMSG_SIZE 128
+
+namespace transport
+{
+
+struct ZeroCopyStats
+{
+    uint64_t sent;          // frames sent with MSG_ZEROCOPY
+    uint64_t completed;     // frames released by the kernel
+    uint64_t copied;        // completed, but the kernel fell back to copying
+    uint64_t fallback;      // sent with a plain copy, e.g. on ENOBUFS
+    size_t pending;         // frames still held for the kernel
+};
+
+// returns the setsockopt result
+static inline int enable_zerocopy(int sockfd)
+{
+    int on = 1;
+    return setsockopt(sockfd, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on));
+}
+
+/*
+ * Keeps frames sent with MSG_ZEROCOPY alive until the kernel reports on the
+ * socket error queue that it no longer reads their pages. The kernel numbers
+ * zerocopy sends from 0 and completes them in ranges. The frame is moved in,
+ * so its data must stay in place when moved, as in a std::vector; only the
+ * send backend uses the tracker, stats() may be called from any thread.
+ */
+template <typename F>
+class ZeroCopyTracker
+{
+public:
+    ZeroCopyTracker() : next_seq(0)
+    {
+        for (auto& counter : counters)
+            counter.store(0, std::memory_order_relaxed);
+        pending_size.store(0, std::memory_order_relaxed);
+    }
+    ZeroCopyTracker(const ZeroCopyTracker&) = delete;
+
+    // after a successful sendmsg with MSG_ZEROCOPY
+    void hold(F frame)
+    {
+        pending.push_back(Entry{next_seq++, false, std::move(frame)});
+        counters[SENT].fetch_add(1, std::memory_order_relaxed);
+        pending_size.store(pending.size(), std::memory_order_relaxed);
+    }
+
+    // a frame of the zerocopy size that went out with a copy
+    void count_fallback()
+    {
+        counters[FALLBACK].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    size_t size() const
+    {
+        return pending.size();
+    }
+
+    // for a new socket, the kernel numbers its sends from 0 again
+    void reset()
+    {
+        pending.clear();
+        next_seq = 0;
+        pending_size.store(0, std::memory_order_relaxed);
+    }
+
+    // read the completions already queued, without blocking
+    void drain(int sockfd)
+    {
+        alignas(struct cmsghdr) char control[TRANSPORT_ZEROCOPY_CMSG_SIZE];
+        while (!pending.empty())
+        {
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+            if (recvmsg(sockfd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+                break;
+            for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+            {
+                if (!((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) ||
+                      (cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)))
+                    continue;
+                struct sock_extended_err err;
+                memcpy(&err, CMSG_DATA(cmsg), sizeof(err));
+                if (err.ee_errno != 0 || err.ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                    continue;
+                complete(err.ee_info, err.ee_data, err.ee_code & SO_EE_CODE_ZEROCOPY_COPIED);
+            }
+        }
+        pending_size.store(pending.size(), std::memory_order_relaxed);
+    }
+
+    // wait until a completion arrives or `timeout_ms` passed, then drain
+    void wait(int sockfd, int timeout_ms)
+    {
+        // the error queue is signalled with POLLERR, which needs no request
+        struct pollfd pfd = {sockfd, 0, 0};
+        poll(&pfd, 1, timeout_ms);
+        drain(sockfd);
+    }
+
+    ZeroCopyStats stats() const
+    {
+        ZeroCopyStats stats;
+        stats.sent = counters[SENT].load(std::memory_order_relaxed);
+        stats.completed = counters[COMPLETED].load(std::memory_order_relaxed);
+        stats.copied = counters[COPIED].load(std::memory_order_relaxed);
+        stats.fallback = counters[FALLBACK].load(std::memory_order_relaxed);
+        stats.pending = pending_size.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+private:
+    enum Counter
+    {
+        SENT,
+        COMPLETED,
+        COPIED,
+        FALLBACK,
+        COUNTER_COUNT
+    };
+
+    struct Entry
+    {
+        uint32_t seq;
+        bool done;
+        F frame;
+    };
+
+    // sends lo..hi (inclusive, wrapping) are done, release the finished prefix
+    void complete(uint32_t lo, uint32_t hi, bool copied)
+    {
+        uint32_t count = hi - lo + 1;
+        for (uint32_t i = 0; i < count && !pending.empty(); ++i)
+        {
+            uint32_t index = lo + i - pending.front().seq;
+            if (index < pending.size() && !pending[index].done)
+            {
+                pending[index].done = true;
+                counters[COMPLETED].fetch_add(1, std::memory_order_relaxed);
+                if (copied)
+                    counters[COPIED].fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        while (!pending.empty() && pending.front().done)
+            pending.pop_front();
+    }
+
+    std::deque<Entry> pending;
+    uint32_t next_seq;
+    std::atomic<uint64_t> counters[COUNTER_COUNT];
+    std::atomic<size_t> pending_size;
+};
+
+}
+
+#endif
@@ -0,0 +1,79 @@
+#!/usr/bin/python3
+
+import json
+import os
+import platform
+import sys
+from argparse import ArgumentParser
+from glob import glob
+from statistics import median
+from subprocess import run
+from time import time
+from typing import Dict, List
+
+
+__version__ = "0.1.0"
+
+
+def run_bench(path: str, scale: float) -> List[dict]:
+    result = run([path, "--scale", str(scale)], capture_output=True)
+    if result.returncode != 0:
+        sys.stderr.write(result.stderr.decode("utf-8", "replace"))
+        raise RuntimeError(f"{path} exited with {result.returncode}")
+    return json.loads(result.stdout.decode("utf-8"))["benchmarks"]
+
+
+def collect(paths: List[str], repeat: int, scale: float) -> Dict[str, dict]:
+    """Run every executable `repeat` times, keeping all samples of each metric."""
+    benchmarks: Dict[str, dict] = {}
+    for r in range(repeat):
+        for path in paths:
+            print(f"[{r + 1}/{repeat}] {path}", file=sys.stderr)
+            for entry in run_bench(path, scale):
+                bench = benchmarks.setdefault(entry["name"], {"params": entry["params"], "metrics": {}})
+                for key, value in entry["metrics"].items():
+                    bench["metrics"].setdefault(key, []).append(value)
+    return benchmarks
+
+
+def print_summary(benchmarks: Dict[str, dict]) -> None:
+    width = max((len(name) for name in benchmarks), default=0)
+    for name, bench in benchmarks.items():
+        metrics = ", ".join(f"{k}={median(v):.4g}" for k, v in bench["metrics"].items())
+        print(f"{name.ljust(width)}  {metrics}")
+
+
+if __name__ == "__main__":
+    parser = ArgumentParser("benchmark", description="Run benchmarks and collect the results as JSON")
+    parser.add_argument("path", nargs='*', help="benchmark executables", default=["./bin/bench_*"])
+    parser.add_argument("-V", "--version", action="version", version=__version__)
+    parser.add_argument("-o", "--output", help="write the results to a JSON file")
+    parser.add_argument("-r", "--repeat", type=int, default=1, help="number of runs of each benchmark")
+    parser.add_argument("-s", "--scale", type=float, default=1.0, help="multiply the iteration counts")
+
+    namespace = parser.parse_args()
+
+    paths = []
+    for p in namespace.path:
+        if '*' in p:
+            paths.extend(sorted(glob(p)))
+        elif os.path.isfile(p):
+            paths.append(p)
+    if not paths:
+        print("no benchmark executables found", file=sys.stderr)
+        sys.exit(1)
+
+    start_time = time()
+    benchmarks = collect(paths, namespace.repeat, namespace.scale)
+    print_summary(benchmarks)
+
+    if namespace.output:
+        with open(namespace.output, 'w') as f:
+            json.dump({
+                "version": 1,
+                "platform": f"{platform.system()} {platform.machine()}",
+                "repeat": namespace.repeat,
+                "scale": namespace.scale,
+                "benchmarks": benchmarks
+            }, f, indent=2)
+    print(f"{len(benchmarks)} benchmarks in {time() - start_time:.2f}s", file=sys.stderr)
@@ -0,0 +1,204 @@
+#!/usr/bin/python3
+
+"""
+Compare two benchmark result sets written by scripts/benchmark.py.
+
+Every metric holds one sample per repeated run. A metric regresses when its
+median moved in the bad direction by more than both its relative tolerance
+and `--mad-factor` times the median absolute deviation of the samples, and
+no current sample is better than the worst baseline sample. A noisy metric
+therefore needs a larger change before it is reported. The direction comes
+from the metric name:
+
+    *_ns, *_ratio           lower is better
+    *_per_sec, *_gbps       higher is better
+
+*_ratio metrics use an absolute tolerance, since their baseline is often 0.
+Other metrics are printed but never fail the check. The baseline only means
+something on the machine it was recorded on, refresh it with
+
+    scripts/benchmark.py -r 5 -o bench/baseline.json
+"""
+
+import json
+import sys
+from argparse import ArgumentParser
+from fnmatch import fnmatchcase
+from statistics import median
+from typing import Dict, List, Optional, Tuple
+
+
+__version__ = "0.1.0"
+
+
+if sys.stdout.isatty():
+    TTY_COLOR_RED = "\033[31m"
+    TTY_COLOR_GREEN = "\033[32m"
+    TTY_COLOR_YELLOW = "\033[33m"
+    TTY_COLOR_CLEAR = "\033[0m"
+else:
+    TTY_COLOR_RED = ""
+    TTY_COLOR_GREEN = ""
+    TTY_COLOR_YELLOW = ""
+    TTY_COLOR_CLEAR = ""
+
+
+# (pattern on "<benchmark>:<metric>", tolerance), the first match wins
+DEFAULT_TOLERANCES: List[Tuple[str, float]] = [
+    ("*:*p99*_ns", 0.50),
+    ("*:*_ns", 0.25),
+    ("*:*_ratio", 0.05),
+    ("*", 0.15),
+]
+
+# normal-consistent scale of the median absolute deviation
+MAD_SCALE = 1.4826
+
+
+def direction(metric: str) -> int:
+    """1 when higher is better, -1 when lower is better, 0 when unknown."""
+    if metric.endswith("_per_sec") or metric.endswith("_gbps"):
+        return 1
+    if metric.endswith("_ns") or metric.endswith("_ratio"):
+        return -1
+    return 0
+
+
+def mad(samples: List[float]) -> float:
+    if len(samples) < 2:
+        return 0.0
+    center = median(samples)
+    return MAD_SCALE * median(abs(v - center) for v in samples)
+
+
+def tolerance_for(key: str, tolerances: List[Tuple[str, float]]) -> float:
+    for pattern, value in tolerances:
+        if fnmatchcase(key, pattern):
+            return value
+    return 0.0
+
+
+def parse_tolerance(arg: str) -> Tuple[str, float]:
+    pattern, sep, value = arg.rpartition('=')
+    if not sep:
+        return ("*", float(value))
+    return (pattern, float(value))
+
+
+def load(path: str) -> Dict[str, dict]:
+    with open(path) as f:
+        return json.load(f)["benchmarks"]
+
+
+def samples_of(value) -> List[float]:
+    return value if isinstance(value, list) else [value]
+
+
+class Comparison:
+    __slots__ = ["key", "base", "curr", "change", "status"]
+
+    def __init__(self, key: str, base: float, curr: float, change: float, status: str) -> None:
+        self.key = key
+        self.base = base
+        self.curr = curr
+        self.change = change
+        self.status = status
+
+    def __str__(self) -> str:
+        if self.status == "REGRESSED":
+            color = TTY_COLOR_RED
+        elif self.status == "improved":
+            color = TTY_COLOR_GREEN
+        elif self.status != "ok":
+            color = TTY_COLOR_YELLOW
+        else:
+            color = ""
+        return f"{self.key:<48} {self.base:>12.4g} {self.curr:>12.4g} {self.change:>+8.1%}  {color}{self.status}{TTY_COLOR_CLEAR}"
+
+
+def compare_metric(key: str, metric: str, base: List[float], curr: List[float],
+                   tolerance: float, mad_factor: float) -> Comparison:
+    base_median = median(base)
+    curr_median = median(curr)
+    change = (curr_median - base_median) / base_median if base_median else 0.0
+    sign = direction(metric)
+    if not sign:
+        return Comparison(key, base_median, curr_median, change, "info")
+
+    if metric.endswith("_ratio"):
+        allowed = tolerance
+    else:
+        allowed = tolerance * abs(base_median)
+    allowed = max(allowed, mad_factor * max(mad(base), mad(curr)))
+
+    # with several runs, the sample ranges must not overlap either
+    if sign > 0:
+        worse = max(curr) < min(base)
+        better = min(curr) > max(base)
+    else:
+        worse = min(curr) > max(base)
+        better = max(curr) < min(base)
+
+    delta = (curr_median - base_median) * sign
+    if delta < -allowed and worse:
+        status = "REGRESSED"
+    elif delta > allowed and better:
+        status = "improved"
+    else:
+        status = "ok"
+    return Comparison(key, base_median, curr_median, change, status)
+
+
+def compare(baseline: Dict[str, dict], current: Dict[str, dict], tolerances: List[Tuple[str, float]],
+            mad_factor: float, pattern: Optional[str]) -> Tuple[List[Comparison], List[str]]:
+    results = []
+    missing = []
+    for name, base in baseline.items():
+        if pattern and not fnmatchcase(name, pattern):
+            continue
+        curr = current.get(name)
+        if curr is None:
+            missing.append(name)
+            continue
+        for metric, base_samples in base["metrics"].items():
+            key = f"{name}:{metric}"
+            if metric not in curr["metrics"]:
+                missing.append(key)
+                continue
+            results.append(compare_metric(
+                key, metric, samples_of(base_samples), samples_of(curr["metrics"][metric]),
+                tolerance_for(key, tolerances), mad_factor))
+    return results, missing
+
+
+if __name__ == "__main__":
+    parser = ArgumentParser("perfcheck", description="Compare benchmark results against a baseline")
+    parser.add_argument("baseline", help="baseline JSON written by benchmark.py")
+    parser.add_argument("current", help="current JSON written by benchmark.py")
+    parser.add_argument("-V", "--version", action="version", version=__version__)
+    parser.add_argument("-t", "--tolerance", action="append", default=[], metavar="[PATTERN=]VALUE",
+                        help="tolerance for metrics matching '<benchmark>:<metric>', checked before the defaults")
+    parser.add_argument("-m", "--mad-factor", type=float, default=3.0,
+                        help="changes within this many MADs are treated as noise")
+    parser.add_argument("-k", "--filter", help="only compare benchmarks matching this pattern")
+    parser.add_argument("-v", "--verbose", action="store_true", help="print every metric, not only changes")
+    parser.add_argument("--strict", action="store_true", help="fail on benchmarks missing from the current run")
+
+    namespace = parser.parse_args()
+    tolerances = [parse_tolerance(t) for t in namespace.tolerance] + DEFAULT_TOLERANCES
+
+    results, missing = compare(load(namespace.baseline), load(namespace.current),
+                               tolerances, namespace.mad_factor, namespace.filter)
+
+    print(f"{'metric':<48} {'baseline':>12} {'current':>12} {'change':>8}")
+    for r in results:
+        if namespace.verbose or r.status in ("REGRESSED", "improved"):
+            print(r)
+    for key in missing:
+        print(f"{key:<48} {TTY_COLOR_YELLOW}missing{TTY_COLOR_CLEAR}")
+
+    regressed = [r for r in results if r.status == "REGRESSED"]
+    improved = [r for r in results if r.status == "improved"]
+    print(f"{len(results)} metrics compared: {len(regressed)} regressed, {len(improved)} improved, {len(missing)} missing")
+    if regressed or (namespace.strict and missing):
+        sys.exit(1)
@@ -0,0 +1,457 @@
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdexcept>
+#include "logging/binary.hpp"
+
+using namespace logging;
+using namespace logging::binary;
+
+struct FormatEntry
+{
+    Logger::Level level;
+    std::string fmt;
+};
+
+static std::mutex registry_mutex;
+static std::vector<FormatEntry> registry;
+static std::atomic<uint64_t> generation_counter(0);
+
+uint32_t logging::register_format(Logger::Level level, const char* fmt)
+{
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    registry.push_back(FormatEntry{level, fmt});
+    return registry.size() - 1;
+}
+
+static bool lookup_format(uint32_t fmt_id, FormatEntry& entry)
+{
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    if (fmt_id >= registry.size())
+        return false;
+    entry = registry[fmt_id];
+    return true;
+}
+
+static void raise_from_errno(const std::string& msg)
+{
+    throw std::runtime_error(msg + ": " + strerror(errno));
+}
+
+// cursor over the encoded arguments of one event
+class ArgCursor
+{
+public:
+    ArgCursor(const uint8_t* p, const uint8_t* end) : _p(p), _end(end) {}
+
+    bool empty() const { return _p >= _end; }
+    uint8_t type() const { return *_p; }
+
+    int64_t get_int()
+    {
+        if (empty()) return 0;
+        uint8_t t = *_p++;
+        if (t == ARG_STRING) {
+            skip_string();
+            return 0;
+        }
+        uint64_t v = read_u64();
+        if (t == ARG_DOUBLE) {
+            double d;
+            memcpy(&d, &v, sizeof(d));
+            return (int64_t)d;
+        }
+        return (int64_t)v;
+    }
+
+    double get_double()
+    {
+        if (empty()) return 0;
+        uint8_t t = *_p++;
+        if (t == ARG_STRING) {
+            skip_string();
+            return 0;
+        }
+        uint64_t v = read_u64();
+        if (t == ARG_DOUBLE) {
+            double d;
+            memcpy(&d, &v, sizeof(d));
+            return d;
+        }
+        return t == ARG_INT ? (double)(int64_t)v : (double)v;
+    }
+
+    std::string get_string()
+    {
+        if (empty()) return std::string();
+        if (*_p != ARG_STRING) {
+            char buf[32];
+            uint8_t t = *_p;
+            if (t == ARG_DOUBLE) {
+                snprintf(buf, sizeof(buf), "%g", get_double());
+            } else {
+                snprintf(buf, sizeof(buf), t == ARG_INT ? "%lld" : "%llu", (long long)get_int());
+            }
+            return buf;
+        }
+        ++_p;
+        uint32_t n = read_u32();
+        if (n > (size_t)(_end - _p)) n = _end - _p;
+        std::string s((const char*)_p, n);
+        _p += n;
+        return s;
+    }
+
+private:
+    uint64_t read_u64()
+    {
+        uint64_t v = 0;
+        if (_end - _p >= (ptrdiff_t)sizeof(v)) memcpy(&v, _p, sizeof(v));
+        _p += sizeof(v);
+        return v;
+    }
+
+    uint32_t read_u32()
+    {
+        uint32_t v = 0;
+        if (_end - _p >= (ptrdiff_t)sizeof(v)) memcpy(&v, _p, sizeof(v));
+        _p += sizeof(v);
+        return v;
+    }
+
+    void skip_string()
+    {
+        uint32_t n = read_u32();
+        _p += (n > (size_t)(_end - _p)) ? _end - _p : n;
+    }
+
+    const uint8_t* _p;
+    const uint8_t* _end;
+};
+
+template <typename T>
+static void append_printf(std::string& out, const std::string& spec, T value)
+{
+    char buf[64];
+    int n = snprintf(buf, sizeof(buf), spec.c_str(), value);
+    if (n < 0) return;
+    if ((size_t)n < sizeof(buf)) {
+        out.append(buf, n);
+        return;
+    }
+    std::string tmp(n + 1, '\0');
+    snprintf(&tmp[0], n + 1, spec.c_str(), value);
+    out.append(tmp.data(), n);
+}
+
+std::string binary::format(const char* fmt, size_t fmt_len, const uint8_t* args, size_t size)
+{
+    ArgCursor cursor(args, args + size);
+    std::string out;
+    const char* p = fmt;
+    const char* end = fmt + fmt_len;
+
+    while (p < end) {
+        const char* pct = static_cast<const char*>(memchr(p, '%', end - p));
+        if (!pct) {
+            out.append(p, end - p);
+            break;
+        }
+        out.append(p, pct - p);
+        const char* q = pct + 1;
+        if (q < end && *q == '%') {
+            out.push_back('%');
+            p = q + 1;
+            continue;
+        }
+
+        std::string spec("%");
+        while (q < end && strchr("-+ #0'", *q)) spec.push_back(*q++);
+        if (q < end && *q == '*') {
+            spec += std::to_string(cursor.get_int());
+            ++q;
+        } else {
+            while (q < end && isdigit((unsigned char)*q)) spec.push_back(*q++);
+        }
+        if (q < end && *q == '.') {
+            spec.push_back(*q++);
+            if (q < end && *q == '*') {
+                spec += std::to_string(cursor.get_int());
+                ++q;
+            } else {
+                while (q < end && isdigit((unsigned char)*q)) spec.push_back(*q++);
+            }
+        }
+        // arguments are always widened to 64 bits, drop the length modifier
+        while (q < end && strchr("hlLqjzt", *q)) ++q;
+        if (q >= end) {
+            out.append(pct, end - pct);
+            break;
+        }
+        char conv = *q++;
+        p = q;
+
+        switch (conv) {
+        case 'd':
+        case 'i':
+            append_printf(out, spec + "ll" + conv, (long long)cursor.get_int());
+            break;
+        case 'u':
+        case 'o':
+        case 'x':
+        case 'X':
+            append_printf(out, spec + "ll" + conv, (unsigned long long)cursor.get_int());
+            break;
+        case 'c':
+            append_printf(out, spec + conv, (int)cursor.get_int());
+            break;
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+            append_printf(out, spec + conv, cursor.get_double());
+            break;
+        case 's':
+            if (spec.size() == 1) {
+                out += cursor.get_string();
+            } else {
+                append_printf(out, spec + conv, cursor.get_string().c_str());
+            }
+            break;
+        case 'p':
+            append_printf(out, spec + conv, (void*)(uintptr_t)cursor.get_int());
+            break;
+        default:
+            out.append(pct, q - pct);
+            break;
+        }
+    }
+    return out;
+}
+
+ThreadBuffer::ThreadBuffer(const std::string& path, Logger::Clock clock, size_t chunk_size)
+    : _fd(-1), _base(nullptr), _capacity(chunk_size), _offset(sizeof(FileHeader)), _chunk_size(chunk_size)
+{
+    if (_capacity < sizeof(FileHeader))
+        _capacity = _chunk_size = 4096;
+    _fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (_fd < 0) {
+        raise_from_errno("failed to open binary log " + path);
+    }
+    if (ftruncate(_fd, _capacity) < 0) {
+        ::close(_fd);
+        raise_from_errno("failed to resize binary log " + path);
+    }
+    void* base = mmap(nullptr, _capacity, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+    if (base == MAP_FAILED) {
+        ::close(_fd);
+        raise_from_errno("failed to map binary log " + path);
+    }
+    _base = static_cast<uint8_t*>(base);
+
+    FileHeader* header = reinterpret_cast<FileHeader*>(_base);
+    memcpy(header->magic, LOGGING_BINARY_MAGIC, sizeof(header->magic));
+    header->version = LOGGING_BINARY_VERSION;
+    header->clock = static_cast<uint32_t>(clock);
+    header->committed = 0;
+}
+
+ThreadBuffer::~ThreadBuffer()
+{
+    close();
+}
+
+void ThreadBuffer::grow(size_t size)
+{
+    size_t capacity = _capacity + _chunk_size;
+    while (capacity < _offset + size)
+        capacity += _chunk_size;
+    if (ftruncate(_fd, capacity) < 0) {
+        raise_from_errno("failed to resize binary log");
+    }
+    void* base = mremap(_base, _capacity, capacity, MREMAP_MAYMOVE);
+    if (base == MAP_FAILED) {
+        raise_from_errno("failed to remap binary log");
+    }
+    _base = static_cast<uint8_t*>(base);
+    _capacity = capacity;
+}
+
+void ThreadBuffer::close()
+{
+    if (_fd < 0)
+        return;
+    munmap(_base, _capacity);
+    // drop the unused tail of the last chunk
+    if (ftruncate(_fd, _offset) < 0) {}
+    ::close(_fd);
+    _fd = -1;
+    _base = nullptr;
+}
+
+Reader::Reader(const std::string& path)
+    : _base(nullptr), _size(0), _offset(sizeof(FileHeader)), _clock(Logger::Clock::REALTIME)
+{
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        raise_from_errno("failed to open binary log " + path);
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        ::close(fd);
+        raise_from_errno("failed to stat binary log " + path);
+    }
+    if ((size_t)st.st_size < sizeof(FileHeader)) {
+        ::close(fd);
+        throw std::runtime_error("binary log too short: " + path);
+    }
+    void* base = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (base == MAP_FAILED) {
+        raise_from_errno("failed to map binary log " + path);
+    }
+    _base = static_cast<uint8_t*>(base);
+    _size = st.st_size;
+
+    const FileHeader* header = reinterpret_cast<const FileHeader*>(_base);
+    if (memcmp(header->magic, LOGGING_BINARY_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != LOGGING_BINARY_VERSION) {
+        munmap(_base, _size);
+        throw std::runtime_error("not a binary log: " + path);
+    }
+    _clock = static_cast<Logger::Clock>(header->clock);
+}
+
+Reader::~Reader()
+{
+    if (_base)
+        munmap(_base, _size);
+}
+
+bool Reader::next(Record& record)
+{
+    const FileHeader* header = reinterpret_cast<const FileHeader*>(_base);
+    size_t end = sizeof(FileHeader) + __atomic_load_n(&header->committed, __ATOMIC_ACQUIRE);
+    if (end > _size) end = _size;
+
+    while (_offset + sizeof(EventHeader) <= end) {
+        EventHeader event;
+        memcpy(&event, _base + _offset, sizeof(event));
+        const uint8_t* payload = _base + _offset + sizeof(event);
+        if (_offset + sizeof(event) + event.size > end)
+            return false;
+        _offset += sizeof(event) + event.size;
+
+        if (event.fmt_id == LOGGING_BINARY_FORMAT_RECORD) {
+            // u32 fmt_id, u8 level, u8 pad, u16 name_len, name, fmt
+            if (event.size < 8) continue;
+            uint32_t fmt_id;
+            uint16_t name_len;
+            memcpy(&fmt_id, payload, sizeof(fmt_id));
+            memcpy(&name_len, payload + 6, sizeof(name_len));
+            if (8u + name_len > event.size) continue;
+            Format& format = _formats[fmt_id];
+            format.level = static_cast<Logger::Level>(payload[4]);
+            format.name.assign((const char*)payload + 8, name_len);
+            format.fmt.assign((const char*)payload + 8 + name_len, event.size - 8 - name_len);
+            continue;
+        }
+
+        auto iter = _formats.find(event.fmt_id);
+        if (iter == _formats.end()) {
+            record = Record("", Logger::Level::ERROR,
+                            "unknown format id " + std::to_string(event.fmt_id), _clock);
+        } else {
+            const Format& f = iter->second;
+            record = Record(f.name, f.level, format(f.fmt.data(), f.fmt.size(), payload, event.size), _clock);
+        }
+        record.time = std::chrono::system_clock::time_point(
+            std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::nanoseconds(event.time)));
+        return true;
+    }
+    return false;
+}
+
+BinaryLogger::BinaryLogger(Level level)
+    : Logger(level), _open(false), _generation(0), _file_clock(Clock::REALTIME), _chunk_size(0)
+{}
+
+BinaryLogger::BinaryLogger(const std::string& name, Level level, Logger* parent)
+    : Logger(name, level, parent), _open(false), _generation(0), _file_clock(Clock::REALTIME), _chunk_size(0)
+{}
+
+BinaryLogger::~BinaryLogger()
+{
+    close();
+}
+
+void BinaryLogger::open(const std::string& path, size_t chunk_size)
+{
+    close();
+    std::lock_guard<std::mutex> lock(_mutex);
+    _path = path;
+    _chunk_size = chunk_size;
+    _file_clock = clock();
+    _generation.store(++generation_counter, std::memory_order_relaxed);
+    _open.store(true, std::memory_order_release);
+}
+
+void BinaryLogger::close()
+{
+    _open.store(false, std::memory_order_release);
+    std::lock_guard<std::mutex> lock(_mutex);
+    _buffers.clear();
+    _generation.store(++generation_counter, std::memory_order_relaxed);
+}
+
+ThreadBuffer* BinaryLogger::open_thread_buffer()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto& buffer = _buffers[std::this_thread::get_id()];
+    if (!buffer) {
+        std::string path = _path + "." + std::to_string(_buffers.size() - 1);
+        buffer.reset(new ThreadBuffer(path, _file_clock, _chunk_size));
+    }
+    return buffer.get();
+}
+
+void BinaryLogger::write_format(ThreadBuffer& buffer, uint32_t fmt_id)
+{
+    FormatEntry entry;
+    if (!lookup_format(fmt_id, entry))
+        return;
+    const std::string& logger_name = name();
+    uint16_t name_len = logger_name.size();
+    size_t size = 8 + name_len + entry.fmt.size();
+
+    uint8_t* p = buffer.reserve(sizeof(EventHeader) + size);
+    EventHeader header = {LOGGING_BINARY_FORMAT_RECORD, (uint32_t)size, 0};
+    memcpy(p, &header, sizeof(header));
+    p += sizeof(header);
+    memcpy(p, &fmt_id, sizeof(fmt_id));
+    p[4] = static_cast<uint8_t>(entry.level);
+    p[5] = 0;
+    memcpy(p + 6, &name_len, sizeof(name_len));
+    memcpy(p + 8, logger_name.data(), name_len);
+    memcpy(p + 8 + name_len, entry.fmt.data(), entry.fmt.size());
+    buffer.commit(sizeof(header) + size);
+}
+
+void BinaryLogger::log_encoded(Level level, uint32_t fmt_id, const uint8_t* args, size_t size)
+{
+    FormatEntry entry;
+    if (!lookup_format(fmt_id, entry)) {
+        log_message(Level::ERROR, "unknown format id " + std::to_string(fmt_id));
+        return;
+    }
+    log_message(level, format(entry.fmt.data(), entry.fmt.size(), args, size));
+}
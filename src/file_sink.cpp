@@ -0,0 +1,185 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdexcept>
+#include "logging/file_sink.hpp"
+
+using namespace logging;
+
+static void raise_from_errno(const std::string& msg)
+{
+    throw std::runtime_error(msg + ": " + strerror(errno));
+}
+
+MappedFileBuf::MappedFileBuf(const std::string& path, size_t max_size, unsigned max_files, size_t chunk_size)
+    : _path(path), _max_size(max_size), _max_files(max_files), _chunk_size(chunk_size),
+      _fd(-1), _base(nullptr), _capacity(0), _size(0)
+{
+    long page_size = sysconf(_SC_PAGESIZE);
+    if (_chunk_size < (size_t)page_size)
+        _chunk_size = page_size;
+    open_file();
+}
+
+MappedFileBuf::MappedFileBuf(MappedFileBuf&& other)
+    : std::streambuf(other), _path(std::move(other._path)), _max_size(other._max_size),
+      _max_files(other._max_files), _chunk_size(other._chunk_size)
+{
+    std::lock_guard<std::mutex> lock(other._mutex);
+    _fd = other._fd;
+    _base = other._base;
+    _capacity = other._capacity;
+    _size = other._size;
+    other._fd = -1;
+    other._base = nullptr;
+    other._capacity = 0;
+    other._size = 0;
+}
+
+MappedFileBuf::~MappedFileBuf()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    // nowhere to report it, the log may be missing its zero-filled tail
+    close_file();
+}
+
+void MappedFileBuf::open_file()
+{
+    _fd = ::open(_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (_fd < 0) {
+        raise_from_errno("failed to open log file " + _path);
+    }
+    struct stat st;
+    if (fstat(_fd, &st) < 0) {
+        ::close(_fd);
+        _fd = -1;
+        raise_from_errno("failed to stat log file " + _path);
+    }
+
+    _size = st.st_size;
+    _capacity = (_size / _chunk_size + 1) * _chunk_size;
+    if (ftruncate(_fd, _capacity) < 0) {
+        ::close(_fd);
+        _fd = -1;
+        raise_from_errno("failed to resize log file " + _path);
+    }
+    void* base = mmap(nullptr, _capacity, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+    if (base == MAP_FAILED) {
+        ::close(_fd);
+        _fd = -1;
+        raise_from_errno("failed to map log file " + _path);
+    }
+    _base = static_cast<char*>(base);
+
+    // a file left by a crashed process still has its zero-filled tail and
+    // maybe a torn record, keep the complete lines only
+    size_t end = _size;
+    while (_size && _base[_size - 1] != '\n')
+        --_size;
+    memset(_base + _size, 0, end - _size);
+}
+
+// 0, or -1 with errno set if the file could not be truncated to its content
+int MappedFileBuf::close_file()
+{
+    if (_fd < 0)
+        return 0;
+    munmap(_base, _capacity);
+    int ret = ftruncate(_fd, _size);
+    int error = errno;
+    ::close(_fd);
+    _fd = -1;
+    _base = nullptr;
+    _capacity = 0;
+    errno = error;
+    return ret;
+}
+
+void MappedFileBuf::grow(size_t size)
+{
+    size_t capacity = _capacity + _chunk_size;
+    while (capacity < _size + size)
+        capacity += _chunk_size;
+    if (ftruncate(_fd, capacity) < 0) {
+        raise_from_errno("failed to resize log file " + _path);
+    }
+    void* base = mremap(_base, _capacity, capacity, MREMAP_MAYMOVE);
+    if (base == MAP_FAILED) {
+        raise_from_errno("failed to remap log file " + _path);
+    }
+    _base = static_cast<char*>(base);
+    _capacity = capacity;
+}
+
+void MappedFileBuf::rotate()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    rotate_file();
+}
+
+void MappedFileBuf::rotate_file()
+{
+    if (close_file() < 0) {
+        raise_from_errno("failed to truncate log file " + _path);
+    }
+    if (_max_files) {
+        for (unsigned i = _max_files - 1; i > 0; --i) {
+            std::string from = _path + "." + std::to_string(i);
+            std::string to = _path + "." + std::to_string(i + 1);
+            rename(from.c_str(), to.c_str());
+        }
+        rename(_path.c_str(), (_path + ".1").c_str());
+    } else {
+        unlink(_path.c_str());
+    }
+    open_file();
+}
+
+void MappedFileBuf::close()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (close_file() < 0) {
+        raise_from_errno("failed to truncate log file " + _path);
+    }
+}
+
+int MappedFileBuf::overflow(int c)
+{
+    if (c == EOF)
+        return 0;
+    char ch = static_cast<char>(c);
+    return xsputn(&ch, 1) == 1 ? c : EOF;
+}
+
+std::streamsize MappedFileBuf::xsputn(const char* s, std::streamsize n)
+{
+    if (n <= 0)
+        return 0;
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_fd < 0)
+        return 0;
+    // a record boundary, or a line that already ran a chunk past max_size
+    if (_size && _size + n > _max_size && (_base[_size - 1] == '\n' || _size >= _max_size + _chunk_size)) {
+        rotate_file();
+    }
+    if (_size + n > _capacity) {
+        grow(n);
+    }
+    memcpy(_base + _size, s, n);
+    _size += n;
+    return n;
+}
+
+MappedFileStream::MappedFileStream(const std::string& path, size_t max_size, unsigned max_files, size_t chunk_size)
+    : std::ostream(&_buf), _buf(path, max_size, max_files, chunk_size)
+{}
+
+MappedFileStream::MappedFileStream(MappedFileStream&& other)
+    : std::ostream(std::move(other)), _buf(std::move(other._buf))
+{
+    set_rdbuf(&_buf);
+}
@@ -1,10 +1,9 @@
 #include <time.h>
+#include <stdio.h>
 #include <string.h>
 #include <chrono>
-#include <iomanip>
 #include <ctime>
 #include <memory>
-#include <sstream>
 #include "logging/interface.h"
 #include "logging/logger.hpp"
 
@@ -29,7 +28,7 @@ void logging::set_global_logger(std::unique_ptr<Logger>&& logger)
 }
 
 Logger::Logger(const std::string& name, Level level, Logger* parent)
-    : _parent(parent), _level(level)
+    : _parent(parent), _level(level), _clock(parent ? parent->_clock : Clock::REALTIME)
 {
     if (parent && !parent->_name.empty()) {
         _name = parent->_name + namesep + name;
@@ -64,7 +63,7 @@ void Logger::log_message(Level level, const std::string& msg)
     if (level < this->level())
         return;
         
-    auto record = Record(name(), level, msg);
+    auto record = Record(name(), level, msg, _clock);
     log_record(record);
 }
 
@@ -86,24 +85,13 @@ void Logger::log_record(const Record& record)
 
 void Logger::write_record(std::ostream& os, const Record& record)
 {
-    auto now = record.time;
-
-    // 转换为时间_t 类型
-    std::time_t now_c = std::chrono::system_clock::to_time_t(now);
-
-    // 获取毫秒部分
-    auto milliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()) % 1000;
-
-    // 格式化时间
-    std::stringstream ss;
-    std::tm *tm_now = std::localtime(&now_c);
-    ss << std::put_time(tm_now, "%Y-%m-%d %H:%M:%S")
-              << ',' << std::setfill('0') << std::setw(3) << milliseconds.count();
-    if (record.name.empty()) {
-        os << ss.str() << " [" << record.level << "] " << record.msg << std::endl;
-    } else {
-        os << ss.str() << " [" << record.name << "] [" << record.level << "] " << record.msg << std::endl;
-    }
+    // one thread_local line buffer, so the record reaches the stream in a
+    // single write instead of one per operator<<
+    static thread_local std::string line;
+    line.clear();
+    format_record(line, record);
+    os.write(line.data(), line.size());
+    os.flush();
 }
 
 LoggerOStream Logger::operator[](Logger::Level level)
@@ -180,10 +168,81 @@ void LoggerStreamBuf::flush_line() {
     }
 }
 
-Record::Record(const std::string& name, Logger::Level level, const std::string& msg)
-    : name(name), time(std::chrono::system_clock::now()), level(level), msg(msg)
+static std::chrono::system_clock::time_point record_time(Logger::Clock clock)
+{
+    if (clock == Logger::Clock::MONOTONIC) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        auto since_boot = std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec);
+        return std::chrono::system_clock::time_point(
+            std::chrono::duration_cast<std::chrono::system_clock::duration>(since_boot));
+    }
+    return std::chrono::system_clock::now();
+}
+
+Record::Record(const std::string& name, Logger::Level level, const std::string& msg, Logger::Clock clock)
+    : name(name), time(record_time(clock)), level(level), clock(clock), msg(msg)
 {}
 
+// "YYYY-mm-dd HH:MM:SS" only changes once a second, so each thread keeps the
+// last formatted prefix and only calls localtime_r when the second rolls over
+struct TimePrefixCache
+{
+    std::time_t sec;
+    char prefix[32];
+    size_t len;
+
+    TimePrefixCache() : sec(-1), len(0) {}
+};
+
+static void format_time(std::string& line, const Record& record)
+{
+    auto since_epoch = record.time.time_since_epoch();
+    auto secs = std::chrono::duration_cast<std::chrono::seconds>(since_epoch);
+    char buf[32];
+
+    if (record.clock == Logger::Clock::MONOTONIC) {
+        auto micros = std::chrono::duration_cast<std::chrono::microseconds>(since_epoch - secs);
+        int n = snprintf(buf, sizeof(buf), "%lld.%06lld",
+                         (long long)secs.count(), (long long)micros.count());
+        line.append(buf, n);
+        return;
+    }
+
+    static thread_local TimePrefixCache cache;
+    std::time_t now_c = std::chrono::system_clock::to_time_t(record.time);
+    if (now_c != cache.sec) {
+        struct tm tm_now;
+        localtime_r(&now_c, &tm_now);
+        cache.len = strftime(cache.prefix, sizeof(cache.prefix), "%Y-%m-%d %H:%M:%S", &tm_now);
+        cache.sec = now_c;
+    }
+    line.append(cache.prefix, cache.len);
+
+    auto millis = std::chrono::duration_cast<std::chrono::milliseconds>(since_epoch - secs).count();
+    if (millis < 0) millis += 1000;
+    buf[0] = ',';
+    buf[1] = '0' + millis / 100;
+    buf[2] = '0' + millis / 10 % 10;
+    buf[3] = '0' + millis % 10;
+    line.append(buf, 4);
+}
+
+void logging::format_record(std::string& line, const Record& record)
+{
+    format_time(line, record);
+    if (!record.name.empty()) {
+        line.append(" [");
+        line.append(record.name);
+        line.push_back(']');
+    }
+    line.append(" [");
+    line.append(level2str(record.level));
+    line.append("] ");
+    line.append(record.msg);
+    line.push_back('\n');
+}
+
 LogLevel logging::str2level(const char* level)
 {
     if (!level) return Logger::Level::INFO;
@@ -196,24 +255,29 @@ LogLevel logging::str2level(const char* level)
     return Logger::Level::UNKNOWN;
 }
 
-std::ostream& logging::operator<<(std::ostream& stream, const LogLevel level)
+const char* logging::level2str(LogLevel level)
 {
     switch (level) {
     case Logger::Level::DEBUG:
-        return stream << "DEBUG";
+        return "DEBUG";
     case Logger::Level::INFO:
-        return stream << "INFO";
+        return "INFO";
     case Logger::Level::WARN:
-        return stream << "WARN";
+        return "WARN";
     case Logger::Level::ERROR:
-        return stream << "ERROR";
+        return "ERROR";
     case Logger::Level::FATAL:
-        return stream << "FATAL";
+        return "FATAL";
     default:
-        return stream << "UNKNOWN";
+        return "UNKNOWN";
     }
 }
 
+std::ostream& logging::operator<<(std::ostream& stream, const LogLevel level)
+{
+    return stream << level2str(level);
+}
+
 void log_init(const char* level)
 {
     if (level == NULL || *level == '\0') {
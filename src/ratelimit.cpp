@@ -0,0 +1,65 @@
+#include <stdio.h>
+#include <string>
+#include "logging/ratelimit.hpp"
+
+using namespace logging;
+
+RateLimiter::RateLimiter(double rate, uint32_t burst)
+    : _tat(0), _suppressed(0), _logger(nullptr), _level(0)
+{
+    if (!burst)
+        burst = 1;
+    // keep interval * burst, and the arrival times built from it, far from
+    // overflowing; at this interval a bucket never refills in practice
+    int64_t max_interval = INT64_MAX / 4 / burst;
+    double interval = rate > 0 ? 1e9 / rate : (double)max_interval;
+    _interval = interval < (double)max_interval ? (int64_t)interval : max_interval;
+    _limit = _interval * burst;
+}
+
+RateLimiter::~RateLimiter()
+{
+    uint64_t suppressed = _suppressed.load(std::memory_order_relaxed);
+    Logger* logger = _logger.load(std::memory_order_relaxed);
+    if (!suppressed || !logger)
+        return;
+    logger->log_message(static_cast<Logger::Level>(_level.load(std::memory_order_relaxed)),
+                        "suppressed " + std::to_string(suppressed) + " messages");
+}
+
+void RateLimiter::log(Logger& logger, Logger::Level level, const char* fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    vlog(logger, level, fmt, args);
+    va_end(args);
+}
+
+void RateLimiter::vlog(Logger& logger, Logger::Level level, const char* fmt, va_list args)
+{
+    // filtered messages should not use up the budget
+    if (level < logger.level())
+        return;
+    _logger.store(&logger, std::memory_order_relaxed);
+    _level.store(static_cast<int>(level), std::memory_order_relaxed);
+    uint64_t suppressed;
+    if (!acquire(suppressed))
+        return;
+    if (!suppressed) {
+        logger.vlog(level, fmt, args);
+        return;
+    }
+
+    va_list args2;
+    va_copy(args2, args);
+    int size = vsnprintf(nullptr, 0, fmt, args2);
+    va_end(args2);
+    if (size < 0)
+        return;
+
+    std::string msg(size + 1, '\0');
+    vsnprintf(&msg[0], size + 1, fmt, args);
+    msg.resize(size);
+    msg += " (suppressed " + std::to_string(suppressed) + " messages)";
+    logger.log_message(level, msg);
+}
@@ -1,3 +1,4 @@
+#include <set>
 #include "transport/base.hpp"
 #include "transport/protocol.hpp"
 #include "c_testcase.h"
@@ -16,6 +17,59 @@ protected:
     void receive_backend() override {}
 };
 
+// echo through the backend helpers, like a real transport would
+class EchoTransport: public BaseTransport<Protocol> {
+protected:
+    void send_backend() override {
+        while (!is_closed) {
+            FrameEntry entry = send_que.Pop();
+            uint64_t start = trace_clock();
+            trace_send(entry.meta, start);
+            deliver(std::move(entry.first), std::move(entry.second));
+        }
+    }
+
+    void receive_backend() override {}
+};
+
+// echo that holds the send backend until released, so a backlog can build
+class GatedTransport: public BaseTransport<Protocol> {
+public:
+    std::atomic<bool> gate{false};
+
+protected:
+    void send_backend() override {
+        while (!gate) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        while (!is_closed) {
+            FrameEntry entry = pop_send();
+            deliver(std::move(entry.first), std::move(entry.second));
+        }
+    }
+
+    void receive_backend() override {}
+};
+
+class PeerToken: public TransportToken {
+public:
+    explicit PeerToken(_transport_base *transport) : TransportToken(transport) {}
+
+    // every PeerToken is its own peer
+    bool operator==(const TransportToken& other) const override {
+        return this == &other;
+    }
+    size_t peer_hash() const override {
+        return std::hash<const void*>()(this);
+    }
+
+    PeerState* peer_state() const override {
+        return &state;
+    }
+
+    mutable PeerState state;
+};
+
 const int timeout = 3;
 
 TEST_CASE(test_init) {
@@ -38,3 +92,366 @@ TEST_CASE(test_transport) {
     assert(t.closed());
     END_TEST;
 }
+
+TEST_CASE(test_histogram) {
+    LatencyHistogram hist;
+    for (uint64_t i = 1; i <= 1000; ++i) {
+        hist.record(i * 1000);
+    }
+    LatencySummary summary = hist.summary();
+    assert_eq(summary.count, 1000);
+    assert_eq(summary.max, 1000000);
+    assert_eq(summary.mean, 500500);
+    // log-linear buckets are accurate to 1/16
+    assert_ge(summary.p50, 500000 * 15 / 16);
+    assert_le(summary.p50, 500000 * 17 / 16);
+    assert_ge(summary.p99, 990000 * 15 / 16);
+    assert_le(summary.p99, 1000000);
+    for (uint64_t v = 0; v < (1ull << 20); v = v * 3 / 2 + 1) {
+        unsigned i = LatencyHistogram::index(v);
+        assert_le(i, LatencyHistogram::BUCKET_COUNT - 1);
+        assert_le(LatencyHistogram::midpoint(i) * 15 / 16, v);
+    }
+    END_TEST;
+}
+
+TEST_CASE(test_tracing) {
+    EchoTransport t;
+    t.open();
+    assert(!t.tracing());
+    assert_eq(t.latency(TraceStage::RECV_QUEUE).count, 0);
+
+    t.enable_tracing();
+    for (int i = 0; i < 10; ++i) {
+        t.send(std::vector<uint8_t>(10, 1));
+    }
+    for (int i = 0; i < 10; ++i) {
+        t.receive(std::chrono::seconds(timeout));
+    }
+    assert_eq(t.latency(TraceStage::SEND_QUEUE).count, 10);
+    assert_eq(t.latency(TraceStage::SEND_SYSCALL).count, 10);
+    assert_eq(t.latency(TraceStage::RECV_QUEUE).count, 10);
+
+    t.reset_latency();
+    assert_eq(t.latency(TraceStage::RECV_QUEUE).count, 0);
+    t.enable_tracing(false);
+    t.send(std::vector<uint8_t>(10, 1));
+    t.receive(std::chrono::seconds(timeout));
+    assert_eq(t.latency(TraceStage::RECV_QUEUE).count, 0);
+    t.close();
+    END_TEST;
+}
+
+TEST_CASE(test_fair_queuing) {
+    GatedTransport t;
+    t.enable_fair_queuing(1000);
+    t.open();
+    auto heavy = std::make_shared<PeerToken>(&t);
+    auto light = std::make_shared<PeerToken>(&t);
+    auto capped = std::make_shared<PeerToken>(&t);
+    capped->state.set_send_limit(3000);
+    for (int i = 0; i < 20; ++i) {
+        t.send(std::vector<uint8_t>(1000, 1), heavy);
+    }
+    t.send(std::vector<uint8_t>(1000, 2), light);
+    for (int i = 0; i < 10; ++i) {
+        t.send(std::vector<uint8_t>(1000, 3), capped);
+    }
+    t.gate = true;
+
+    // the light peer goes out in the first round, not after the backlog
+    int light_at = -1;
+    for (int i = 0; i < 24; ++i) {
+        auto data_pair = t.receive(std::chrono::seconds(timeout));
+        if (data_pair.second == light) {
+            light_at = i;
+        }
+    }
+    assert_ge(light_at, 0);
+    assert_le(light_at, 2);
+
+    // three frames fit under the cap, the rest were dropped
+    assert_eq(capped->state.stats().frames_dropped, 7);
+    assert_eq(heavy->state.stats().frames_dropped, 0);
+    assert_eq(t.stats().frames_dropped, 7);
+    assert_eq(t.stats().send_queue_depth, (size_t)0);
+    t.close();
+    END_TEST;
+}
+
+TEST_CASE(test_priority) {
+    GatedTransport t;
+    t.open();
+    for (uint8_t i = 0; i < 3; ++i) {
+        t.send(std::vector<uint8_t>{0, i}, nullptr, Priority::BULK);
+        t.send(std::vector<uint8_t>{1, i});
+    }
+    t.send(std::vector<uint8_t>{2, 0}, nullptr, Priority::CONTROL);
+    t.gate = true;
+
+    // strict: control, then normal, then bulk, each lane in order
+    const uint8_t strict[][2] = {{2, 0}, {1, 0}, {1, 1}, {1, 2}, {0, 0}, {0, 1}, {0, 2}};
+    for (auto& expected : strict) {
+        auto frame = t.receive(std::chrono::seconds(timeout)).first;
+        assert_eq(frame[0], expected[0]);
+        assert_eq(frame[1], expected[1]);
+    }
+    t.close();
+
+    // fair queuing keeps the lane order, bulk queued first still goes last
+    GatedTransport f;
+    f.enable_fair_queuing(1000);
+    f.open();
+    auto bulk_peer = std::make_shared<PeerToken>(&f);
+    auto normal_peer = std::make_shared<PeerToken>(&f);
+    for (uint8_t i = 0; i < 3; ++i) {
+        f.send(std::vector<uint8_t>{0, i}, bulk_peer, Priority::BULK);
+    }
+    for (uint8_t i = 0; i < 3; ++i) {
+        f.send(std::vector<uint8_t>{1, i}, normal_peer);
+    }
+    f.send(std::vector<uint8_t>{2, 0}, bulk_peer, Priority::CONTROL);
+    f.gate = true;
+    for (auto& expected : strict) {
+        auto frame = f.receive(std::chrono::seconds(timeout)).first;
+        assert_eq(frame[0], expected[0]);
+        assert_eq(frame[1], expected[1]);
+    }
+    f.close();
+
+    // weighted: bulk gets its share while normal frames are waiting,
+    // control still goes first
+    GatedTransport w;
+    w.set_priority_weights(1, 2);
+    w.open();
+    for (uint8_t i = 0; i < 4; ++i) {
+        w.send(std::vector<uint8_t>{0, i}, nullptr, Priority::BULK);
+        w.send(std::vector<uint8_t>{1, i});
+    }
+    w.send(std::vector<uint8_t>{2, 0}, nullptr, Priority::CONTROL);
+    w.gate = true;
+    const uint8_t weighted[] = {2, 1, 1, 0, 1, 1, 0, 0, 0};
+    for (uint8_t lane : weighted) {
+        assert_eq(w.receive(std::chrono::seconds(timeout)).first[0], lane);
+    }
+    w.close();
+
+    // the same order with fair queuing
+    GatedTransport wf;
+    wf.set_priority_weights(1, 2);
+    wf.enable_fair_queuing(1000);
+    wf.open();
+    auto peer = std::make_shared<PeerToken>(&wf);
+    for (uint8_t i = 0; i < 4; ++i) {
+        wf.send(std::vector<uint8_t>{0, i}, peer, Priority::BULK);
+        wf.send(std::vector<uint8_t>{1, i}, peer);
+    }
+    wf.send(std::vector<uint8_t>{2, 0}, peer, Priority::CONTROL);
+    wf.gate = true;
+    for (uint8_t lane : weighted) {
+        assert_eq(wf.receive(std::chrono::seconds(timeout)).first[0], lane);
+    }
+    wf.close();
+    END_TEST;
+}
+
+TEST_CASE(test_deadline) {
+    GatedTransport t;
+    t.open();
+    auto now = std::chrono::steady_clock::now();
+    t.send(std::vector<uint8_t>{1}, nullptr, Priority::NORMAL, now + std::chrono::milliseconds(1));
+    t.send(std::vector<uint8_t>{2}, nullptr, Priority::NORMAL, now + std::chrono::seconds(10));
+    for (uint8_t i = 3; i < 6; ++i) {
+        t.send_latest(7, std::vector<uint8_t>{i});
+    }
+    t.send(std::vector<uint8_t>{6});
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    t.gate = true;
+
+    // the expired frame is skipped, the coalesced ones keep the first position
+    const uint8_t expected[] = {2, 5, 6};
+    for (uint8_t value : expected) {
+        assert_eq(t.receive(std::chrono::seconds(timeout)).first[0], value);
+    }
+    assert_eq(t.stats().send_expired, 1);
+    assert_eq(t.stats().frames_coalesced, 2);
+    t.close();
+
+    // a frame that expires while pacing holds it is not sent
+    GatedTransport p;
+    p.gate = true;
+    p.open();
+    p.set_pacing(PacingConfig(0, 10, 0, 1));
+    p.send(std::vector<uint8_t>{1});
+    SendFuture late = p.send_async(std::vector<uint8_t>{2}, nullptr, Priority::NORMAL,
+                                   std::chrono::steady_clock::now() + std::chrono::milliseconds(20));
+    p.send(std::vector<uint8_t>{3});
+    assert_eq(p.receive(std::chrono::seconds(timeout)).first[0], 1);
+    assert_eq(p.receive(std::chrono::seconds(timeout)).first[0], 3);
+    assert_eq(late.get(), -ETIMEDOUT);
+    assert_eq(p.stats().send_expired, 1);
+    p.close();
+
+    // latest value frames are charged to their peer under fair queuing
+    GatedTransport f;
+    f.enable_fair_queuing();
+    f.open();
+    auto capped = std::make_shared<PeerToken>(&f);
+    capped->state.set_send_limit(100);
+    f.send_latest(1, std::vector<uint8_t>(80, 1), capped);
+    f.send_latest(2, std::vector<uint8_t>(80, 2), capped);
+    f.gate = true;
+    assert_eq(f.receive(std::chrono::seconds(timeout)).first[0], 1);
+    assert_eq(capped->state.stats().frames_dropped, 1);
+    // the dropped key is free again
+    f.send_latest(2, std::vector<uint8_t>(80, 3), capped);
+    assert_eq(f.receive(std::chrono::seconds(timeout)).first[0], 3);
+    f.close();
+
+    EchoTransport e;
+    e.open();
+    e.set_receive_ttl(std::chrono::milliseconds(5));
+    e.send(std::vector<uint8_t>{1});
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    e.send(std::vector<uint8_t>{2});
+    assert_eq(e.receive(std::chrono::seconds(timeout)).first[0], 2);
+    assert_eq(e.stats().receive_expired, 1);
+    e.close();
+    END_TEST;
+}
+
+TEST_CASE(test_pacing) {
+    GatedTransport t;
+    t.gate = true;
+    t.open();
+    // 100 KB/s with a 1 KB burst: two frames at once, then one per 5 ms
+    t.set_pacing(PacingConfig(100000, 0, 1000));
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 10; ++i) {
+        t.send(std::vector<uint8_t>(500, 1));
+    }
+    for (int i = 0; i < 10; ++i) {
+        t.receive(std::chrono::seconds(timeout));
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+    assert_ge(elapsed.count(), 35);
+    assert_ge(t.stats().frames_paced, 7);
+
+    // a peer limited to 100 frames/s, the transport no longer paced
+    t.set_pacing(PacingConfig());
+    auto peer = std::make_shared<PeerToken>(&t);
+    peer->state.set_pacing(PacingConfig(0, 100));
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 5; ++i) {
+        t.send(std::vector<uint8_t>(10, 1), peer);
+    }
+    for (int i = 0; i < 5; ++i) {
+        t.receive(std::chrono::seconds(timeout));
+    }
+    elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+    assert_ge(elapsed.count(), 35);
+    t.close();
+    END_TEST;
+}
+
+TEST_CASE(test_on_receive) {
+    EchoTransport t;
+    t.open();
+    std::atomic<int> received{0};
+    std::thread::id backend;
+    t.on_receive([&](EchoTransport::FrameEntry& entry) {
+        backend = std::this_thread::get_id();
+        received += entry.first[0];
+    });
+    t.send(std::vector<uint8_t>{3});
+    for (int i = 0; i < 300 && received != 3; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    assert_eq(received.load(), 3);
+    assert(backend != std::this_thread::get_id());
+    assert_eq(t.stats().recv_queue_depth, (size_t)0);
+
+    // on the pool, each token's frames in order
+    auto pool = std::make_shared<WorkerPool>(4);
+    auto first = std::make_shared<PeerToken>(&t);
+    auto second = std::make_shared<PeerToken>(&t);
+    std::mutex mutex;
+    std::vector<uint8_t> first_seen, second_seen;
+    t.on_receive([&](EchoTransport::FrameEntry& entry) {
+        std::lock_guard<std::mutex> lock(mutex);
+        (entry.second == first ? first_seen : second_seen).push_back(entry.first[0]);
+    }, pool, Dispatch::BY_TOKEN);
+    for (uint8_t i = 0; i < 100; ++i) {
+        t.send(std::vector<uint8_t>{i}, first);
+        t.send(std::vector<uint8_t>{i}, second);
+    }
+    auto done = [&]() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return first_seen.size() == 100 && second_seen.size() == 100;
+    };
+    for (int i = 0; i < 300 && !done(); ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    t.on_receive(nullptr);
+    pool.reset();
+    assert_eq(first_seen.size(), (size_t)100);
+    assert_eq(second_seen.size(), (size_t)100);
+    for (uint8_t i = 0; i < 100; ++i) {
+        assert_eq(first_seen[i], i);
+        assert_eq(second_seen[i], i);
+    }
+
+    // many peers spread over the workers
+    pool = std::make_shared<WorkerPool>(4);
+    std::set<std::thread::id> workers;
+    std::atomic<int> handled{0};
+    t.on_receive([&](EchoTransport::FrameEntry&) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            workers.insert(std::this_thread::get_id());
+        }
+        handled++;
+    }, pool, Dispatch::BY_TOKEN);
+    std::vector<std::shared_ptr<PeerToken>> peers;
+    for (int i = 0; i < 64; ++i) {
+        peers.push_back(std::make_shared<PeerToken>(&t));
+        t.send(std::vector<uint8_t>{1}, peers.back());
+    }
+    for (int i = 0; i < 300 && handled != 64; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    t.on_receive(nullptr);
+    pool.reset();
+    assert_eq(handled.load(), 64);
+    assert_gt(workers.size(), (size_t)1);
+
+    // back to receive()
+    t.send(std::vector<uint8_t>{7});
+    assert_eq(t.receive(std::chrono::seconds(timeout)).first[0], 7);
+    t.close();
+    END_TEST;
+}
+
+TEST_CASE(test_send_async) {
+    GatedTransport t;
+    t.open();
+    SendFuture pending = t.send_async(std::vector<uint8_t>{1});
+    assert(!pending.ready());
+    std::atomic<ssize_t> result{0};
+    t.send_async(std::vector<uint8_t>{2}, [&](ssize_t sent) { result = sent; });
+    // frames dropped with the queue are cancelled
+    t.close();
+    assert(pending.wait_for(std::chrono::seconds(timeout)));
+    assert_eq(pending.get(), -ECANCELED);
+    assert_eq(result.load(), -ECANCELED);
+
+    GatedTransport e;
+    e.gate = true;
+    e.open();
+    SendFuture expired = e.send_async(std::vector<uint8_t>{3}, nullptr, Priority::NORMAL,
+                                      std::chrono::steady_clock::now() - std::chrono::milliseconds(1));
+    assert(expired.wait_for(std::chrono::seconds(timeout)));
+    assert_eq(expired.get(), -ETIMEDOUT);
+    e.close();
+    END_TEST;
+}
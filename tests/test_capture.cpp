@@ -0,0 +1,174 @@
+#include <unistd.h>
+#include "transport/memory.hpp"
+#include "transport/replay.hpp"
+#include "transport/udp.hpp"
+#include "transport/protocol.hpp"
+#include "c_testcase.h"
+
+using namespace transport;
+
+const int timeout = 3;
+const char* capture_path = "/tmp/transport_test_capture.pcap";
+
+TEST_CASE(test_capture_memory) {
+    auto pair = MemoryTransport<Protocol>::make_pair();
+    pair.first->enable_capture(capture_path);
+    assert(pair.first->capturing());
+    pair.first->open();
+    pair.second->open();
+
+    pair.first->send(std::vector<uint8_t>{1, 2, 3});
+    auto frame_pair = pair.second->receive(std::chrono::seconds(timeout));
+    pair.second->send(std::vector<uint8_t>{4, 5}, frame_pair.second);
+    pair.first->receive(std::chrono::seconds(timeout));
+    pair.first->disable_capture();
+    pair.first->send(std::vector<uint8_t>{6});
+    pair.second->receive(std::chrono::seconds(timeout));
+
+    CaptureReader reader(capture_path);
+    CaptureRecord record;
+    assert(reader.next(record));
+    assert(record.direction == CaptureDirection::SENT);
+    assert_eq(record.size, 3);
+    assert_eq(record.data[2], 3);
+    assert(!record.addr);
+    assert(reader.next(record));
+    assert(record.direction == CaptureDirection::RECEIVED);
+    assert_eq(record.size, 2);
+    assert_eq(record.data[0], 4);
+    assert(!reader.next(record));
+    unlink(capture_path);
+    END_TEST;
+}
+
+TEST_CASE(test_capture_datagram) {
+    DatagramTransport<Protocol> server;
+    server.enable_capture(capture_path, 4 + sizeof(struct sockaddr_storage));
+    server.open();
+    server.bind("127.0.0.1", 12348);
+
+    DatagramTransport<Protocol> client;
+    client.open();
+    client.connect("127.0.0.1", 12348);
+    client.send(std::vector<uint8_t>(200, 1));
+    auto frame_pair = server.receive(std::chrono::seconds(timeout));
+    server.send(std::vector<uint8_t>{5, 6}, frame_pair.second);
+    client.receive(std::chrono::seconds(timeout));
+    server.disable_capture();
+
+    CaptureReader reader(capture_path);
+    CaptureRecord record;
+    assert(reader.next(record));
+    assert(record.direction == CaptureDirection::RECEIVED);
+    assert_eq(record.addr_len, sizeof(struct sockaddr_in));
+    struct sockaddr_in addr;
+    memcpy(&addr, record.addr, sizeof(addr));
+    assert_eq(addr.sin_family, AF_INET);
+    assert_eq(addr.sin_addr.s_addr, htonl(INADDR_LOOPBACK));
+    // the pseudo header and sockaddr_in take 20 bytes of the snaplen
+    assert_eq(record.size, 4 + sizeof(struct sockaddr_storage) - 20);
+    assert_eq(record.orig_size, 200);
+    assert(reader.next(record));
+    assert(record.direction == CaptureDirection::SENT);
+    assert_eq(record.addr_len, sizeof(struct sockaddr_in));
+    unlink(capture_path);
+    END_TEST;
+}
+
+TEST_CASE(test_capture_flush) {
+    // records reach the file while the writer is still open
+    CaptureWriter writer(capture_path, TRANSPORT_CAPTURE_SNAPLEN, 0);
+    uint8_t data[] = {7, 8};
+    writer.write(CaptureDirection::SENT, capture_now(), nullptr, 0, data, sizeof(data));
+    {
+        CaptureReader reader(capture_path);
+        CaptureRecord record;
+        assert(reader.next(record));
+        assert_eq(record.size, 2);
+        assert_eq(record.data[1], 8);
+    }
+    unlink(capture_path);
+    END_TEST;
+}
+
+TEST_CASE(test_capture_malformed) {
+    // a record claiming less than it holds is skipped
+    {
+        CaptureWriter writer(capture_path);
+        uint8_t data[] = {1, 2};
+        writer.write(CaptureDirection::RECEIVED, capture_now(), nullptr, 0, data, sizeof(data));
+        writer.write(CaptureDirection::RECEIVED, capture_now(), nullptr, 0, data, sizeof(data));
+    }
+    FILE* file = fopen(capture_path, "r+b");
+    uint32_t orig_len = 1;
+    fseek(file, sizeof(CaptureFileHeader) + offsetof(CaptureRecordHeader, orig_len), SEEK_SET);
+    fwrite(&orig_len, sizeof(orig_len), 1, file);
+    fclose(file);
+
+    CaptureReader reader(capture_path);
+    CaptureRecord record;
+    assert(reader.next(record));
+    assert_eq(record.size, 2);
+    assert_eq(record.orig_size, 2);
+    assert(!reader.next(record));
+    unlink(capture_path);
+    END_TEST;
+}
+
+TEST_CASE(test_replay) {
+    {
+        auto pair = MemoryTransport<Protocol>::make_pair();
+        pair.second->enable_capture(capture_path);
+        pair.first->open();
+        pair.second->open();
+        for (int i = 0; i < 100; ++i) {
+            pair.first->send(std::vector<uint8_t>(i + 1, i));
+            pair.second->receive(std::chrono::seconds(timeout));
+        }
+    }
+
+    ReplayTransport<Protocol> replay(capture_path);
+    replay.open();
+    for (int i = 0; i < 100; ++i) {
+        auto entry = replay.receive_entry(std::chrono::seconds(timeout));
+        assert_eq(entry.first.size(), (size_t)i + 1);
+        assert_eq(entry.first[0], i);
+        assert_ne(entry.meta.kernel_time, 0);
+        assert(entry.second);
+    }
+    try {
+        replay.receive(std::chrono::milliseconds(100));
+        assert(0);
+    } catch (const QueueTimeout&) {}
+    assert(replay.finished());
+    assert_eq(replay.stats().frames_received, 100);
+    unlink(capture_path);
+    END_TEST;
+}
+
+TEST_CASE(test_replay_timing) {
+    {
+        auto pair = MemoryTransport<Protocol>::make_pair();
+        pair.second->enable_capture(capture_path);
+        pair.first->open();
+        pair.second->open();
+        pair.first->send(std::vector<uint8_t>{1});
+        pair.second->receive(std::chrono::seconds(timeout));
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        pair.first->send(std::vector<uint8_t>{2});
+        pair.second->receive(std::chrono::seconds(timeout));
+    }
+
+    ReplayTransport<Protocol> replay(capture_path, ReplayMode::ORIGINAL);
+    replay.set_speed(2);
+    replay.open();
+    replay.receive(std::chrono::seconds(timeout));
+    auto start = std::chrono::steady_clock::now();
+    assert_eq(replay.receive(std::chrono::seconds(timeout)).first[0], 2);
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+    // 100ms captured gap at double speed
+    assert_ge(elapsed.count(), 40);
+    assert_le(elapsed.count(), 90);
+    unlink(capture_path);
+    END_TEST;
+}
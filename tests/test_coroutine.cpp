@@ -0,0 +1,168 @@
+#include "transport/coroutine.hpp"
+#include "transport/memory.hpp"
+#include "transport/protocol.hpp"
+#include "c_testcase.h"
+
+using namespace transport;
+
+const int timeout = 3;
+
+#if defined(__cpp_impl_coroutine)
+
+typedef MemoryTransport<Protocol> Memory;
+
+// wait for the coroutines from a test thread
+static bool wait_until(std::atomic<int>& counter, int value) {
+    for (int i = 0; i < timeout * 100 && counter != value; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return counter == value;
+}
+
+TEST_CASE(test_send_receive) {
+    auto pair = Memory::make_pair();
+    pair.first->open();
+    pair.second->open();
+    Reactor reactor(2);
+    AsyncTransport<Memory> client(*pair.first, reactor);
+    AsyncTransport<Memory> server(*pair.second, reactor);
+
+    std::atomic<int> done{0};
+    std::atomic<ssize_t> sent{0};
+    std::atomic<int> received{0};
+    reactor.spawn([&]() -> Task<> {
+        auto [frame, token] = co_await server.async_receive(std::chrono::seconds(timeout));
+        received = frame[0];
+        done++;
+    });
+    reactor.spawn([&]() -> Task<> {
+        std::vector<uint8_t> frame = {0x05, 0x06};
+        sent = co_await client.async_send(std::move(frame));
+        done++;
+    });
+    assert(wait_until(done, 2));
+    assert_eq(sent.load(), 2);
+    assert_eq(received.load(), 5);
+    END_TEST;
+}
+
+TEST_CASE(test_timeout) {
+    auto pair = Memory::make_pair();
+    pair.first->open();
+    pair.second->open();
+    Reactor reactor;
+    AsyncTransport<Memory> client(*pair.first, reactor);
+
+    std::atomic<int> done{0};
+    std::atomic<bool> timed_out{false};
+    reactor.spawn([&]() -> Task<> {
+        try {
+            co_await client.async_receive(std::chrono::milliseconds(50));
+        } catch (const QueueTimeout&) {
+            timed_out = true;
+        }
+        co_await reactor.sleep_for(std::chrono::milliseconds(10));
+        done++;
+    });
+    assert(wait_until(done, 1));
+    assert(timed_out.load());
+
+    // a waiter for another peer neither takes the frame nor keeps waiting
+    AsyncTransport<Memory> server(*pair.second, reactor);
+    auto stranger = std::make_shared<TransportToken>(pair.second.get());
+    std::atomic<int> received{0};
+    timed_out = false;
+    reactor.spawn([&]() -> Task<> {
+        std::vector<uint8_t> frame = {0x09};
+        co_await server.async_send(std::move(frame));
+        try {
+            co_await client.async_receive(stranger, std::chrono::milliseconds(50));
+        } catch (const QueueTimeout&) {
+            timed_out = true;
+        }
+        auto [reply, token] = co_await client.async_receive(std::chrono::seconds(timeout));
+        received = reply[0];
+        done++;
+    });
+    assert(wait_until(done, 2));
+    assert(timed_out.load());
+    assert_eq(received.load(), 9);
+    END_TEST;
+}
+
+TEST_CASE(test_mailbox_limit) {
+    auto pair = Memory::make_pair();
+    pair.first->open();
+    pair.second->open();
+    Reactor reactor;
+    AsyncTransport<Memory> client(*pair.first, reactor);
+    client.set_mailbox_limit(2);
+
+    // nobody waits, only the newest frames are kept
+    for (uint8_t i = 0; i < 5; ++i) {
+        pair.second->send(std::vector<uint8_t>{i});
+    }
+    for (int i = 0; i < timeout * 100 && client.mailbox_dropped() != 3; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    assert_eq(client.mailbox_dropped(), 3);
+
+    std::atomic<int> done{0};
+    std::vector<uint8_t> received;
+    reactor.spawn([&]() -> Task<> {
+        for (int i = 0; i < 2; ++i) {
+            auto [frame, token] = co_await client.async_receive(std::chrono::seconds(timeout));
+            received.push_back(frame[0]);
+        }
+        done++;
+    });
+    assert(wait_until(done, 1));
+    assert_eq(received.size(), (size_t)2);
+    assert_eq(received[0], 3);
+    assert_eq(received[1], 4);
+    END_TEST;
+}
+
+TEST_CASE(test_request) {
+    auto pair = Memory::make_pair();
+    pair.first->open();
+    pair.second->open();
+    Reactor reactor(2);
+    AsyncTransport<Memory> client(*pair.first, reactor);
+    AsyncTransport<Memory> server(*pair.second, reactor);
+
+    // many conversations, one echo server, two threads
+    const int count = 200;
+    std::atomic<int> done{0};
+    std::atomic<int> replies{0};
+    reactor.spawn([&]() -> Task<> {
+        for (int i = 0; i < count; ++i) {
+            auto [frame, token] = co_await server.async_receive();
+            frame.push_back(0xff);
+            co_await server.async_send(std::move(frame), token);
+        }
+        done++;
+    });
+    reactor.spawn([&]() -> Task<> {
+        for (int i = 0; i < count; ++i) {
+            std::vector<uint8_t> request(1, static_cast<uint8_t>(i));
+            std::vector<uint8_t> reply = co_await client.async_request(
+                std::move(request), 1, std::chrono::seconds(timeout));
+            if (reply.size() == 2 && reply[0] == static_cast<uint8_t>(i) && reply[1] == 0xff)
+                replies++;
+        }
+        done++;
+    });
+    assert(wait_until(done, 2));
+    assert_eq(replies.load(), count);
+    END_TEST;
+}
+
+#else
+
+TEST_CASE(test_coroutine) {
+    // built without C++20 coroutines
+    SKIP_TEST;
+}
+
+#endif
@@ -36,5 +36,279 @@ TEST_CASE(test_send_recv) {
     assert_eq(frame2[1], 0x03);
     assert_eq(frame2[2], 0x02);
     assert_eq(frame2[3], 0x01);
+
+    // a token subclass still addresses its peer
+    struct TaggedToken : DatagramTransportToken {
+        explicit TaggedToken(const DatagramTransportToken& token) : DatagramTransportToken(token) {}
+    };
+    auto tagged = std::make_shared<TaggedToken>(*std::static_pointer_cast<DatagramTransportToken>(token));
+    assert(*tagged == *token);
+    assert(*token == *tagged);
+    transport_server.send(std::vector<uint8_t>{0x05}, tagged);
+    auto [frame3, token3] = transport_client.receive(std::chrono::seconds(3));
+    assert_eq(frame3[0], 0x05);
+    END_TEST;
+}
+
+TEST_CASE(test_send_async) {
+    DatagramTransport<Protocol> transport_server;
+    transport_server.open();
+    transport_server.bind("127.0.0.1", 12356);
+
+    DatagramTransport<Protocol> transport_client;
+    transport_client.open();
+    transport_client.connect("127.0.0.1", 12356);
+    SendFuture future = transport_client.send_async(std::vector<uint8_t>{0x01, 0x02, 0x03});
+    assert(future.wait_for(std::chrono::seconds(3)));
+    assert_eq(future.get(), 3);
+    transport_server.receive(std::chrono::seconds(3));
+
+    std::atomic<ssize_t> result{0};
+    transport_client.send_async(std::vector<uint8_t>{0x04}, [&](ssize_t sent) { result = sent; });
+    transport_server.receive(std::chrono::seconds(3));
+    for (int i = 0; i < 100 && result == 0; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    assert_eq(result.load(), 1);
+
+    // the syscall error comes back as -errno
+    DatagramTransport<Protocol> unconnected;
+    unconnected.open();
+    SendFuture failed = unconnected.send_async(std::vector<uint8_t>{0x05});
+    assert(failed.wait_for(std::chrono::seconds(3)));
+    assert_ls(failed.get(), 0);
+    END_TEST;
+}
+
+TEST_CASE(test_stats) {
+    DatagramTransport<Protocol> transport_server(8);
+    transport_server.open();
+    transport_server.bind("127.0.0.1", 12346);
+
+    DatagramTransport<Protocol> transport_client;
+    transport_client.open();
+    transport_client.connect("127.0.0.1", 12346);
+    transport_client.send(std::vector<uint8_t>(4, 1));
+    transport_client.send(std::vector<uint8_t>(16, 2));
+
+    auto frame_pair = transport_server.receive(std::chrono::seconds(3));
+    assert_eq(frame_pair.first.size(), 4);
+    frame_pair = transport_server.receive(std::chrono::seconds(3));
+    assert_eq(frame_pair.first.size(), 8);
+
+    // the send backend counts a frame after sendto returns
+    TransportStats client_stats = transport_client.stats();
+    for (int i = 0; i < 100 && client_stats.frames_sent < 2; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        client_stats = transport_client.stats();
+    }
+    assert_eq(client_stats.frames_sent, 2);
+    assert_eq(client_stats.bytes_sent, 20);
+    assert_eq(client_stats.send_errors, 0);
+    assert_ge(client_stats.send_queue_high_water, 1);
+
+    TransportStats server_stats = transport_server.stats();
+    assert_eq(server_stats.frames_received, 2);
+    assert_eq(server_stats.bytes_received, 12);
+    assert_eq(server_stats.truncated, 1);
+    assert_eq(server_stats.invalid_frames, 0);
+    assert_eq(server_stats.recv_queue_depth, 0);
+
+    transport_server.reset_stats();
+    server_stats = transport_server.stats();
+    assert_eq(server_stats.frames_received, 0);
+    assert_eq(server_stats.recv_queue_high_water, 0);
+    END_TEST;
+}
+
+TEST_CASE(test_kernel_timestamp) {
+    DatagramTransport<Protocol> transport_server;
+    transport_server.set_timestamping(TimestampMode::SOFTWARE);
+    transport_server.open();
+    transport_server.bind("127.0.0.1", 12347);
+
+    DatagramTransport<Protocol> transport_client;
+    transport_client.open();
+    transport_client.connect("127.0.0.1", 12347);
+    transport_client.send(std::vector<uint8_t>{0x01, 0x02});
+
+    auto entry = transport_server.receive_entry(std::chrono::seconds(3));
+    assert_eq(entry.first.size(), 2);
+    uint64_t now = timespec_ns({time(nullptr), 0});
+    assert_gt(entry.meta.kernel_time, now - 5000000000ull);
+    assert_ls(entry.meta.kernel_time, now + 5000000000ull);
+
+    transport_server.set_timestamping(TimestampMode::NONE);
+    transport_client.send(std::vector<uint8_t>{0x03});
+    entry = transport_server.receive_entry(std::chrono::seconds(3));
+    assert_eq(entry.meta.kernel_time, 0);
+    END_TEST;
+}
+
+TEST_CASE(test_multicast) {
+    const char* group = "239.255.0.42";
+    DatagramTransport<Protocol> subscribers[2];
+    try {
+        for (auto& subscriber : subscribers) {
+            subscriber.set_reuse_address(true);
+            subscriber.open();
+            subscriber.bind("", 12351);
+            subscriber.join_group(group, "127.0.0.1");
+        }
+    } catch (const std::runtime_error&) {
+        // no multicast on this host
+        SKIP_TEST;
+    }
+
+    DatagramTransport<Protocol> publisher;
+    publisher.set_multicast_interface("127.0.0.1");
+    publisher.set_multicast_ttl(1);
+    publisher.set_multicast_loopback(true);
+    publisher.open();
+    publisher.connect(group, 12351);
+    publisher.send(std::vector<uint8_t>{0x01, 0x02});
+
+    // one send, every subscriber gets it
+    for (auto& subscriber : subscribers) {
+        auto [frame, token] = subscriber.receive(std::chrono::seconds(3));
+        assert_eq(frame.size(), 2);
+        assert_eq(frame[1], 0x02);
+    }
+
+    subscribers[1].leave_group(group, "127.0.0.1");
+    publisher.send(std::vector<uint8_t>{0x03});
+    assert_eq(subscribers[0].receive(std::chrono::seconds(3)).first[0], 0x03);
+    bool received = true;
+    try {
+        subscribers[1].receive(std::chrono::milliseconds(200));
+    } catch (const QueueTimeout&) {
+        received = false;
+    }
+    assert(!received);
+    // counted after the syscall, by now certainly done
+    assert_eq(publisher.stats().frames_sent, 2);
+    END_TEST;
+}
+
+TEST_CASE(test_filter) {
+    DatagramTransport<Protocol> transport_server;
+    SocketFilter filter;
+    // magic 0xaa 0x55, 4 to 64 bytes, little endian payload length at byte 2
+    filter.magic("\xaa\x55", 2).length(4, 64).length_field(2, 2, 0, 60);
+    transport_server.attach_filter(filter);
+    transport_server.open();
+    transport_server.bind("127.0.0.1", 12352);
+
+    DatagramTransport<Protocol> transport_client;
+    transport_client.open();
+    transport_client.connect("127.0.0.1", 12352);
+    transport_client.send(std::vector<uint8_t>{0x00, 0x55, 0x00, 0x00});
+    transport_client.send(std::vector<uint8_t>{0xaa, 0x55, 0x04, 0x00, 0x01, 0x02, 0x03, 0x04});
+    transport_client.send(std::vector<uint8_t>(100, 0xaa));
+    transport_client.send(std::vector<uint8_t>{0xaa, 0x55, 0x3d, 0x00});
+    transport_client.send(std::vector<uint8_t>{0xaa, 0x55});
+    transport_client.send(std::vector<uint8_t>{0xaa, 0x55, 0x00, 0x00, 0x09});
+
+    assert_eq(transport_server.receive(std::chrono::seconds(3)).first.size(), 8);
+    assert_eq(transport_server.receive(std::chrono::seconds(3)).first.size(), 5);
+    bool received = true;
+    try {
+        transport_server.receive(std::chrono::milliseconds(200));
+    } catch (const QueueTimeout&) {
+        received = false;
+    }
+    assert(!received);
+    assert_eq(transport_server.stats().frames_received, 2);
+
+    transport_server.detach_filter();
+    transport_client.send(std::vector<uint8_t>{0x00});
+    assert_eq(transport_server.receive(std::chrono::seconds(3)).first.size(), 1);
+    END_TEST;
+}
+
+TEST_CASE(test_zerocopy) {
+    DatagramTransport<Protocol> transport_server;
+    transport_server.open();
+    transport_server.bind("127.0.0.1", 12353);
+
+    DatagramTransport<Protocol> transport_client;
+    transport_client.set_zerocopy(16 * 1024);
+    transport_client.open();
+    transport_client.connect("127.0.0.1", 12353);
+
+    // small frames go the copying path
+    transport_client.send(std::vector<uint8_t>{0x01});
+    for (int i = 0; i < 20; ++i) {
+        transport_client.send(std::vector<uint8_t>(32 * 1024, i));
+        auto [frame, token] = transport_server.receive(std::chrono::seconds(3));
+        if (i == 0) {
+            assert_eq(frame.size(), 1);
+            frame = transport_server.receive(std::chrono::seconds(3)).first;
+        }
+        assert_eq(frame.size(), 32 * 1024);
+        assert_eq(frame[0], i);
+        assert_eq(frame[32 * 1024 - 1], i);
+    }
+
+    // every frame held for the kernel is released eventually
+    ZeroCopyStats stats;
+    for (int i = 0; i < 100; ++i) {
+        stats = transport_client.zerocopy_stats();
+        if (stats.sent + stats.fallback == 20 && stats.pending == 0 && stats.completed == stats.sent)
+            break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    }
+    assert_eq(stats.sent + stats.fallback, 20);
+    assert_eq(stats.completed, stats.sent);
+    assert_eq(stats.pending, (size_t)0);
+    END_TEST;
+}
+
+TEST_CASE(test_peers) {
+    DatagramTransport<Protocol> transport_server;
+    transport_server.open();
+    transport_server.bind("127.0.0.1", 12354);
+
+    DatagramTransport<Protocol> transport_client;
+    transport_client.open();
+    transport_client.bind("127.0.0.1", 12355);
+    transport_client.connect("127.0.0.1", 12354);
+    for (int i = 0; i < 3; ++i) {
+        transport_client.send(std::vector<uint8_t>{0x01, 0x02});
+    }
+
+    // one interned token per peer
+    auto token = transport_server.receive(std::chrono::seconds(3)).second;
+    for (int i = 0; i < 2; ++i) {
+        assert(transport_server.receive(std::chrono::seconds(3)).second == token);
+    }
+    assert_eq(transport_server.peer_count(), (size_t)1);
+    assert(transport_server.peer("127.0.0.1", 12355) == token);
+    PeerStats stats = token->peer_state()->stats();
+    assert_eq(stats.frames_received, 3);
+    assert_eq(stats.bytes_received, 6);
+    assert_gt(stats.last_received, 0);
+
+    token->peer_state()->set_user_data(std::make_shared<int>(42));
+    transport_server.send(std::vector<uint8_t>{0x03}, token);
+    transport_client.receive(std::chrono::seconds(3));
+    assert_eq(token->peer_state()->stats().frames_sent, 1);
+    assert_eq(*transport_server.peers()[0]->peer_state()->user_data<int>(), 42);
+
+    // the least recently seen peer is forgotten, equal tokens stay equal
+    transport_server.set_peer_capacity(1);
+    DatagramTransport<Protocol> other_client;
+    other_client.open();
+    other_client.connect("127.0.0.1", 12354);
+    other_client.send(std::vector<uint8_t>{0x04});
+    auto other = transport_server.receive(std::chrono::seconds(3)).second;
+    assert(other != token);
+    assert(!(*other == *token));
+    assert_eq(transport_server.peer_count(), (size_t)1);
+    transport_client.send(std::vector<uint8_t>{0x05});
+    auto again = transport_server.receive(std::chrono::seconds(3)).second;
+    assert(again != token);
+    assert(*again == *token);
+    assert_eq(again->peer_state()->stats().frames_received, 1);
     END_TEST;
 }
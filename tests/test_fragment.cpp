@@ -0,0 +1,168 @@
+#include <thread>
+#include "transport/fragment.hpp"
+#include "transport/udp.hpp"
+#include "transport/protocol.hpp"
+#include "c_testcase.h"
+
+using namespace transport;
+
+// fragments of `frame` with `chunk` payload bytes each, as sent on the wire
+static std::vector<std::vector<uint8_t>> split(const std::vector<uint8_t>& frame, uint32_t msg_id, size_t chunk) {
+    std::vector<std::vector<uint8_t>> fragments;
+    for (size_t offset = 0; offset < frame.size(); offset += chunk) {
+        size_t length = std::min(chunk, frame.size() - offset);
+        FragmentHeader header = {TRANSPORT_FRAGMENT_MAGIC, 0, msg_id, (uint32_t)offset, (uint32_t)frame.size()};
+        std::vector<uint8_t> datagram(sizeof(header));
+        header.store(datagram.data());
+        datagram.insert(datagram.end(), frame.begin() + offset, frame.begin() + offset + length);
+        fragments.push_back(datagram);
+    }
+    return fragments;
+}
+
+static std::vector<uint8_t> pattern(size_t size) {
+    std::vector<uint8_t> frame(size);
+    for (size_t i = 0; i < size; ++i) {
+        frame[i] = (uint8_t)(i * 7 + i / 251);
+    }
+    return frame;
+}
+
+TEST_CASE(test_header) {
+    // little endian on the wire
+    FragmentHeader header = {TRANSPORT_FRAGMENT_MAGIC, 0, 0x01020304, 0x10, 0x0a0b0c0d};
+    uint8_t wire[sizeof(FragmentHeader)];
+    header.store(wire);
+    const uint8_t expected[] = {0x54, 0x46, 0, 0, 4, 3, 2, 1, 0x10, 0, 0, 0, 0x0d, 0x0c, 0x0b, 0x0a};
+    assert_mem_eq(wire, expected, sizeof(expected));
+    FragmentHeader loaded = FragmentHeader::load(wire);
+    assert_eq(loaded.msg_id, 0x01020304u);
+    assert_eq(loaded.total, 0x0a0b0c0du);
+
+    // stats are valid before the first fragment
+    FragmentReassembler reassembler;
+    assert_eq(reassembler.stats().pending, (size_t)0);
+    assert_eq(reassembler.stats().memory, (size_t)0);
+
+    // a single datagram frame is returned in place
+    auto single = split(pattern(100), 1, 1000);
+    const uint8_t* frame;
+    size_t frame_size;
+    assert(reassembler.add(nullptr, 0, single[0].data(), single[0].size(), frame, frame_size));
+    assert(frame == single[0].data() + sizeof(FragmentHeader));
+    assert_eq(frame_size, (size_t)100);
+    END_TEST;
+}
+
+TEST_CASE(test_reassemble_out_of_order) {
+    FragmentReassembler reassembler;
+    auto frame = pattern(10000);
+    auto fragments = split(frame, 1, 1000);
+    std::swap(fragments[0], fragments[9]);
+    std::swap(fragments[3], fragments[6]);
+
+    std::vector<uint8_t> out;
+    for (size_t i = 0; i < fragments.size(); ++i) {
+        bool done = reassembler.add(nullptr, 0, fragments[i].data(), fragments[i].size(), out);
+        assert_eq(done, i == fragments.size() - 1);
+        if (i == 4) {
+            // a duplicate must not complete the frame with a hole
+            assert(!reassembler.add(nullptr, 0, fragments[i].data(), fragments[i].size(), out));
+        }
+    }
+    assert(out == frame);
+
+    FragmentStats stats = reassembler.stats();
+    assert_eq(stats.reassembled, 1);
+    assert_eq(stats.invalid, 1);
+    assert_eq(stats.pending, (size_t)0);
+    assert_eq(stats.memory, (size_t)0);
+    END_TEST;
+}
+
+TEST_CASE(test_reassemble_peers) {
+    FragmentReassembler reassembler;
+    struct sockaddr_in peers[2];
+    memset(peers, 0, sizeof(peers));
+    peers[0].sin_port = htons(1);
+    peers[1].sin_port = htons(2);
+    auto frame_a = pattern(3000);
+    auto frame_b = std::vector<uint8_t>(3000, 0xab);
+    // same message id from two peers
+    auto fragments_a = split(frame_a, 5, 1000);
+    auto fragments_b = split(frame_b, 5, 1000);
+
+    std::vector<uint8_t> out;
+    for (int i = 0; i < 2; ++i) {
+        assert(!reassembler.add((struct sockaddr*)&peers[0], sizeof(peers[0]), fragments_a[i].data(), fragments_a[i].size(), out));
+        assert(!reassembler.add((struct sockaddr*)&peers[1], sizeof(peers[1]), fragments_b[i].data(), fragments_b[i].size(), out));
+    }
+    assert_eq(reassembler.stats().pending, (size_t)2);
+    assert(reassembler.add((struct sockaddr*)&peers[1], sizeof(peers[1]), fragments_b[2].data(), fragments_b[2].size(), out));
+    assert(out == frame_b);
+    assert(reassembler.add((struct sockaddr*)&peers[0], sizeof(peers[0]), fragments_a[2].data(), fragments_a[2].size(), out));
+    assert(out == frame_a);
+    END_TEST;
+}
+
+TEST_CASE(test_reassemble_limits) {
+    FragmentConfig config;
+    config.max_memory = 25000;
+    config.timeout = std::chrono::milliseconds(50);
+    FragmentReassembler reassembler(config);
+    std::vector<uint8_t> out;
+
+    // larger than the whole budget
+    auto huge = split(pattern(30000), 1, 1000);
+    assert(!reassembler.add(nullptr, 0, huge[0].data(), huge[0].size(), out));
+    assert_eq(reassembler.stats().invalid, 1);
+
+    // the third frame evicts the first
+    for (uint32_t id = 2; id <= 4; ++id) {
+        auto fragments = split(pattern(10000), id, 1000);
+        assert(!reassembler.add(nullptr, 0, fragments[0].data(), fragments[0].size(), out));
+    }
+    FragmentStats stats = reassembler.stats();
+    assert_eq(stats.evicted, 1);
+    assert_eq(stats.pending, (size_t)2);
+    assert_eq(stats.memory, (size_t)20000);
+
+    // incomplete frames time out
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    auto single = split(pattern(100), 5, 1000);
+    assert(reassembler.add(nullptr, 0, single[0].data(), single[0].size(), out));
+    stats = reassembler.stats();
+    assert_eq(stats.expired, 2);
+    assert_eq(stats.pending, (size_t)0);
+    assert_eq(stats.memory, (size_t)0);
+    END_TEST;
+}
+
+TEST_CASE(test_datagram_fragmentation) {
+    DatagramTransport<Protocol> server;
+    DatagramTransport<Protocol> client;
+    server.enable_fragmentation();
+    client.enable_fragmentation();
+    server.open();
+    server.bind("127.0.0.1", 12350);
+    client.open();
+    client.connect("127.0.0.1", 12350);
+
+    // larger than any UDP datagram
+    auto frame = pattern(100000);
+    client.send(frame);
+    auto [received, token] = server.receive(std::chrono::seconds(3));
+    assert(received == frame);
+
+    server.send(std::vector<uint8_t>{0x01, 0x02}, token);
+    auto [reply, token2] = client.receive(std::chrono::seconds(3));
+    assert_eq(reply.size(), 2);
+    assert_eq(reply[1], 0x02);
+
+    FragmentStats stats = server.fragment_stats();
+    assert_eq(stats.reassembled, 1);
+    assert_eq(stats.fragments, (100000 + 1455) / 1456);
+    assert_eq(server.stats().bytes_received, 100000);
+    assert_eq(client.stats().bytes_sent, 100000);
+    END_TEST;
+}
@@ -0,0 +1,264 @@
+#include <time.h>
+#include <sstream>
+#include <fstream>
+#include <unistd.h>
+#include <thread>
+#include "logging/logger.hpp"
+#include "logging/binary.hpp"
+#include "logging/ratelimit.hpp"
+#include "logging/file_sink.hpp"
+#include "c_testcase.h"
+
+using namespace logging;
+
+TEST_CASE(test_format) {
+    Logger logger(LogLevel::DEBUG);
+    std::stringstream ss;
+    logger.add_stream(static_cast<std::ostream&>(ss));
+
+    logger.info("hello %d", 42);
+    std::string line = ss.str();
+    // "YYYY-mm-dd HH:MM:SS,mmm [INFO] hello 42\n"
+    assert_eq(line.size(), 23 + strlen(" [INFO] hello 42\n"));
+    assert_eq(line.substr(23), " [INFO] hello 42\n");
+    assert_eq(line[4], '-');
+    assert_eq(line[10], ' ');
+    assert_eq(line[19], ',');
+
+    time_t now = time(nullptr);
+    struct tm tm_now;
+    localtime_r(&now, &tm_now);
+    char date[16];
+    strftime(date, sizeof(date), "%Y-%m-%d", &tm_now);
+    assert_eq(line.substr(0, 10), date);
+    END_TEST;
+}
+
+TEST_CASE(test_format_cached) {
+    Logger logger(LogLevel::DEBUG);
+    std::stringstream ss;
+    logger.add_stream(static_cast<std::ostream&>(ss));
+
+    for (int i = 0; i < 100; ++i) {
+        logger.debug("line %d", i);
+    }
+    std::string line;
+    int count = 0;
+    while (std::getline(ss, line)) {
+        assert_eq(line.substr(23), " [DEBUG] line " + std::to_string(count));
+        ++count;
+    }
+    assert_eq(count, 100);
+    END_TEST;
+}
+
+TEST_CASE(test_monotonic_clock) {
+    Logger logger(LogLevel::INFO);
+    logger.set_clock(Logger::Clock::MONOTONIC);
+    std::stringstream ss;
+    logger.add_stream(static_cast<std::ostream&>(ss));
+
+    logger.warn("mono");
+    std::string line = ss.str();
+    auto dot = line.find('.');
+    auto space = line.find(' ');
+    assert_ne(dot, std::string::npos);
+    assert_eq(space - dot, 7);
+    assert_eq(line.substr(space), " [WARN] mono\n");
+    END_TEST;
+}
+
+TEST_CASE(test_binary_format) {
+    uint8_t buf[256];
+    const char* fmt = "%d|%5u|%x|%.2f|%s|%-4s|%%|%c";
+    size_t size = logging::binary::args_size(-7, 42u, 255, 3.14159, "str", std::string("ab"), 'z');
+    assert_le(size, sizeof(buf));
+    logging::binary::write_args(buf, -7, 42u, 255, 3.14159, "str", std::string("ab"), 'z');
+    std::string msg = logging::binary::format(fmt, strlen(fmt), buf, size);
+    assert_eq(msg, "-7|   42|ff|3.14|str|ab  |%|z");
+    END_TEST;
+}
+
+TEST_CASE(test_binary_logger) {
+    const char* path = "/tmp/transport_test_binary.log";
+    {
+        BinaryLogger logger("binary", LogLevel::INFO);
+        logger.open(path);
+        for (int i = 0; i < 10; ++i) {
+            log_binary(logger, LogLevel::INFO, "frame %d sent (%zu bytes)", i, (size_t)i * 100);
+        }
+        log_binary(logger, LogLevel::DEBUG, "filtered %d", 0);
+        std::thread([&logger] {
+            log_binary(logger, LogLevel::WARN, "from thread %s", "t1");
+        }).join();
+        logger.close();
+    }
+
+    binary::Reader reader(std::string(path) + ".0");
+    Record record("", LogLevel::UNKNOWN, "");
+    for (int i = 0; i < 10; ++i) {
+        assert(reader.next(record));
+        assert_eq(record.name, "binary");
+        assert_eq(record.level, LogLevel::INFO);
+        assert_eq(record.msg, "frame " + std::to_string(i) + " sent (" + std::to_string(i * 100) + " bytes)");
+    }
+    assert(!reader.next(record));
+
+    binary::Reader reader2(std::string(path) + ".1");
+    assert(reader2.next(record));
+    assert_eq(record.level, LogLevel::WARN);
+    assert_eq(record.msg, "from thread t1");
+    assert(!reader2.next(record));
+
+    unlink(path);
+    unlink((std::string(path) + ".0").c_str());
+    unlink((std::string(path) + ".1").c_str());
+
+    // one thread alternating between two loggers writes to both files
+    const char* other_path = "/tmp/transport_test_binary_other.log";
+    {
+        BinaryLogger first("first", LogLevel::INFO);
+        BinaryLogger second("second", LogLevel::INFO);
+        first.open(path);
+        second.open(other_path);
+        for (int i = 0; i < 4; ++i) {
+            log_binary(first, LogLevel::INFO, "first %d", i);
+            log_binary(second, LogLevel::INFO, "second %d", i);
+        }
+        first.close();
+        second.close();
+    }
+    binary::Reader first_reader(std::string(path) + ".0");
+    binary::Reader second_reader(std::string(other_path) + ".0");
+    for (int i = 0; i < 4; ++i) {
+        assert(first_reader.next(record));
+        assert_eq(record.msg, "first " + std::to_string(i));
+        assert(second_reader.next(record));
+        assert_eq(record.msg, "second " + std::to_string(i));
+    }
+    assert(!first_reader.next(record));
+    assert(!second_reader.next(record));
+    unlink((std::string(path) + ".0").c_str());
+    unlink((std::string(other_path) + ".0").c_str());
+    END_TEST;
+}
+
+TEST_CASE(test_binary_logger_text_fallback) {
+    BinaryLogger logger(LogLevel::INFO);
+    std::stringstream ss;
+    logger.add_stream(static_cast<std::ostream&>(ss));
+    log_binary(logger, LogLevel::ERROR, "not open %d", 5);
+    assert_eq(ss.str().substr(23), " [ERROR] not open 5\n");
+    END_TEST;
+}
+
+TEST_CASE(test_rate_limiter) {
+    Logger logger(LogLevel::INFO);
+    std::stringstream ss;
+    logger.add_stream(static_cast<std::ostream&>(ss));
+
+    RateLimiter limiter(20, 3);
+    for (int i = 0; i < 100; ++i) {
+        limiter.log(logger, LogLevel::ERROR, "storm %d", i);
+    }
+    assert_eq(limiter.suppressed(), 97);
+    limiter.log(logger, LogLevel::DEBUG, "filtered");
+    assert_eq(limiter.suppressed(), 97);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    limiter.log(logger, LogLevel::ERROR, "recovered");
+    assert_eq(limiter.suppressed(), 0);
+
+    std::string line;
+    std::vector<std::string> lines;
+    while (std::getline(ss, line)) {
+        lines.push_back(line.substr(23));
+    }
+    assert_eq(lines.size(), 4);
+    assert_eq(lines[2], " [ERROR] storm 2");
+    assert_eq(lines[3], " [ERROR] recovered (suppressed 97 messages)");
+
+    // a storm that stops is summarised when the limiter goes away
+    std::stringstream ss2;
+    Logger logger2(LogLevel::INFO);
+    logger2.add_stream(static_cast<std::ostream&>(ss2));
+    {
+        // rate 0: the burst passes, then nothing
+        RateLimiter stopped(0, 5);
+        for (int i = 0; i < 10; ++i) {
+            stopped.log(logger2, LogLevel::WARN, "storm %d", i);
+        }
+        assert_eq(stopped.suppressed(), 5);
+    }
+    lines.clear();
+    while (std::getline(ss2, line)) {
+        lines.push_back(line.substr(23));
+    }
+    assert_eq(lines.size(), 6);
+    assert_eq(lines[5], " [WARN] suppressed 5 messages");
+    END_TEST;
+}
+
+static std::string read_file(const std::string& path)
+{
+    std::ifstream in(path);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+TEST_CASE(test_mapped_file_sink) {
+    const std::string path = "/tmp/transport_test_sink.log";
+    unlink(path.c_str());
+    unlink((path + ".1").c_str());
+    unlink((path + ".2").c_str());
+    {
+        Logger logger(LogLevel::INFO);
+        logger.add_stream(MappedFileStream(path, 200, 2, 4096));
+        for (int i = 0; i < 10; ++i) {
+            logger.info("line %d", i);
+        }
+    }
+    // 38 bytes per line, rotated every 5 lines
+    std::string content = read_file(path);
+    assert_eq(content.size(), 5 * 38);
+    assert_eq(content.substr(content.size() - 15), " [INFO] line 9\n");
+    std::string rotated = read_file(path + ".1");
+    assert_eq(rotated.size(), 5 * 38);
+    assert_eq(rotated.substr(23, 15), " [INFO] line 0\n");
+    assert_eq(access((path + ".2").c_str(), F_OK), -1);
+
+    // output without newlines still rotates, a chunk past max_size
+    {
+        MappedFileBuf buf(path, 200, 2, 4096);
+        std::ostream os(&buf);
+        for (int i = 0; i < 100; ++i) {
+            os << std::string(100, 'x');
+        }
+        assert_le(buf.size(), (size_t)(200 + 4096 + 100));
+    }
+    size_t rotated_size = read_file(path + ".1").size();
+    assert_ge(rotated_size, (size_t)(200 + 4096));
+    assert_le(rotated_size, (size_t)(200 + 4096 + 100));
+
+    unlink(path.c_str());
+    unlink((path + ".1").c_str());
+    unlink((path + ".2").c_str());
+    END_TEST;
+}
+
+TEST_CASE(test_mapped_file_recover) {
+    const std::string path = "/tmp/transport_test_recover.log";
+    {
+        // what a crashed writer leaves behind: a torn record and a zero-filled tail
+        std::ofstream out(path, std::ios::trunc);
+        out << "first\ntorn" << std::string(100, '\0');
+    }
+    {
+        MappedFileBuf buf(path);
+        assert_eq(buf.size(), 6);
+        std::ostream os(&buf);
+        os << "second\n";
+    }
+    assert_eq(read_file(path), "first\nsecond\n");
+    unlink(path.c_str());
+    END_TEST;
+}
@@ -0,0 +1,315 @@
+#include "transport/memory.hpp"
+#include "transport/select.hpp"
+#include "transport/protocol.hpp"
+#include "c_testcase.h"
+
+using namespace transport;
+
+const int timeout = 3;
+
+static std::vector<uint8_t> numbered(uint8_t n) {
+    return std::vector<uint8_t>(4, n);
+}
+
+// indices of the frames that arrive within `wait`
+static std::vector<int> drain(MemoryTransport<Protocol>& t, std::chrono::milliseconds wait) {
+    std::vector<int> received;
+    try {
+        while (true) {
+            received.push_back(t.receive(wait).first[0]);
+        }
+    } catch (const QueueTimeout&) {}
+    return received;
+}
+
+TEST_CASE(test_send_recv) {
+    auto pair = MemoryTransport<Protocol>::make_pair();
+    pair.first->open();
+    pair.second->open();
+
+    pair.first->send(std::vector<uint8_t>{0x01, 0x02, 0x03});
+    auto [frame, token] = pair.second->receive(std::chrono::seconds(timeout));
+    assert_eq(frame.size(), 3);
+    assert_eq(frame[2], 0x03);
+    assert(token);
+
+    pair.second->send(std::vector<uint8_t>{0x04}, token);
+    auto [frame2, token2] = pair.first->receive(std::chrono::seconds(timeout));
+    assert_eq(frame2.size(), 1);
+    assert_eq(frame2[0], 0x04);
+
+    assert_eq(pair.first->stats().frames_sent, 1);
+    assert_eq(pair.second->stats().frames_received, 1);
+    assert_eq(pair.first->link_stats().delivered, 1);
+    END_TEST;
+}
+
+TEST_CASE(test_latency) {
+    MemoryLinkConfig config;
+    config.latency = std::chrono::milliseconds(50);
+    auto pair = MemoryTransport<Protocol>::make_pair(config);
+    pair.first->open();
+    pair.second->open();
+
+    auto start = std::chrono::steady_clock::now();
+    pair.first->send(numbered(1));
+    pair.second->receive(std::chrono::seconds(timeout));
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    assert_ge(std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count(), 50);
+    END_TEST;
+}
+
+TEST_CASE(test_bandwidth) {
+    MemoryLinkConfig config;
+    config.bandwidth = 1000000;
+    auto pair = MemoryTransport<Protocol>::make_pair(config);
+    pair.first->open();
+    pair.second->open();
+
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < 10; ++i) {
+        pair.first->send(std::vector<uint8_t>(10000, i));
+    }
+    for (int i = 0; i < 10; ++i) {
+        assert_eq(pair.second->receive(std::chrono::seconds(timeout)).first[0], i);
+    }
+    // 100KB at 1MB/s
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    assert_ge(std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count(), 100);
+    END_TEST;
+}
+
+TEST_CASE(test_reopen) {
+    MemoryLinkConfig config;
+    config.bandwidth = 100000;
+    auto pair = MemoryTransport<Protocol>::make_pair(config);
+    pair.first->open();
+    pair.second->open();
+
+    // close while the send backend waits for the link, then both ends again
+    pair.first->send(std::vector<uint8_t>(20000, 0xff));
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    auto start = std::chrono::steady_clock::now();
+    pair.first->close();
+    assert_ls(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count(), 100);
+    pair.first->open();
+    assert_eq(pair.second->receive(std::chrono::seconds(timeout)).first[0], 0xff);
+    pair.second->close();
+    pair.second->open();
+    for (uint8_t i = 0; i < 20; ++i) {
+        pair.first->send(numbered(i));
+    }
+    std::vector<int> received = drain(*pair.second, std::chrono::milliseconds(500));
+    assert_eq(received.size(), (size_t)20);
+    for (int i = 0; i < 20; ++i) {
+        assert_eq(received[i], i);
+    }
+    END_TEST;
+}
+
+TEST_CASE(test_loss) {
+    MemoryLinkConfig config;
+    config.loss = 0.3;
+    config.seed = 42;
+
+    std::vector<int> runs[2];
+    for (auto& received : runs) {
+        auto pair = MemoryTransport<Protocol>::make_pair(config);
+        pair.first->open();
+        pair.second->open();
+        for (int i = 0; i < 200; ++i) {
+            pair.first->send(numbered(i));
+        }
+        received = drain(*pair.second, std::chrono::milliseconds(200));
+        MemoryLinkStats stats = pair.first->link_stats();
+        assert_eq(stats.transmitted, 200);
+        assert_eq(stats.dropped + stats.delivered, 200);
+        assert_eq(stats.delivered, received.size());
+    }
+    // same seed, same frames lost
+    assert_eq(runs[0].size(), runs[1].size());
+    assert(runs[0] == runs[1]);
+    assert_gt(runs[0].size(), 100);
+    assert_ls(runs[0].size(), 180);
+    END_TEST;
+}
+
+TEST_CASE(test_duplicate) {
+    MemoryLinkConfig config;
+    config.duplicate = 1;
+    auto pair = MemoryTransport<Protocol>::make_pair(config);
+    pair.first->open();
+    pair.second->open();
+    for (int i = 0; i < 10; ++i) {
+        pair.first->send(numbered(i));
+    }
+    auto received = drain(*pair.second, std::chrono::milliseconds(200));
+    assert_eq(received.size(), 20);
+    assert_eq(pair.first->link_stats().duplicated, 10);
+    END_TEST;
+}
+
+TEST_CASE(test_reorder) {
+    MemoryLinkConfig config;
+    config.latency = std::chrono::milliseconds(20);
+    config.reorder = 0.5;
+    config.seed = 7;
+    auto pair = MemoryTransport<Protocol>::make_pair(config);
+    pair.first->open();
+    pair.second->open();
+    for (int i = 0; i < 50; ++i) {
+        pair.first->send(numbered(i));
+    }
+    auto received = drain(*pair.second, std::chrono::milliseconds(200));
+    assert_eq(received.size(), 50);
+    assert(!std::is_sorted(received.begin(), received.end()));
+    std::sort(received.begin(), received.end());
+    for (int i = 0; i < 50; ++i) {
+        assert_eq(received[i], i);
+    }
+    assert_gt(pair.first->link_stats().reordered, 0);
+    END_TEST;
+}
+
+TEST_CASE(test_handler_reentry) {
+    auto pair = MemoryTransport<Protocol>::make_pair();
+    pair.first->open();
+    pair.second->open();
+
+    // an inline handler may use the link it is delivered from
+    std::atomic<uint64_t> delivered{0};
+    pair.second->on_receive([&](MemoryTransport<Protocol>::FrameEntry&) {
+        delivered = pair.first->link_stats().delivered;
+    });
+    pair.first->send(numbered(1));
+    for (int i = 0; i < timeout * 100 && delivered != 1; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    assert_eq(delivered.load(), 1);
+
+    // and close its own endpoint
+    std::atomic<bool> closed{false};
+    pair.second->on_receive([&](MemoryTransport<Protocol>::FrameEntry&) {
+        pair.second->close();
+        closed = true;
+    });
+    pair.first->send(numbered(2));
+    for (int i = 0; i < timeout * 100 && !closed; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    assert(closed.load());
+    END_TEST;
+}
+
+TEST_CASE(test_dispatch_order) {
+    auto pair = MemoryTransport<Protocol>::make_pair();
+    pair.first->open();
+    pair.second->open();
+
+    // every frame carries a new token, the peer still keeps its order
+    auto pool = std::make_shared<WorkerPool>(4);
+    std::mutex mutex;
+    std::vector<uint8_t> seen;
+    pair.second->on_receive([&](MemoryTransport<Protocol>::FrameEntry& entry) {
+        std::lock_guard<std::mutex> lock(mutex);
+        seen.push_back(entry.first[0]);
+    }, pool, Dispatch::BY_TOKEN);
+    for (int i = 0; i < 200; ++i) {
+        pair.first->send(numbered(static_cast<uint8_t>(i)));
+    }
+    auto done = [&]() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return seen.size() == 200;
+    };
+    for (int i = 0; i < timeout * 100 && !done(); ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    pair.second->on_receive(nullptr);
+    pool.reset();
+    assert_eq(seen.size(), (size_t)200);
+    for (int i = 0; i < 200; ++i) {
+        assert_eq(seen[i], static_cast<uint8_t>(i));
+    }
+    END_TEST;
+}
+
+TEST_CASE(test_select) {
+    auto a = MemoryTransport<Protocol>::make_pair();
+    auto b = MemoryTransport<Protocol>::make_pair();
+    a.first->open();
+    a.second->open();
+    b.first->open();
+    b.second->open();
+
+    TransportSet<Protocol> set;
+    set.add(*a.second);
+    set.add(*b.second);
+    assert_eq(set.size(), 2);
+
+    bool timed_out = false;
+    try {
+        set.select(std::chrono::milliseconds(50));
+    } catch (const QueueTimeout&) {
+        timed_out = true;
+    }
+    assert(timed_out);
+
+    // a blocked select wakes as soon as any member receives
+    std::thread sender([&] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        b.first->send(numbered(7));
+    });
+    auto [transport, pair] = set.select(std::chrono::seconds(timeout));
+    sender.join();
+    assert(transport == b.second.get());
+    assert_eq(pair.first[0], 7);
+
+    // a busy member does not starve the other one
+    for (uint8_t i = 0; i < 3; ++i) {
+        a.first->send(numbered(i));
+        b.first->send(numbered(10 + i));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    BaseTransport<Protocol>* last = nullptr;
+    for (int i = 0; i < 6; ++i) {
+        auto selected = set.select(std::chrono::seconds(timeout));
+        assert(selected.first != last);
+        if (selected.first == a.second.get())
+            assert_ls(selected.second.first[0], 10);
+        else
+            assert_ge(selected.second.first[0], 10);
+        last = selected.first;
+    }
+
+    set.remove(*b.second);
+    assert_eq(set.size(), 1);
+    b.first->send(numbered(20));
+    timed_out = false;
+    try {
+        set.select(std::chrono::milliseconds(50));
+    } catch (const QueueTimeout&) {
+        timed_out = true;
+    }
+    assert(timed_out);
+
+    // closed members are skipped, and closing the last one ends a blocked select
+    set.add(*b.second);
+    b.second->close();
+    a.first->send(numbered(21));
+    auto selected = set.select(std::chrono::seconds(timeout));
+    assert(selected.first == a.second.get());
+    assert_eq(selected.second.first[0], 21);
+    std::thread closer([&] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        a.second->close();
+    });
+    bool all_closed = false;
+    try {
+        set.select();
+    } catch (const std::runtime_error&) {
+        all_closed = true;
+    }
+    closer.join();
+    assert(all_closed);
+    END_TEST;
+}
@@ -0,0 +1,193 @@
+#include "transport/memory.hpp"
+#include "transport/protocol.hpp"
+#include "transport/reliable.hpp"
+#include "transport/udp.hpp"
+#include "c_testcase.h"
+
+using namespace transport;
+
+typedef ReliableTransport<Protocol, MemoryTransport<Protocol>> ReliableMemory;
+
+const int timeout = 5;
+
+static std::vector<uint8_t> numbered(int n) {
+    std::vector<uint8_t> frame(64, 0);
+    memcpy(frame.data(), &n, sizeof(n));
+    return frame;
+}
+
+static int number_of(const std::vector<uint8_t>& frame) {
+    int n;
+    memcpy(&n, frame.data(), sizeof(n));
+    return n;
+}
+
+TEST_CASE(test_header) {
+    // little endian on the wire
+    ReliableHeader header;
+    memset(&header, 0, sizeof(header));
+    header.type = static_cast<uint8_t>(ReliableFrameType::ACK);
+    header.session = 0x11223344;
+    header.seq = 0x01020304;
+    header.ack = 0x10;
+    header.sack = 0x0a0b0c0d;
+    uint8_t wire[sizeof(ReliableHeader)];
+    header.store(wire);
+    const uint8_t expected[] = {2, 0, 0, 0, 0x44, 0x33, 0x22, 0x11, 4, 3, 2, 1,
+                                0x10, 0, 0, 0, 0x0d, 0x0c, 0x0b, 0x0a};
+    assert_mem_eq(wire, expected, sizeof(expected));
+    ReliableHeader loaded = ReliableHeader::load(wire);
+    assert_eq(loaded.type, header.type);
+    assert_eq(loaded.session, 0x11223344u);
+    assert_eq(loaded.seq, 0x01020304u);
+    assert_eq(loaded.sack, 0x0a0b0c0du);
+    END_TEST;
+}
+
+TEST_CASE(test_lossless) {
+    auto pair = MemoryTransport<Protocol>::make_pair();
+    pair.first->open();
+    pair.second->open();
+    ReliableMemory client(*pair.first);
+    ReliableMemory server(*pair.second);
+    client.open();
+    server.open();
+
+    client.send(std::vector<uint8_t>{0x01, 0x02, 0x03});
+    auto [frame, token] = server.receive(std::chrono::seconds(timeout));
+    assert_eq(frame.size(), 3);
+    assert_eq(frame[2], 0x03);
+
+    server.send(std::vector<uint8_t>{0x04}, token);
+    auto [frame2, token2] = client.receive(std::chrono::seconds(timeout));
+    assert_eq(frame2.size(), 1);
+    assert_eq(frame2[0], 0x04);
+
+    // resolved once the peer acknowledged it
+    SendFuture future = client.send_async(std::vector<uint8_t>{0x05, 0x06});
+    assert(future.wait_for(std::chrono::seconds(timeout)));
+    assert_eq(future.get(), 2);
+    assert_eq(server.receive(std::chrono::seconds(timeout)).first.size(), 2);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    ReliableStats stats = client.reliable_stats();
+    assert_eq(stats.retransmits, 0);
+    assert_eq(stats.in_flight, (size_t)0);
+    END_TEST;
+}
+
+TEST_CASE(test_restart) {
+    auto pair = MemoryTransport<Protocol>::make_pair();
+    pair.first->open();
+    pair.second->open();
+    ReliableMemory server(*pair.second);
+    server.open();
+    {
+        ReliableMemory client(*pair.first);
+        client.open();
+        for (int i = 0; i < 3; ++i) {
+            assert(client.send_async(numbered(i)).wait_for(std::chrono::seconds(timeout)));
+            assert_eq(number_of(server.receive(std::chrono::seconds(timeout)).first), i);
+        }
+    }
+
+    // a restarted sender numbers from 0 again, its frames are not duplicates
+    ReliableMemory client(*pair.first);
+    client.open();
+    for (int i = 10; i < 13; ++i) {
+        SendFuture future = client.send_async(numbered(i));
+        assert(future.wait_for(std::chrono::seconds(timeout)));
+        assert_eq(future.get(), 64);
+        assert_eq(number_of(server.receive(std::chrono::seconds(timeout)).first), i);
+    }
+    assert_eq(server.reliable_stats().peer_restarts, 1);
+    assert_eq(server.reliable_stats().duplicates, 0);
+    END_TEST;
+}
+
+TEST_CASE(test_lossy_in_order) {
+    MemoryLinkConfig config;
+    config.latency = std::chrono::milliseconds(2);
+    config.jitter = std::chrono::milliseconds(1);
+    config.loss = 0.2;
+    config.duplicate = 0.05;
+    config.reorder = 0.1;
+    config.seed = 42;
+    auto pair = MemoryTransport<Protocol>::make_pair(config);
+    pair.first->open();
+    pair.second->open();
+    ReliableMemory client(*pair.first);
+    ReliableMemory server(*pair.second);
+    client.open();
+    server.open();
+
+    const int count = 500;
+    for (int i = 0; i < count; ++i) {
+        client.send(numbered(i));
+    }
+    for (int i = 0; i < count; ++i) {
+        assert_eq(number_of(server.receive(std::chrono::seconds(timeout)).first), i);
+    }
+    bool extra = true;
+    try {
+        server.receive(std::chrono::milliseconds(100));
+    } catch (const QueueTimeout&) {
+        extra = false;
+    }
+    assert(!extra);
+
+    ReliableStats stats = client.reliable_stats();
+    assert_gt(stats.retransmits, 0);
+    assert_gt(stats.fast_retransmits, 0);
+    assert_eq(server.stats().frames_received, count);
+    assert_gt(server.reliable_stats().out_of_order, 0);
+    END_TEST;
+}
+
+TEST_CASE(test_rtt) {
+    MemoryLinkConfig config;
+    config.latency = std::chrono::milliseconds(20);
+    auto pair = MemoryTransport<Protocol>::make_pair(config);
+    pair.first->open();
+    pair.second->open();
+    ReliableMemory client(*pair.first);
+    ReliableMemory server(*pair.second);
+    client.open();
+    server.open();
+
+    for (int i = 0; i < 5; ++i) {
+        client.send(numbered(i));
+        server.receive(std::chrono::seconds(timeout));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    ReliableStats stats = client.reliable_stats();
+    assert_eq(stats.in_flight, (size_t)0);
+    assert_eq(stats.retransmits, 0);
+    assert_ge(stats.srtt_us, 40000);
+    assert_ls(stats.srtt_us, 80000);
+    assert_ge(stats.rto_us, stats.srtt_us);
+    END_TEST;
+}
+
+TEST_CASE(test_datagram) {
+    DatagramTransport<Protocol> server_udp, client_udp;
+    server_udp.bind("127.0.0.1", 12349);
+    client_udp.connect("127.0.0.1", 12349);
+    server_udp.open();
+    client_udp.open();
+    typedef ReliableTransport<Protocol, DatagramTransport<Protocol>> ReliableUdp;
+    ReliableUdp client(client_udp);
+    ReliableUdp server(server_udp);
+    client.open();
+    server.open();
+
+    for (int i = 0; i < 100; ++i) {
+        client.send(numbered(i));
+    }
+    for (int i = 0; i < 100; ++i) {
+        assert_eq(number_of(server.receive(std::chrono::seconds(timeout)).first), i);
+    }
+    server.send(numbered(-1));
+    assert_eq(number_of(client.receive(std::chrono::seconds(timeout)).first), -1);
+    END_TEST;
+}
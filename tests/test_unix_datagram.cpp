@@ -36,3 +36,78 @@ TEST_CASE(test_send_recv) {
     END_TEST;
     END_TEST;
 }
+
+TEST_CASE(test_kernel_timestamp) {
+    UnixDatagramTransport<Protocol> transport_server("/tmp/vxup_test2.sock", "");
+    UnixDatagramTransport<Protocol> transport_client("", "/tmp/vxup_test2.sock");
+    transport_server.set_timestamping(TimestampMode::SOFTWARE);
+    transport_server.open();
+    transport_client.open();
+    transport_client.send(std::vector<uint8_t>{0x01, 0x02});
+
+    auto entry = transport_server.receive_entry(std::chrono::seconds(3));
+    assert_eq(entry.first.size(), 2);
+    uint64_t now = timespec_ns({time(nullptr), 0});
+    assert_gt(entry.meta.kernel_time, now - 5000000000ull);
+    assert_ls(entry.meta.kernel_time, now + 5000000000ull);
+    assert(!entry.meta.kernel_raw);
+    END_TEST;
+}
+
+TEST_CASE(test_filter) {
+    UnixDatagramTransport<Protocol> transport_server("/tmp/vxup_test_filter.sock", "");
+    UnixDatagramTransport<Protocol> transport_client("", "/tmp/vxup_test_filter.sock");
+    // raw program: accept frames starting with 0x01
+    struct sock_filter code[] = {
+        {BPF_LD | BPF_B | BPF_ABS, 0, 0, 0},
+        {BPF_JMP | BPF_JEQ | BPF_K, 0, 1, 0x01},
+        {BPF_RET | BPF_K, 0, 0, 0xffffffff},
+        {BPF_RET | BPF_K, 0, 0, 0},
+    };
+    struct sock_fprog program = {4, code};
+    transport_server.attach_filter(program);
+    transport_server.open();
+    transport_client.open();
+
+    transport_client.send(std::vector<uint8_t>{0x02, 0x01});
+    transport_client.send(std::vector<uint8_t>{0x01, 0x02});
+    auto [frame, token] = transport_server.receive(std::chrono::seconds(3));
+    assert_eq(frame[0], 0x01);
+
+    // the builder, without a UDP header in front of the frame
+    SocketFilter filter;
+    filter.magic("\x02\x01", 2).length_field(2, 1, 1, 1);
+    transport_server.attach_filter(filter);
+    transport_client.send(std::vector<uint8_t>{0x01, 0x02, 0x01});
+    transport_client.send(std::vector<uint8_t>{0x02, 0x01, 0x02});
+    transport_client.send(std::vector<uint8_t>{0x02, 0x01, 0x01});
+    auto [frame2, token2] = transport_server.receive(std::chrono::seconds(3));
+    assert_eq(frame2[2], 0x01);
+    assert_eq(transport_server.stats().frames_received, 2);
+    END_TEST;
+}
+
+TEST_CASE(test_peers) {
+    UnixDatagramTransport<Protocol> transport_server("/tmp/vxup_test_peers.sock", "");
+    UnixDatagramTransport<Protocol> transport_client("/tmp/vxup_test_peers1.sock", "/tmp/vxup_test_peers.sock");
+    transport_server.open();
+    transport_client.open();
+    transport_client.send(std::vector<uint8_t>{0x01});
+    transport_client.send(std::vector<uint8_t>{0x02});
+
+    auto token = transport_server.receive(std::chrono::seconds(3)).second;
+    assert(transport_server.receive(std::chrono::seconds(3)).second == token);
+    assert(transport_server.peer("/tmp/vxup_test_peers1.sock") == token);
+    assert_eq(token->peer_state()->stats().frames_received, 2);
+
+    // unnamed sockets are one peer too
+    UnixDatagramTransport<Protocol> unnamed_client("", "/tmp/vxup_test_peers.sock");
+    unnamed_client.open();
+    unnamed_client.send(std::vector<uint8_t>{0x03});
+    unnamed_client.send(std::vector<uint8_t>{0x04});
+    auto unnamed = transport_server.receive(std::chrono::seconds(3)).second;
+    assert(transport_server.receive(std::chrono::seconds(3)).second == unnamed);
+    assert(unnamed != token);
+    assert_eq(transport_server.peer_count(), (size_t)2);
+    END_TEST;
+}
@@ -0,0 +1,55 @@
+#include <stdio.h>
+#include <string.h>
+#include <memory>
+#include <queue>
+#include <string>
+#include <vector>
+#include "logging/binary.hpp"
+
+using namespace logging;
+
+// merge per-thread binary logs by timestamp and print them as text
+int main(int argc, const char** argv)
+{
+    if (argc < 2 || strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0) {
+        fprintf(stderr, "usage: %s FILE...\n", argv[0]);
+        return argc < 2;
+    }
+
+    struct Cursor
+    {
+        std::unique_ptr<binary::Reader> reader;
+        Record record;
+    };
+    std::vector<Cursor> cursors;
+    for (int i = 1; i < argc; ++i) {
+        try {
+            Cursor cursor = {std::unique_ptr<binary::Reader>(new binary::Reader(argv[i])),
+                             Record("", LogLevel::UNKNOWN, "")};
+            if (cursor.reader->next(cursor.record))
+                cursors.push_back(std::move(cursor));
+        } catch (const std::exception& e) {
+            fprintf(stderr, "%s\n", e.what());
+            return 1;
+        }
+    }
+
+    auto later = [&cursors](size_t a, size_t b) {
+        return cursors[a].record.time > cursors[b].record.time;
+    };
+    std::priority_queue<size_t, std::vector<size_t>, decltype(later)> heap(later);
+    for (size_t i = 0; i < cursors.size(); ++i)
+        heap.push(i);
+
+    std::string line;
+    while (!heap.empty()) {
+        size_t i = heap.top();
+        heap.pop();
+        line.clear();
+        format_record(line, cursors[i].record);
+        fwrite(line.data(), 1, line.size(), stdout);
+        if (cursors[i].reader->next(cursors[i].record))
+            heap.push(i);
+    }
+    return 0;
+}